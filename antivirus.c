@@ -1,26 +1,110 @@
+#ifndef _WIN32
+#define _GNU_SOURCE // fanotify and other POSIX/Linux extensions
+#endif
+
+#include "libantivirus.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stddef.h>
 
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/fanotify.h>
+#endif
+
 /**
- * @def MAX_SIGNATURE_LENGTH
- * @brief Maximum length (in bytes) of a virus signature.
+ * @def MAX_FS_ADRESS_SIZE
+ * @brief Maximum length (in characters) of a file system path or address.
  */
-#define MAX_SIGNATURE_LENGTH 8
+#define MAX_FS_ADRESS_SIZE 256
 
 /**
- * @def MAX_VIRUS_NAME_LENGTH
- * @brief Maximum length (in characters) of a virus name string.
+ * @def VERDICT_CACHE_SIZE
+ * @brief Number of slots in the on-access verdict cache (power of two).
  */
-#define MAX_VIRUS_NAME_LENGTH 256
+#define VERDICT_CACHE_SIZE 4096
 
 /**
- * @def MAX_FS_ADRESS_SIZE
- * @brief Maximum length (in characters) of a file system path or address.
+ * @def SCAN_QUEUE_SIZE
+ * @brief Maximum number of fanotify events waiting for a worker.
  */
-#define MAX_FS_ADRESS_SIZE 256
+#define SCAN_QUEUE_SIZE 1024
+
+/**
+ * @def DEFAULT_ON_ACCESS_WORKERS
+ * @brief Number of on-access scanning threads when none is given.
+ */
+#define DEFAULT_ON_ACCESS_WORKERS 4
+
+/**
+ * @def MAX_ON_ACCESS_WORKERS
+ * @brief Upper limit of on-access scanning threads.
+ */
+#define MAX_ON_ACCESS_WORKERS 64
+
+/**
+ * @def DEFAULT_ON_ACCESS_BUDGET_MS
+ * @brief Time (in milliseconds) an exec may wait for a verdict before it is allowed unscanned.
+ */
+#define DEFAULT_ON_ACCESS_BUDGET_MS 200
+
+/**
+ * @def DEFAULT_BULK_BUDGET_MS
+ * @brief Time (in milliseconds) a background scan of a written file may take, queueing included.
+ */
+#define DEFAULT_BULK_BUDGET_MS 30000
+
+/**
+ * @def SWEEP_MAX_PATH
+ * @brief Maximum length (in characters) of a path visited by a sweep.
+ */
+#define SWEEP_MAX_PATH 4096
+
+/**
+ * @def JOURNAL_BUFFER_SIZE
+ * @brief Bytes of sweep journal records buffered before they are written.
+ */
+#define JOURNAL_BUFFER_SIZE 65536
+
+/**
+ * @def JOURNAL_BATCH_RECORDS
+ * @brief Number of journal records written per fdatasync().
+ */
+#define JOURNAL_BATCH_RECORDS 1024
+
+/**
+ * @def JOURNAL_BATCH_MS
+ * @brief Longest time (in milliseconds) a journal record waits in the buffer.
+ */
+#define JOURNAL_BATCH_MS 1000
+
+/**
+ * @def DEFAULT_SWEEP_PLAN_DEPTH
+ * @brief Depth below the root of the work items of a new sweep journal.
+ */
+#define DEFAULT_SWEEP_PLAN_DEPTH 1
+
+/**
+ * @def DEFAULT_TRACE_EVENTS
+ * @brief Spans kept per thread by --trace (older spans are overwritten).
+ */
+#define DEFAULT_TRACE_EVENTS 16384
+
 /**
  * @def STR2
  * @brief Converts a token to a string literal.
@@ -59,187 +143,161 @@
  */
 #define STR(x) STR2(x)
 
-
 /**
- * @brief Represents a virus signature.
+ * @enum Error_Codes_OA
+ * @brief Error codes for the run_on_access() function.
+ *
+ * OA - On-Access scanning.
  *
- * Contains a byte array for the signature, an offset where the signature should be located,
- * and the virus name.
+ * @see run_on_access() for function utilizing these error codes.
+ * @retval Error_Codes_OA See the enum for possible return values.
  */
-typedef struct
+enum Error_Codes_OA
 {
-    unsigned char signature[MAX_SIGNATURE_LENGTH]; /**< Byte array representing the virus signature. */
-    size_t offset; /**< Offset in the file where the signature is expected. */
-    char virus_name[MAX_VIRUS_NAME_LENGTH]; /**< Name of the virus. */
-} VirusSignature;
+    /** @brief No errors, scanning stopped by SIGINT/SIGTERM. */
+    OA_SUCCESS = 0,
 
-/**
- * @brief Here is a list of all enums with links to the files they belong to:
- *
- * - The error naming convention follows this pattern:
- *   The error is named by the current function (CF) + the error function (EF) = CF_VARIABLE_EF_ERROR:
- *   Example: Error with the OFFSET variable in the FSCANF function.
- *   RS - Read Signature (current function), fscanf(file, "%zx", &vs->offset) - error function.
- *   The error name will be: RS_OFFSET_FSCANF_ERROR.
- *
- * - If there is an error with the variable value, the following naming convention is used:
- *   Current function (CF) + error value (EV) + variable name (VN) = CF_EV_VN:
- *   Example: Error with the variable FILE_PATH (VN) - NULL POINTER (EV) in the current function RS (Read Signature; CF).
- *   The error will be named: RS_NULL_FILE_PATH_POINTER.
- *
- * - For special return values, I will also use an enum for simplification.
- */
+    /** @brief Signature file path argument is NULL. */
+    OA_NULL_SIGN_PATH_POINTER = 1,
 
-/**
- * @enum Error_Codes_RS
- * @brief Error codes for the read_signature() function.
- *
- * These codes represent different failure scenarios that might occur
- * when reading a virus signature from a file.
- *
- * @note Each error code corresponds to a specific issue during file handling or
- *       signature parsing. Use these error codes to troubleshoot issues with
- *       file reading operations in the `read_signature` function.
- *
- * @see read_signature() for function utilizing these error codes.
- * @retval Error_Codes_RS See the enum for possible return values.
- */
-enum Error_Codes_RS
-{
-    /** @brief No errors, function completed successfully. */
-    RS_SUCCESS = 0,
+    /** @brief Mount point path argument is NULL. */
+    OA_NULL_MOUNT_PATH_POINTER = 2,
+
+    /** @brief Failed to load the signature base. */
+    OA_SIGNATURE_BASE_ERROR = 3,
 
-    /** @brief File path argument is NULL. */
-    RS_NULL_FILE_PATH_POINTER = 1,
+    /** @brief Failed to create fanotify group (needs CAP_SYS_ADMIN). */
+    OA_FANOTIFY_INIT_ERROR = 4,
 
-    /** @brief Virus structure pointer is NULL. */
-    RS_NULL_VSTRUCT_POINTER = 2,
+    /** @brief Failed to mark the mount point for fanotify events. */
+    OA_FANOTIFY_MARK_ERROR = 5,
 
-    /** @brief Failed to open file. */
-    RS_FILE_FOPEN_ERROR = 3,
+    /** @brief Failed to create the scanning engine, the verdict cache or the event queue. */
+    OA_CONTEXT_MALLOC_ERROR = 6,
 
-    /** @brief Failed to read signature from file. */
-    RS_SIGNATURE_FSCANF_ERROR = 4,
+    /** @brief Failed to start a worker thread. */
+    OA_WORKER_CREATE_ERROR = 7,
 
-    /** @brief Failed to set file-position-indicator (offset). */
-    RS_OFFSET_FSCANF_ERROR = 5,
+    /** @brief Failed to read events from the fanotify descriptor. */
+    OA_EVENT_READ_ERROR = 8,
 
-    /** @brief Failed to read virus name from file. */
-    RS_VNAME_FSCANF_ERROR = 6,
+    /** @brief On-access scanning is not supported on this platform. */
+    OA_NOT_SUPPORTED = 9,
 
-    /** @brief Failed to close file descriptor. */
-    RS_FILE_FCLOSE_ERROR = 7
+    /** @brief NUMA placement was requested but the topology could not be read. */
+    OA_NUMA_ERROR = 10
 };
 
 /**
- * @enum Error_Codes_EXE
- * @brief Error codes for the is_exec() function.
+ * @enum Error_Codes_SW
+ * @brief Error codes for the run_sweep() function.
  *
- * These codes represent different failure scenarios that might occur
- * when checking 2 firsts bytes of file (Checking file if it's executable permission)
+ * SW - Sweep of a directory tree with a checkpoint journal.
  *
- * @see is_exec() for function utilizing these error codes.
- * @retval Error_Codes_EXE See the enum for possible return values.
+ * @see run_sweep() for function utilizing these error codes.
+ * @retval Error_Codes_SW See the enum for possible return values.
  */
-enum Error_Codes_EXE
+enum Error_Codes_SW
 {
-    /** @brief No errors, function completed successfully. */
-    EXE_SUCCESS = 0,
+    /** @brief No errors, every work item of this shard is completed. */
+    SW_SUCCESS = 0,
 
-    /** @brief File path argument is NULL. */
-    EXE_NULL_FILE_PATH_POINTER = 1,
+    /** @brief Signature file path argument is NULL. */
+    SW_NULL_SIGN_PATH_POINTER = 1,
 
-    /** @brief Execution flag pointer is NULL. */
-    EXE_NULL_EFLAG_POINTER = 2,
+    /** @brief Journal path argument is NULL. */
+    SW_NULL_JOURNAL_PATH_POINTER = 2,
 
-    /** @brief Failed to open the specified file. */
-    EXE_FILE_FOPEN_ERROR = 3,
+    /** @brief Failed to load the signature base. */
+    SW_SIGNATURE_BASE_ERROR = 3,
 
-    /** @brief Failed to read data from the file into the buffer. */
-    EXE_BUFFER_FREAD_ERROR = 4,
+    /** @brief Failed to open or create the journal. */
+    SW_JOURNAL_OPEN_ERROR = 4,
 
-    /** @brief Failed to close the file descriptor. */
-    EXE_FILE_FCLOSE_ERROR = 5,
-};
+    /** @brief Failed to read the journal. */
+    SW_JOURNAL_READ_ERROR = 5,
 
-/**
- * @enum Error_Codes_CFS
- * @brief Error codes for the calculate_file_size() function.
- *
- * CFS - Calculate File Size.
- * These error codes help to identify various issues that can occur
- * while determining the size of a file.
- *
- * @note Each error code corresponds to a specific failure during file
- *       handling or file size calculation.
- *
- * @see calculate_file_size() for function utilizing these error codes.
- * @retval Error_Codes_CFS See the enum for possible return values.
- */
-enum Error_Codes_CFS
-{
-    /** @brief No errors, function completed successfully. */
-    CFS_SUCCESS = 0,
+    /** @brief Failed to write, sync or truncate the journal. */
+    SW_JOURNAL_WRITE_ERROR = 6,
+
+    /** @brief Failed to allocate the engine, the path sets or the work items. */
+    SW_MALLOC_ERROR = 7,
 
-    /** @brief The file path argument is NULL. */
-    CFS_NULL_FILE_PATH_POINTER = 1,
+    /** @brief Shard is not below the number of shards. */
+    SW_INVALID_SHARD = 8,
 
-    /** @brief The file size pointer argument is NULL. */
-    CFS_NULL_FILE_SIZE_POINTER = 2,
+    /** @brief The journal has no work items and the root cannot be read. */
+    SW_ROOT_ERROR = 9,
 
-    /** @brief The file could not be opened. */
-    CFS_FILE_FOPEN_ERROR = 3,
+    /** @brief Stopped by SIGINT/SIGTERM; the journal is synced and the sweep can be resumed. */
+    SW_INTERRUPTED = 10,
+
+    /** @brief Sweeping is not supported on this platform. */
+    SW_NOT_SUPPORTED = 11
+};
 
-    /** @brief Failed to set file position to the end of the file. */
-    CFS_END_FSEEK_ERROR = 4,
+/**
+ * @enum Detection_Actions
+ * @brief What is done with an infected file after it is reported.
+ */
+enum Detection_Actions
+{
+    /** @brief Only report the detection. */
+    ACTION_REPORT = 0,
 
-    /** @brief Failed to obtain the current value of the file-position indicator. */
-    CFS_SIZE_FTELL_ERROR = 5,
+    /** @brief Move the file into a quarantine directory, with a metadata sidecar. */
+    ACTION_QUARANTINE = 1,
 
-    /** @brief The file could not be closed properly. */
-    CFS_FILE_FCLOSE_ERROR = 6
+    /** @brief Truncate the file to zero bytes. */
+    ACTION_TRUNCATE = 2
 };
 
 /**
- * @enum Error_Codes_SF
- * @brief Error codes for the scan_file() function.
- *
- * SF - Scan File.
- * These error codes are used to report results and errors during
- * the process of scanning a file for virus signatures.
+ * @enum Error_Codes_ACT
+ * @brief Error codes for the run_action() function.
  *
- * @note These error codes are specifically associated with the
- * scanning process and help in identifying different types of failures
- * or issues during file scanning.
+ * ACT - Action on an infected file.
  *
- * @see scan_file() for function utilizing these error codes.
- * @retval Error_Codes_SF See the enum for possible return values.
+ * @see run_action() for function utilizing these error codes.
+ * @retval Error_Codes_ACT See the enum for possible return values.
  */
-enum Error_Codes_SF
+enum Error_Codes_ACT
 {
-    /** @brief No errors, function completed successfully. */
-    SF_SUCCESS = 0,
+    /** @brief No errors, the action is done. */
+    ACT_SUCCESS = 0,
+
+    /** @brief Path, virus name or quarantine directory argument is NULL. */
+    ACT_NULL_ARGUMENT_POINTER = 1,
+
+    /** @brief Failed to get the status of the scanned descriptor. */
+    ACT_STAT_ERROR = 2,
+
+    /** @brief Failed to create or open the quarantine directory. */
+    ACT_QUARANTINE_DIR_ERROR = 3,
 
-    /** @brief The file path argument is NULL. */
-    SF_NULL_FILE_PATH_POINTER = 1,
+    /** @brief The quarantine directory is on another file system (files are never copied). */
+    ACT_CROSS_DEVICE = 4,
 
-    /** @brief The virus structure pointer is NULL. */
-    SF_NULL_VSTRUCT_POINTER = 2,
+    /** @brief Failed to rename or link the file into the quarantine directory. */
+    ACT_MOVE_ERROR = 5,
 
-    /** @brief The Virus Flag pointer is NULL. */
-    SF_NULL_VFLAG_POINTER = 3,
+    /** @brief The file is linked into quarantine but its original path could not be removed. */
+    ACT_UNLINK_ERROR = 6,
 
-    /** @brief The file could not be opened. */
-    SF_FILE_FOPEN_ERROR = 4,
+    /** @brief The file is quarantined but its metadata sidecar could not be written. */
+    ACT_SIDECAR_ERROR = 7,
 
-    /** @brief Failed to set the file position to the given offset. */
-    SF_OFFSET_FSEEK_ERROR = 5,
+    /** @brief The path no longer names the scanned file. */
+    ACT_FILE_CHANGED = 8,
 
-    /** @brief Failed to read the signature from the file buffer. */
-    SF_BUFFER_FREAD_ERROR = 6,
+    /** @brief Failed to open the file for writing or to truncate it. */
+    ACT_TRUNCATE_ERROR = 9,
 
-    /** @brief The file could not be closed properly during scanning. */
-    SF_FILE_FCLOSE_ERROR = 7,
+    /** @brief Actions are not supported on this platform. */
+    ACT_NOT_SUPPORTED = 10,
+
+    /** @brief The file was deleted after the scan (no links left), there is nothing to quarantine. */
+    ACT_FILE_DELETED = 11
 };
 
 /**
@@ -250,7 +308,8 @@ enum Error_Codes_SF
  *
  * These error codes represent various failure cases encountered during the
  * execution of the main function, including issues with printing messages,
- * reading files, and invoking specific subroutines (e.g., read_signature and scan_file).
+ * reading paths, and invoking the library (e.g., av_engine_load and av_scan_path).
+ * Values of codes that no longer occur are not reused, so exit codes stay stable.
  *
  * @note These error codes help to diagnose and handle issues related to input/output operations,
  * file scanning, and printing results to the user.
@@ -275,740 +334,2652 @@ enum Error_Codes_Main
     /** @brief Failed to scan the target file path for possible virus. */
     MAIN_TARG_SCANF_ERROR = 4,
 
-    /** @brief Failed to print that file is safe(NOT PE). */
-    MAIN_NOT_PE_PRINTF_ERROR = 5,
+    /** @brief Failed to print that the file is safe(NO VIRUS). */
+    MAIN_OK_PRINTF_ERROR = 13,
+
+    /** @brief Failed to print that the file is not safe. */
+    MAIN_VIRUS_PRINTF_ERROR = 14,
 
-    /** @brief Failed to print the error message related to is_exec(). */
-    MAIN_EXEC_PRINTF_ERROR = 6,
+    /** @brief Failed to print the error message from av_scan_path(). */
+    MAIN_SF_PRINTF_ERROR = 15,
 
-    /** @brief An error occurred in the is_exec() function. */
-    MAIN_EXEC_ERROR = 7,
+    /** @brief An error occurred while scanning the target file in av_scan_path(). */
+    MAIN_SF_ERROR = 16,
 
-    /** @brief Failed to print the error message related to read_signature(). */
-    MAIN_RS_PRINTF_ERROR = 8,
+    /** @brief Failed to print the error message related to av_engine_create() or av_engine_load(). */
+    MAIN_RSB_PRINTF_ERROR = 17,
 
-    /** @brief An error occurred in the read_signature() function. */
-    MAIN_RS_ERROR = 9,
+    /** @brief An error occurred in av_engine_create() or av_engine_load() (signature base). */
+    MAIN_RSB_ERROR = 18,
 
-    /** @brief Failed to print that file is safe(SMALL SIZE). */
-    MAIN_SMALL_SIZE_PRINTF_ERROR = 10,
+    /** @brief Failed to print the error message about opening the target file. */
+    MAIN_RFH_PRINTF_ERROR = 19,
 
-    /** @brief Failed to print the error message related to calculate_file_size(). */
-    MAIN_CFS_PRINTF_ERROR = 11,
+    /** @brief The target file could not be opened by av_scan_path(). */
+    MAIN_RFH_ERROR = 20,
 
-    /** @brief An error occurred in the calculate_file_size() function. */
-    MAIN_CFS_ERROR = 12,
+    /** @brief Failed to print the error message related to run_on_access(). */
+    MAIN_OA_PRINTF_ERROR = 23,
 
-    /** @brief Failed to print that the file is safe(NO VIRUS). */
-    MAIN_OK_PRINTF_ERROR = 13,
+    /** @brief An error occurred in the run_on_access() function. */
+    MAIN_OA_ERROR = 24,
 
-    /** @brief Failed to print that the file is not safe. */
-    MAIN_VIRUS_PRINTF_ERROR = 14,
+    /** @brief Failed to print that the file looks packed. */
+    MAIN_PACKED_PRINTF_ERROR = 27,
 
-    /** @brief Failed to print the error message from scan_file(). */
-    MAIN_SF_PRINTF_ERROR = 15,
+    /** @brief Failed to print the error message related to run_sweep(). */
+    MAIN_SW_PRINTF_ERROR = 28,
 
-    /** @brief An error occurred during the scan_file() function. */
-    MAIN_SF_ERROR = 16
-};
+    /** @brief An error occurred in the run_sweep() function. */
+    MAIN_SW_ERROR = 29,
 
-// Declare all functions here:
-int read_signature(const char *file_path, VirusSignature *vs); // Reads a virus signature from a specified file.
+    /** @brief Failed to print the outcome of run_action(). */
+    MAIN_ACT_PRINTF_ERROR = 30,
 
-int is_exec(const char *file_path, int *exe_flag); // Checks if the specified file has execution permissions.
+    /** @brief The infected file could not be quarantined or truncated, or the action option is incomplete. */
+    MAIN_ACT_ERROR = 31,
 
-int calculate_file_size(const char *file_path, size_t *file_size); // Calculates the size of a file specified by the file path.
+    /** @brief Failed to output the message of a tracing error. */
+    MAIN_TRACE_PRINTF_ERROR = 32,
+
+    /** @brief Tracing is not supported, or the trace option is incomplete. */
+    MAIN_TRACE_ERROR = 33
+};
 
-int scan_file(const char *file_path, VirusSignature *vs, int *virus_flag); // Scans a file specified by the file path for virus signatures.
+// Declare all functions here:
+int run_on_access(const char *sign_path, const char *mount_path, size_t workers, long budget_ms,
+                  uint64_t io_bytes_per_second, uint64_t io_reads_per_second, int numa_flag,
+                  int detection_action, const char *quarantine_dir); // Runs fanotify on-access scanning.
+int run_sweep(const char *sign_path, const char *journal_path, const char *root_path,
+              size_t shard, size_t shard_count, size_t plan_depth,
+              int detection_action, const char *quarantine_dir); // Sweeps a tree with a checkpoint journal.
+int run_action(int action, const char *quarantine_dir, int fd, const char *path,
+               const char *virus_name); // Quarantines or truncates an infected file.
+int report_action(int action, const char *quarantine_dir, int result, const char *path,
+                  int line_start); // Prints the outcome of run_action().
+void write_trace(void); // Writes the trace file of --trace (run at exit).
+
+static const char *trace_path = NULL; // --trace file, NULL = not tracing
+static int trace_format = AV_TRACE_CHROME;
 
 /**
  * @brief Entry point of the antivirus scanner.
  *
  * Prompts user for paths to the signature and target file.
  * Reports whether a virus is found based on the provided signature.
+ * All scanning is done by libantivirus (see libantivirus.h); this is a thin client.
+ *
+ * Started as
+ * @code
+ * antivirus --on-access <signature file> <mount point> [workers] [budget ms] [read MB/s] [read IOPS] [numa]
+ * @endcode
+ * the program instead runs on-access scanning of the mount point until SIGINT/SIGTERM
+ * (see run_on_access()). Started as
+ * @code
+ * antivirus --sweep <signature file> <journal> <root> [shard/shards] [plan depth]
+ * @endcode
+ * it scans the whole tree under root, recording progress in the journal so that
+ * the same command resumes an interrupted sweep (see run_sweep()).
  *
+ * In every mode, a leading "--quarantine <dir>" or "--truncate" option runs that
+ * action on each infected file (see run_action()).
+ * A leading "--trace <file>" or "--trace-folded <file>" option records where the
+ * time of every scanned file goes (open, header, reads, matching, output) and writes
+ * it at exit as Chrome trace-event JSON or as folded stacks for flamegraph.pl
+ * (see av_trace_enable() and write_trace()).
+ *
+ * @param [in] argc Number of command line arguments.
+ * @param [in] argv Command line arguments.
  * @return Error code from @ref Error_Codes_Main.
  */
-int main()
+int main(int argc, char *argv[])
 {
     // Declare all the variables:
-    VirusSignature vs;
+    AvEngine *engine = NULL;
+    AvScanResult scan;
     char sign_path[MAX_FS_ADRESS_SIZE];
     char target_path[MAX_FS_ADRESS_SIZE];
-    int result, exe_flag = 0, virus_flag = 0;
+    int result;
     const char *message;
-    size_t file_size = 0;
+    size_t i;
+    size_t shard = 0, shard_count = 1;
+    char *end;
+    const char *quarantine_dir = NULL;
+    int action = ACTION_REPORT;
+    int fd = -1;
     int ch;
+#ifndef _WIN32
+    uint64_t span;
+#endif
 
-    message = "Welcome to the virus scanner program!\n\n"
-              "This program scans files on your computer to check for viruses.\n"
-              "Viruses have unique \"signatures\" - special sequences of numbers that the program can recognize.\n"
-              "The program will search for these virus signatures in the file you select.\n"
-              "If it finds a virus, it will alert you.\n"
-              "If no viruses are found, the program will tell you the file is clean.\n"
-              "Note: The program only supports file names/paths that consist\n"
-              "solely of Latin alphabet letters. Any other characters will result in a file reading error.\n\n"
-              "Enter path to signature file: \n"
-              "Example: signature.txt or D:\\Bin1\\Bin2\\signature.txt\n";
-
-    if (printf("%s",message) < 0)
-    {
-        printf("\nError in function:\n"
-               "int printf(const char *restrict format, ...);\n"
-               "Desciption: Failed to output message\n");
-        return MAIN_SIGN_PRINTF_ERROR; // 1
-    }
-
-    if (scanf("%" STR(MAX_FS_ADRESS_SIZE) "[^\n]", sign_path) != 1)
-    {
-        printf("\nError in function:\n"
-               "int scanf(const char *restrict format, ...);\n"
-               "Desciption: Failed to reading signature file path\n");
-        return MAIN_SIGN_SCANF_ERROR; // 2
-    }
-
-    while ((ch = getchar()) != '\n' && ch != EOF);
-
-    message = "\nEnter path to target file: \n"
-              "Example: target.exe OR C:\\Bin1\\Bin2\\target.exe\n";
-
-    if (printf("%s", message) < 0)
-    {
-       printf("\nError in function:\n"
-              "int printf(const char *restrict format, ...);\n"
-              "Description: Failed to output message\n");
-       return MAIN_TARG_PRINTF_ERROR; // 3
-    }
-
-    if (scanf("%" STR(MAX_FS_ADRESS_SIZE) "[^\n]", target_path) != 1)
+    while (argc >= 2 && (strcmp(argv[1], "--quarantine") == 0 || strcmp(argv[1], "--truncate") == 0 ||
+                         strcmp(argv[1], "--trace") == 0 || strcmp(argv[1], "--trace-folded") == 0))
     {
-        printf("\nError in function:\n"
-               "int scanf(const char *restrict format, ...);\n"
-               "Description: Failed to reading signature file path\n");
-        return MAIN_TARG_SCANF_ERROR; // 4
+        if (strcmp(argv[1], "--trace") == 0 || strcmp(argv[1], "--trace-folded") == 0)
+        {
+            if (argc < 3)
+            {
+                if (printf("\nError in variable:\n"
+                           "const char *trace_path;\n"
+                           "Description: %s needs a file\n", argv[1]) < 0)
+                {
+                    return MAIN_TRACE_PRINTF_ERROR; // 32
+                }
+                return MAIN_TRACE_ERROR; // 33
+            }
+            trace_format = (strcmp(argv[1], "--trace") == 0) ? AV_TRACE_CHROME : AV_TRACE_FOLDED;
+            trace_path = argv[2];
+            argv += 2;
+            argc -= 2;
+        }
+        else if (strcmp(argv[1], "--truncate") == 0)
+        {
+            action = ACTION_TRUNCATE;
+            argv++;
+            argc--;
+        }
+        else if (argc >= 3)
+        {
+            action = ACTION_QUARANTINE;
+            quarantine_dir = argv[2];
+            argv += 2;
+            argc -= 2;
+        }
+        else
+        {
+            if (printf("\nError in variable:\n"
+                       "const char *quarantine_dir;\n"
+                       "Description: --quarantine needs a directory\n") < 0)
+            {
+                return MAIN_ACT_PRINTF_ERROR; // 30
+            }
+            return MAIN_ACT_ERROR; // 31
+        }
     }
 
-    while ((ch = getchar()) != '\n' && ch != EOF);
-
-    // 1) MZ check (is_exec) -> 2) file size (CFS) -> 3) signatura (SF)
-    result = is_exec(target_path, &exe_flag);
-    if (result == 0)
+    if (trace_path != NULL)
     {
-        if (exe_flag == 0) // flag = 1 is executable or = 0 if it's not -> file is safe
+        result = av_trace_enable(DEFAULT_TRACE_EVENTS);
+        if (result != AV_SUCCESS || atexit(write_trace) != 0)
         {
-            if (printf("\nAll OK, FILE(%s) is safe", target_path) < 0)
+            if (printf("\nError in function:\n"
+                       "int av_trace_enable(size_t events_per_thread);\n"
+                       "Description: %s\n",
+                       (result != AV_SUCCESS) ? av_strerror(result) : "Failed to register the trace writer") < 0)
             {
-                printf("\nError in function:\n"
-                       "int printf(const char *restrict format, ...);\n"
-                       "Description: Failed to output message\n");
-                return MAIN_NOT_PE_PRINTF_ERROR; // 5
+                return MAIN_TRACE_PRINTF_ERROR; // 32
             }
-            return MAIN_SUCCESS; // file is safe -> program is over
+            return MAIN_TRACE_ERROR; // 33
         }
     }
-    else // if result != EXE_SUCCESS / 0
+
+    if (argc >= 4 && strcmp(argv[1], "--on-access") == 0)
     {
-        switch(result)
+        result = run_on_access(argv[2], argv[3],
+                               (argc >= 5) ? strtoul(argv[4], NULL, 10) : DEFAULT_ON_ACCESS_WORKERS,
+                               (argc >= 6) ? strtol(argv[5], NULL, 10) : DEFAULT_ON_ACCESS_BUDGET_MS,
+                               (argc >= 7) ? strtoull(argv[6], NULL, 10) * 1000000u : 0,
+                               (argc >= 8) ? strtoull(argv[7], NULL, 10) : 0,
+                               (argc >= 9) && strcmp(argv[8], "numa") == 0,
+                               action, quarantine_dir);
+        if (result == OA_SUCCESS)
+        {
+            return MAIN_SUCCESS; // 0
+        }
+
+        switch (result)
         {
-            case EXE_NULL_FILE_PATH_POINTER: // case 1
+            case OA_NULL_SIGN_PATH_POINTER: // case 1
             {
                 message = "\nError in variable:\n"
-                          "const char *file_path;\n"
+                          "const char *sign_path;\n"
                           "Description: Signature file path pointer is NULL\n";
                 break;
             }
-            case EXE_NULL_EFLAG_POINTER: // case 2
+            case OA_NULL_MOUNT_PATH_POINTER: // case 2
             {
                 message = "\nError in variable:\n"
-                          "int *exe_flag;\n"
-                          "Description: Exe flag pointer is NULL\n";
+                          "const char *mount_path;\n"
+                          "Description: Mount point path pointer is NULL\n";
                 break;
             }
-            case EXE_FILE_FOPEN_ERROR: // case 3
+            case OA_SIGNATURE_BASE_ERROR: // case 3
             {
                 message = "\nError in function:\n"
-                          "FILE *fopen(const char *restrict pathname, const char *restrict mode);\n"
-                          "Description: Failed to open target file\n";
+                          "int av_engine_load(AvEngine *engine, const char *sign_path);\n"
+                          "Description: Failed to load signature file\n";
                 break;
             }
-            case EXE_BUFFER_FREAD_ERROR: // case 4
+            case OA_FANOTIFY_INIT_ERROR: // case 4
             {
                 message = "\nError in function:\n"
-                          "size_t fread( void * ptrvoid, size_t size, size_t count, FILE * filestream);"
-                          "Description: Failed to read bytes in target file\n";
+                          "int fanotify_init(unsigned int flags, unsigned int event_f_flags);\n"
+                          "Description: Failed to create fanotify group (root is required)\n";
                 break;
             }
-            case EXE_FILE_FCLOSE_ERROR: // case 5
+            case OA_FANOTIFY_MARK_ERROR: // case 5
             {
                 message = "\nError in function:\n"
-                          "int fclose(FILE *stream);\n"
-                          "Description: Failed to close signature file\n";
+                          "int fanotify_mark(int fanotify_fd, unsigned int flags, uint64_t mask, int dirfd, const char *pathname);\n"
+                          "Description: Failed to watch mount point\n";
                 break;
             }
-            default:
+            case OA_CONTEXT_MALLOC_ERROR: // case 6
             {
                 message = "\nError in function:\n"
-                          "int is_exec(const char *file_path, int *exe_flag)\n"
-                          "Description: Unknown error occurred while reading signature\n";
+                          "void *calloc(size_t nelem, size_t elsize);\n"
+                          "Description: Failed to allocate scanning engine, verdict cache or event queue\n";
                 break;
             }
-        } // switch
-
-        if (printf("%s", message) < 0)
-        {
-            printf("\nError in function:\n"
-                   "int printf(const char *restrict format, ...);\n"
-                   "Desciption: Failed to output message\n");
-            return MAIN_EXEC_PRINTF_ERROR; // 6
-        }
-
-        return MAIN_EXEC_ERROR; // 7
-    } // if
-
-    result = read_signature(sign_path, &vs);
-    if (result != RS_SUCCESS) // result != 0
-    {
-        switch(result)
-        {
-            case RS_NULL_FILE_PATH_POINTER: // case 1
+            case OA_WORKER_CREATE_ERROR: // case 7
             {
-                message = "\nError in variable:\n"
-                          "const char *file_path;\n"
-                          "Description: Signature file path pointer is NULL\n";
+                message = "\nError in function:\n"
+                          "int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine)(void *), void *arg);\n"
+                          "Description: Failed to start worker thread\n";
+                break;
+            }
+            case OA_EVENT_READ_ERROR: // case 8
+            {
+                message = "\nError in function:\n"
+                          "ssize_t read(int fildes, void *buf, size_t nbyte);\n"
+                          "Description: Failed to read fanotify events\n";
+                break;
+            }
+            case OA_NOT_SUPPORTED: // case 9
+            {
+                message = "\nError in function:\n"
+                          "int run_on_access(const char *sign_path, const char *mount_path, size_t workers, long budget_ms, ...);\n"
+                          "Description: On-access scanning requires Linux with fanotify\n";
+                break;
+            }
+            case OA_NUMA_ERROR: // case 10
+            {
+                message = "\nError in function:\n"
+                          "int av_engine_set_numa(AvEngine *engine);\n"
+                          "Description: Failed to read the NUMA topology from /sys/devices/system/node\n";
                 break;
             }
-            case RS_NULL_VSTRUCT_POINTER: // case 2
-                {
-                    message = "\nError in variable:\n"
-                              "VirusSignature *vs;\n"
-                              "Description: Virus structure pointer is NULL\n";
-                    break;
-                }
-            case RS_FILE_FOPEN_ERROR: // case 3
-                {
-                    message = "\nError in function:\n"
-                              "FILE *fopen(const char *restrict pathname, const char *restrict mode);\n"
-                              "Description: Failed to open signature file\n";
-                    break;
-                }
-            case RS_SIGNATURE_FSCANF_ERROR: // case 4
-                {
-                    message = "\nError in function:\n"
-                              "int fscanf(FILE *restrict stream, const char *restrict format, ...);\n"
-                              "Description: Failed to read signature from file\n";
-                    break;
-                }
-            case RS_OFFSET_FSCANF_ERROR: // case 5
-                {
-                    message = "\nError in function:\n"
-                              "int fscanf(FILE *restrict stream, const char *restrict format, ...);\n"
-                              "Description: Failed to read offset from file\n";
-                    break;
-                }
-            case RS_VNAME_FSCANF_ERROR: // case 6
-                {
-                    message = "\nError in function:\n"
-                              "int fscanf(FILE *restrict stream, const char *restrict format, ...);\n"
-                              "Description: Failed to read virus name from file\n";
-                    break;
-                }
-            case RS_FILE_FCLOSE_ERROR: // case 7
-                {
-                    message = "\nError in function:\n"
-                              "int fclose(FILE *stream);\n"
-                              "Description: Failed to close signature file\n";
-                    break;
-                }
             default:
-                {
+            {
                 message = "\nError in function:\n"
-                          "int read_signature(const char *file_path, VirusSignature *vs)\n"
-                          "Description: Unknown error occurred while reading signature\n";
+                          "int run_on_access(const char *sign_path, const char *mount_path, size_t workers, long budget_ms, ...);\n"
+                          "Description: Unknown error occurred during on-access scanning\n";
                 break;
-                }
-            } // switch
+            }
+        } // switch
 
         if (printf("%s", message) < 0)
         {
             printf("\nError in function:\n"
                    "int printf(const char *restrict format, ...);\n"
                    "Desciption: Failed to output message\n");
-            return MAIN_RS_PRINTF_ERROR; // 8
+            return MAIN_OA_PRINTF_ERROR; // 23
         }
+        return MAIN_OA_ERROR; // 24
+    }
 
-        return MAIN_RS_ERROR; // 9
-    } // if
-
-    result = calculate_file_size(target_path, &file_size);
-    if (result == CFS_SUCCESS) // if result == 0
+    if (argc >= 5 && strcmp(argv[1], "--sweep") == 0)
     {
-        //     offset + (length of signatire) > file_size -> file is safe
-        if (vs.offset + (sizeof(vs.signature) / sizeof(vs.signature[0])) > file_size)
+        if (argc >= 6) // "i/n": this process takes work items i, i+n, i+2n, ...
         {
-            if (printf("\nAll OK, FILE(%s) is safe", target_path) < 0)
-            {
-                printf("\nError in function:\n"
-                       "int printf(const char *restrict format, ...);\n"
-                       "Description: Failed to output message\n");
-                return MAIN_SMALL_SIZE_PRINTF_ERROR; // 10
-            }
-            return MAIN_SUCCESS; // file is safe -> program is over
+            shard = strtoul(argv[5], &end, 10);
+            shard_count = (*end == '/') ? strtoul(end + 1, NULL, 10) : 0;
         }
-    }
-    else // if result != CFS_SUCCESS / 0
-    {
+        result = run_sweep(argv[2], argv[3], argv[4], shard, shard_count,
+                           (argc >= 7) ? strtoul(argv[6], NULL, 10) : DEFAULT_SWEEP_PLAN_DEPTH,
+                           action, quarantine_dir);
+        if (result == SW_SUCCESS)
+        {
+            return MAIN_SUCCESS; // 0
+        }
+
         switch (result)
         {
-            case CFS_NULL_FILE_PATH_POINTER: // case 1
+            case SW_NULL_SIGN_PATH_POINTER: // case 1
             {
                 message = "\nError in variable:\n"
-                          "const char *file_path;\n"
-                          "Description: Target file path pointer is NULL\n";
+                          "const char *sign_path;\n"
+                          "Description: Signature file path pointer is NULL\n";
                 break;
             }
-            case CFS_NULL_FILE_SIZE_POINTER: // case 2
+            case SW_NULL_JOURNAL_PATH_POINTER: // case 2
             {
                 message = "\nError in variable:\n"
-                          "size_t *file_size;\n"
-                          "Description: File_size pointer is NULL\n";
+                          "const char *journal_path;\n"
+                          "Description: Journal path pointer is NULL\n";
                 break;
             }
-            case CFS_FILE_FOPEN_ERROR: // case 3
+            case SW_SIGNATURE_BASE_ERROR: // case 3
             {
                 message = "\nError in function:\n"
-                          "FILE *fopen(const char *restrict pathname, const char *restrict mode);\n"
-                          "Description: Failed to open target file\n";
+                          "int av_engine_load(AvEngine *engine, const char *sign_path);\n"
+                          "Description: Failed to load signature file\n";
                 break;
             }
-            case CFS_END_FSEEK_ERROR: // case 4
+            case SW_JOURNAL_OPEN_ERROR: // case 4
             {
                 message = "\nError in function:\n"
-                          "int fseek(FILE *stream, long offset, int whence);\n"
-                          "Description: Failed to set END position in file for size calculation\n";
+                          "int open(const char *path, int oflag, ...);\n"
+                          "Description: Failed to open or create the journal\n";
                 break;
             }
-            case CFS_SIZE_FTELL_ERROR: // case 5
+            case SW_JOURNAL_READ_ERROR: // case 5
             {
                 message = "\nError in function:\n"
-                          "long ftell(FILE *stream);\n"
-                          "Description: Failed to tell file position for size calculation\n";
+                          "ssize_t getline(char **restrict lineptr, size_t *restrict n, FILE *restrict stream);\n"
+                          "Description: Failed to read the journal\n";
                 break;
             }
-            case CFS_FILE_FCLOSE_ERROR: // case 6
+            case SW_JOURNAL_WRITE_ERROR: // case 6
             {
                 message = "\nError in function:\n"
-                          "int fclose(FILE *stream);\n"
-                          "Description: Failed to close file after size calculation\n";
-                break;
-            }
-            default:
-            {
-                message = "\nError in function:"
-                          "int calculate_file_size(const char *file_path, size_t *file_size);\n"
-                          "Description: Unknown error occurred while calculating file size\n";
+                          "ssize_t write(int fildes, const void *buf, size_t nbyte);\n"
+                          "Description: Failed to write or sync the journal; run again to resume\n";
                 break;
             }
-        } // switch brackets
-
-        if (printf("%s", message) < 0)
-        {
-            printf("\nError in function:\n"
-                   "int printf(const char *restrict format, ...);\n"
-                   "Desciption: Failed to output message\n");
-            return MAIN_CFS_PRINTF_ERROR; // 11
-        }
-
-        return MAIN_CFS_ERROR; // 12
-    } // if brackets
-
-    result = scan_file(target_path, &vs, &virus_flag);
-    if (result == SF_SUCCESS) // if result == 0
-    {
-        if (virus_flag == 0) // virus flag = 0 -> there`s no a virus in file
-        {
-            if (printf("\nAll OK, FILE(%s) is safe", target_path) < 0)
-            {
-                printf("\nError in function:\n"
-                       "int printf(const char *restrict format, ...);\n"
-                       "Description: Failed to output message\n");
-                return MAIN_OK_PRINTF_ERROR; // 13
-            }
-        }
-        else // virus flag = 1 -> there`s a virus in file
-        {
-            if (printf("\nFind VIRUS(%s) in FILE(%s)", vs.virus_name, target_path) < 0)
-            {
-                printf("\nError in function:\n"
-                       "int printf(const char *restrict format, ...);\n"
-                       "Description: Failed to output message\n");
-                return MAIN_VIRUS_PRINTF_ERROR; // 14
-            }
-        }
-    }
-    else // if result != 0
-    {
-        switch(result)
-        {
-            case SF_NULL_FILE_PATH_POINTER: // case 1
+            case SW_MALLOC_ERROR: // case 7
             {
-                message = "\nError in variable:\n"
-                          "const char *file_path;\n"
-                          "Description: Scan file path pointer is NULL\n";
+                message = "\nError in function:\n"
+                          "void *calloc(size_t nelem, size_t elsize);\n"
+                          "Description: Failed to allocate scanning engine or journal state\n";
                 break;
             }
-            case SF_NULL_VSTRUCT_POINTER: // case 2
+            case SW_INVALID_SHARD: // case 8
             {
                 message = "\nError in variable:\n"
-                          "VirusSignature *vs;\n"
-                          "Description: Virus structure pointer is NULL\n";
+                          "size_t shard;\n"
+                          "Description: Shard must be given as i/n with i < n\n";
                 break;
             }
-            case SF_NULL_VFLAG_POINTER: // case 3
+            case SW_ROOT_ERROR: // case 9
             {
                 message = "\nError in variable:\n"
-                          "int *virus_flag;\n"
-                          "Description: Virus flag pointer is NULL\n";
+                          "const char *root_path;\n"
+                          "Description: The journal has no work items and the root cannot be read\n";
                 break;
             }
-            case SF_FILE_FOPEN_ERROR: // case 4
+            case SW_INTERRUPTED: // case 10
             {
-                message = "\nError in function:\n"
-                          "FILE *fopen(const char *restrict pathname, const char *restrict mode);\n"
-                          "Description: Failed to open scan file\n";
+                message = "\nSweep interrupted, run the same command again to resume\n";
                 break;
             }
-            case SF_OFFSET_FSEEK_ERROR: // case 5
+            case SW_NOT_SUPPORTED: // case 11
             {
                 message = "\nError in function:\n"
-                          "int fseek(FILE *stream, long offset, int whence);\n"
-                          "Description: Failed to set offset position in file\n";
+                          "int run_sweep(const char *sign_path, const char *journal_path, const char *root_path, ...);\n"
+                          "Description: Sweeping requires a POSIX system\n";
                 break;
             }
-            case SF_BUFFER_FREAD_ERROR: // case 6
+            default:
             {
                 message = "\nError in function:\n"
-                          "size_t fread(void *restrict ptr, size_t size, size_t nitems, FILE *restrict stream);\n"
-                          "Description: Failed to read buffer from file\n";
+                          "int run_sweep(const char *sign_path, const char *journal_path, const char *root_path, ...);\n"
+                          "Description: Unknown error occurred during the sweep\n";
                 break;
             }
-            case SF_FILE_FCLOSE_ERROR: // case 7
+        } // switch
+
+        if (printf("%s", message) < 0)
+        {
+            printf("\nError in function:\n"
+                   "int printf(const char *restrict format, ...);\n"
+                   "Desciption: Failed to output message\n");
+            return MAIN_SW_PRINTF_ERROR; // 28
+        }
+        return MAIN_SW_ERROR; // 29
+    }
+
+    message = "Welcome to the virus scanner program!\n\n"
+              "This program scans files on your computer to check for viruses.\n"
+              "Viruses have unique \"signatures\" - special sequences of numbers that the program can recognize.\n"
+              "The program will search for these virus signatures in the file you select.\n"
+              "If it finds a virus, it will alert you.\n"
+              "If no viruses are found, the program will tell you the file is clean.\n"
+              "Note: The program only supports file names/paths that consist\n"
+              "solely of Latin alphabet letters. Any other characters will result in a file reading error.\n\n"
+              "Enter path to signature file: \n"
+              "Example: signature.txt or D:\\Bin1\\Bin2\\signature.txt\n";
+
+    if (printf("%s",message) < 0)
+    {
+        printf("\nError in function:\n"
+               "int printf(const char *restrict format, ...);\n"
+               "Desciption: Failed to output message\n");
+        return MAIN_SIGN_PRINTF_ERROR; // 1
+    }
+
+    if (scanf("%" STR(MAX_FS_ADRESS_SIZE) "[^\n]", sign_path) != 1)
+    {
+        printf("\nError in function:\n"
+               "int scanf(const char *restrict format, ...);\n"
+               "Desciption: Failed to reading signature file path\n");
+        return MAIN_SIGN_SCANF_ERROR; // 2
+    }
+
+    while ((ch = getchar()) != '\n' && ch != EOF);
+
+    message = "\nEnter path to target file: \n"
+              "Example: target.exe OR C:\\Bin1\\Bin2\\target.exe\n";
+
+    if (printf("%s", message) < 0)
+    {
+       printf("\nError in function:\n"
+              "int printf(const char *restrict format, ...);\n"
+              "Description: Failed to output message\n");
+       return MAIN_TARG_PRINTF_ERROR; // 3
+    }
+
+    if (scanf("%" STR(MAX_FS_ADRESS_SIZE) "[^\n]", target_path) != 1)
+    {
+        printf("\nError in function:\n"
+               "int scanf(const char *restrict format, ...);\n"
+               "Description: Failed to reading signature file path\n");
+        return MAIN_TARG_SCANF_ERROR; // 4
+    }
+
+    while ((ch = getchar()) != '\n' && ch != EOF);
+
+    // 1) engine + signature base (AV) -> 2) type, size gate, signatures and entropy of the target (AV) -> 3) report
+    result = av_engine_create(&engine);
+    if (result == AV_SUCCESS)
+    {
+        result = av_engine_load(engine, sign_path);
+    }
+    if (result != AV_SUCCESS)
+    {
+        av_engine_destroy(engine);
+        if (printf("\nError in function:\n"
+                   "%s\n"
+                   "Description: %s\n",
+                   (engine == NULL) ? "int av_engine_create(AvEngine **engine);"
+                                    : "int av_engine_load(AvEngine *engine, const char *sign_path);",
+                   av_strerror(result)) < 0)
+        {
+            printf("\nError in function:\n"
+                   "int printf(const char *restrict format, ...);\n"
+                   "Desciption: Failed to output message\n");
+            return MAIN_RSB_PRINTF_ERROR; // 17
+        }
+
+        return MAIN_RSB_ERROR; // 18
+    }
+
+    // Fixed-offset signatures of the detected type, then floating ones (split into ranges
+    // scanned in parallel); PE files also get section entropy from the same reads.
+    // The descriptor stays open until the action, which works on it rather than on the path.
+#ifndef _WIN32
+    av_trace_file_begin(target_path);
+    span = av_trace_now();
+    fd = open(target_path, O_RDONLY | O_CLOEXEC);
+    av_trace_span("open", span);
+    result = (fd < 0) ? AV_FILE_OPEN_ERROR : av_scan_fd(engine, fd, AV_SCAN_ENTROPY, &scan);
+    av_trace_file_end();
+#else
+    result = av_scan_path(engine, target_path, AV_SCAN_ENTROPY, &scan);
+#endif
+    av_engine_destroy(engine); // the result keeps its own copy of the virus names
+    if (result != AV_SUCCESS)
+    {
+#ifndef _WIN32
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+#endif
+        if (printf("\nError in function:\n"
+                   "int av_scan_path(AvEngine *engine, const char *file_path, int flags, AvScanResult *result);\n"
+                   "Description: %s\n", av_strerror(result)) < 0)
+        {
+            printf("\nError in function:\n"
+                   "int printf(const char *restrict format, ...);\n"
+                   "Description: Failed to output message\n");
+            return (result == AV_FILE_OPEN_ERROR) ? MAIN_RFH_PRINTF_ERROR : MAIN_SF_PRINTF_ERROR; // 19 : 15
+        }
+
+        return (result == AV_FILE_OPEN_ERROR) ? MAIN_RFH_ERROR : MAIN_SF_ERROR; // 20 : 16
+    }
+
+    for (i = 0; i < scan.hit_count; i++)
+    {
+        if (scan.hits[i].floating_flag)
+        {
+            result = printf("\nFind VIRUS(%s) in FILE(%s) at offset %llx", scan.hits[i].virus_name,
+                            target_path, (unsigned long long)scan.hits[i].offset);
+        }
+        else
+        {
+            result = printf("\nFind VIRUS(%s) in FILE(%s)", scan.hits[i].virus_name, target_path);
+        }
+
+        if (result < 0)
+        {
+            av_free_result(&scan);
+            printf("\nError in function:\n"
+                   "int printf(const char *restrict format, ...);\n"
+                   "Description: Failed to output message\n");
+            return MAIN_VIRUS_PRINTF_ERROR; // 14
+        }
+    }
+
+    if (scan.packed_flag &&
+        printf("\nFILE(%s) looks packed: entropy %.2f bits/byte in section %s, deep scan recommended",
+               target_path, scan.packed_entropy,
+               (scan.packed_section[0] != '\0') ? scan.packed_section : "(whole file)") < 0)
+    {
+        av_free_result(&scan);
+        printf("\nError in function:\n"
+               "int printf(const char *restrict format, ...);\n"
+               "Description: Failed to output message\n");
+        return MAIN_PACKED_PRINTF_ERROR; // 27
+    }
+
+    if (scan.hit_count == 0) // no signature matched -> there`s no a virus in file
+    {
+        av_free_result(&scan);
+#ifndef _WIN32
+        close(fd);
+#endif
+        if (printf("\nAll OK, FILE(%s) is safe", target_path) < 0)
+        {
+            printf("\nError in function:\n"
+                   "int printf(const char *restrict format, ...);\n"
+                   "Description: Failed to output message\n");
+            return MAIN_OK_PRINTF_ERROR; // 13
+        }
+        return MAIN_SUCCESS; // 0
+    }
+
+    result = run_action(action, quarantine_dir, fd, target_path, scan.hits[0].virus_name);
+    av_free_result(&scan);
+#ifndef _WIN32
+    close(fd);
+#endif
+    if (report_action(action, quarantine_dir, result, target_path, 1) < 0)
+    {
+        printf("\nError in function:\n"
+               "int printf(const char *restrict format, ...);\n"
+               "Description: Failed to output message\n");
+        return MAIN_ACT_PRINTF_ERROR; // 30
+    }
+    if (result != ACT_SUCCESS)
+    {
+        return MAIN_ACT_ERROR; // 31
+    }
+    return MAIN_SUCCESS; // 0
+}
+
+/**
+ * @brief Writes the spans recorded since --trace to its file (registered with atexit()).
+ *
+ * Runs on every exit of main(), so a failed or interrupted scan is traced too.
+ * Stops tracing first: threads still running at exit add no spans to the file.
+ */
+void write_trace(void)
+{
+    // Declare all the variables:
+    int result;
+
+    av_trace_enable(0);
+    result = av_trace_dump(trace_path, trace_format);
+    if (result != AV_SUCCESS)
+    {
+        printf("\nError in function:\n"
+               "int av_trace_dump(const char *path, int format);\n"
+               "Description: %s\n", av_strerror(result));
+    }
+}
+
+#ifndef _WIN32
+/**
+ * @brief Returns CLOCK_MONOTONIC time in nanoseconds.
+ */
+static uint64_t monotonic_ns(void)
+{
+    // Declare all the variables:
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief Copies a path with '\\' and newlines escaped, so it fits on one line.
+ *
+ * @param [out] out Destination with room for 2 * strlen(path) characters.
+ * @param [in] path Path to escape.
+ * @return End of the written characters (not terminated).
+ */
+static char *escape_path(char *out, const char *path)
+{
+    for (; *path != '\0'; path++)
+    {
+        if (*path == '\\' || *path == '\n')
+        {
+            *out++ = '\\';
+            *out++ = (*path == '\n') ? 'n' : '\\';
+        }
+        else
+        {
+            *out++ = *path;
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief Checks whether a path still names the file held by a descriptor.
+ *
+ * @param [in] held Status of the held descriptor.
+ * @param [in] dir_fd Directory the path is relative to (or AT_FDCWD).
+ * @param [in] path Path to check; symbolic links are not followed.
+ * @return 1 if the path names the same inode, 0 otherwise.
+ */
+static int same_file(const struct stat *held, int dir_fd, const char *path)
+{
+    // Declare all the variables:
+    struct stat st;
+
+    return fstatat(dir_fd, path, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+           st.st_dev == held->st_dev && st.st_ino == held->st_ino;
+}
+
+/**
+ * @brief Moves the file held by a descriptor into the quarantine directory without copying it.
+ *
+ * The path is renamed first (renameat2() with RENAME_NOREPLACE on Linux) and
+ * put back, again without replacing anything, if it turns out to name another file
+ * than the scanned one; if that file cannot be put back (a new file took the path
+ * meanwhile) it stays in quarantine and ACT_FILE_CHANGED is returned. When the
+ * path was renamed away or replaced but the scanned inode still has a name
+ * elsewhere, the inode itself is linked into the quarantine directory through
+ * /proc/self/fd. An inode deleted since the scan has no links left and cannot
+ * be linked again: that is reported as ACT_FILE_DELETED. Both only move directory
+ * entries, so the quarantine directory must be on the same file system as the file.
+ *
+ * @param [in] dir_fd Quarantine directory.
+ * @param [in] name Name of the file in the quarantine directory.
+ * @param [in] fd Descriptor of the scanned file.
+ * @param [in] path Path the file was scanned under.
+ * @param [in] held Status of the descriptor.
+ * @param [out] method "rename" or "link".
+ * @return Error code from @ref Error_Codes_ACT.
+ */
+static int quarantine_move(int dir_fd, const char *name, int fd, const char *path, const struct stat *held,
+                           const char **method)
+{
+    // Declare all the variables:
+    char link[64];
+    struct stat st;
+    int moved_flag, restored_flag;
+
+#if defined(__linux__) && defined(RENAME_NOREPLACE)
+    moved_flag = renameat2(AT_FDCWD, path, dir_fd, name, RENAME_NOREPLACE) == 0;
+#else
+    moved_flag = fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0 && renameat(AT_FDCWD, path, dir_fd, name) == 0;
+#endif
+    if (!moved_flag && errno == EXDEV)
+    {
+        return ACT_CROSS_DEVICE; // 4
+    }
+    if (moved_flag)
+    {
+        if (same_file(held, dir_fd, name))
+        {
+            *method = "rename";
+            return ACT_SUCCESS; // 0
+        }
+        // Replaced after the scan: not ours to quarantine, put it back unless the path is taken again
+#if defined(__linux__) && defined(RENAME_NOREPLACE)
+        restored_flag = renameat2(dir_fd, name, AT_FDCWD, path, RENAME_NOREPLACE) == 0;
+#else
+        restored_flag = fstatat(AT_FDCWD, path, &st, AT_SYMLINK_NOFOLLOW) != 0 &&
+                        renameat(dir_fd, name, AT_FDCWD, path) == 0;
+#endif
+        if (!restored_flag)
+        {
+            return ACT_FILE_CHANGED; // 8
+        }
+    }
+
+    // The path is gone or names another file: keep the scanned inode itself
+    if (fstat(fd, &st) == 0 && st.st_nlink == 0)
+    {
+        return ACT_FILE_DELETED; // 11
+    }
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    if (linkat(AT_FDCWD, link, dir_fd, name, AT_SYMLINK_FOLLOW) != 0)
+    {
+        return (errno == EXDEV) ? ACT_CROSS_DEVICE : ACT_MOVE_ERROR; // 4 : 5
+    }
+    *method = "link";
+    if (same_file(held, AT_FDCWD, path) && unlinkat(AT_FDCWD, path, 0) != 0)
+    {
+        return ACT_UNLINK_ERROR; // 6
+    }
+    return ACT_SUCCESS; // 0
+}
+
+/**
+ * @brief Writes the metadata sidecar "<name>.meta" of a quarantined file.
+ *
+ * The sidecar is written to an O_TMPFILE and linked into the directory only
+ * when complete, so a crash never leaves a half-written sidecar. File systems
+ * without O_TMPFILE get an exclusively created file instead.
+ *
+ * @param [in] dir_fd Quarantine directory.
+ * @param [in] name Name of the quarantined file.
+ * @param [in] path Original path of the file.
+ * @param [in] virus_name Name of the matched signature.
+ * @param [in] held Status of the file before it was quarantined.
+ * @param [in] method How the file was moved ("rename" or "link").
+ * @return Error code from @ref Error_Codes_ACT.
+ */
+static int quarantine_sidecar(int dir_fd, const char *name, const char *path, const char *virus_name,
+                              const struct stat *held, const char *method)
+{
+    // Declare all the variables:
+    char text[SWEEP_MAX_PATH * 4 + 512];
+    char cwd[SWEEP_MAX_PATH];
+    char meta_name[128];
+    char link[64];
+    char *end;
+    size_t written = 0;
+    ssize_t length;
+    int meta_fd = -1, tmp_flag, result = ACT_SUCCESS;
+
+    if (strlen(path) >= SWEEP_MAX_PATH)
+    {
+        path = "(path too long)";
+    }
+    end = text + sprintf(text, "path=");
+    if (path[0] != '/' && getcwd(cwd, sizeof(cwd)) != NULL && strlen(cwd) < SWEEP_MAX_PATH)
+    {
+        end = escape_path(end, cwd); // restorable from anywhere
+        *end++ = '/';
+    }
+    end = escape_path(end, path);
+    end += sprintf(end, "\nvirus=%s\nsize=%lld\nmode=%o\nuid=%lu\ngid=%lu\nmtime=%lld\nquarantined=%lld\nmethod=%s\n",
+                   virus_name, (long long)held->st_size, (unsigned)(held->st_mode & 07777),
+                   (unsigned long)held->st_uid, (unsigned long)held->st_gid, (long long)held->st_mtime,
+                   (long long)time(NULL), method);
+    snprintf(meta_name, sizeof(meta_name), "%s.meta", name);
+
+#if defined(__linux__) && defined(O_TMPFILE)
+    meta_fd = openat(dir_fd, ".", O_TMPFILE | O_WRONLY | O_CLOEXEC, 0600);
+#endif
+    tmp_flag = meta_fd >= 0;
+    if (!tmp_flag)
+    {
+        meta_fd = openat(dir_fd, meta_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (meta_fd < 0)
+        {
+            return ACT_SIDECAR_ERROR; // 7
+        }
+    }
+
+    while (written < (size_t)(end - text))
+    {
+        length = write(meta_fd, text + written, (size_t)(end - text) - written);
+        if (length < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (length <= 0)
+        {
+            result = ACT_SIDECAR_ERROR; // 7
+            break;
+        }
+        written += (size_t)length;
+    }
+    if (result == ACT_SUCCESS && fsync(meta_fd) != 0)
+    {
+        result = ACT_SIDECAR_ERROR; // 7
+    }
+    if (result == ACT_SUCCESS && tmp_flag)
+    {
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", meta_fd);
+        if (linkat(AT_FDCWD, link, dir_fd, meta_name, AT_SYMLINK_FOLLOW) != 0)
+        {
+            result = ACT_SIDECAR_ERROR; // 7
+        }
+    }
+    close(meta_fd);
+    return result;
+}
+
+/**
+ * @brief Truncates the file held by a descriptor to zero bytes.
+ *
+ * The held inode is reopened for writing through /proc/self/fd, so a file
+ * renamed or replaced since the scan is never truncated by mistake; without
+ * /proc the path is opened and must still name the scanned inode.
+ *
+ * @param [in] fd Descriptor of the scanned file (may be read-only).
+ * @param [in] path Path the file was scanned under.
+ * @param [in] held Status of the descriptor.
+ * @return Error code from @ref Error_Codes_ACT.
+ */
+static int truncate_held(int fd, const char *path, const struct stat *held)
+{
+    // Declare all the variables:
+    char link[64];
+    struct stat st;
+    int write_fd, result = ACT_SUCCESS;
+
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    write_fd = open(link, O_WRONLY | O_NOCTTY | O_CLOEXEC);
+    if (write_fd < 0 && errno == ENOENT)
+    {
+        write_fd = open(path, O_WRONLY | O_NOFOLLOW | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+        if (write_fd >= 0 && (fstat(write_fd, &st) != 0 || st.st_dev != held->st_dev || st.st_ino != held->st_ino))
+        {
+            close(write_fd);
+            return ACT_FILE_CHANGED; // 8
+        }
+    }
+    if (write_fd < 0)
+    {
+        return ACT_TRUNCATE_ERROR; // 9
+    }
+
+    if (ftruncate(write_fd, 0) != 0 || fsync(write_fd) != 0)
+    {
+        result = ACT_TRUNCATE_ERROR; // 9
+    }
+    close(write_fd);
+    return result;
+}
+#endif
+
+/**
+ * @brief Runs the detection action on an infected file, on the descriptor it was scanned from.
+ *
+ * ACTION_QUARANTINE moves the file into quarantine_dir (created if missing)
+ * as "<time>-<device>-<inode>", removes all its permission bits and writes a
+ * "<name>.meta" sidecar with the original path, virus name, size, mode, owner
+ * and times. ACTION_TRUNCATE empties the file. Neither reads or copies the
+ * contents of the file. ACTION_REPORT does nothing (the caller prints the detection).
+ *
+ * @param [in] action Action from @ref Detection_Actions.
+ * @param [in] quarantine_dir Quarantine directory (for ACTION_QUARANTINE).
+ * @param [in] fd Open descriptor of the scanned file.
+ * @param [in] path Path the file was scanned under.
+ * @param [in] virus_name Name of the matched signature.
+ * @return Error code from @ref Error_Codes_ACT.
+ */
+int run_action(int action, const char *quarantine_dir, int fd, const char *path, const char *virus_name)
+{
+    if (path == NULL || virus_name == NULL || (action == ACTION_QUARANTINE && quarantine_dir == NULL))
+    {
+        return ACT_NULL_ARGUMENT_POINTER; // 1
+    }
+    if (action == ACTION_REPORT)
+    {
+        return ACT_SUCCESS; // 0
+    }
+
+#ifdef _WIN32
+    (void)fd;
+    return ACT_NOT_SUPPORTED; // 10
+#else
+    // Declare all the variables:
+    struct stat held;
+    char name[96];
+    const char *method = "rename";
+    int dir_fd, result;
+
+    if (fstat(fd, &held) != 0)
+    {
+        return ACT_STAT_ERROR; // 2
+    }
+    if (action == ACTION_TRUNCATE)
+    {
+        return truncate_held(fd, path, &held);
+    }
+
+    mkdir(quarantine_dir, 0700);
+    dir_fd = open(quarantine_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0)
+    {
+        return ACT_QUARANTINE_DIR_ERROR; // 3
+    }
+
+    snprintf(name, sizeof(name), "%lld-%llx-%llx", (long long)time(NULL),
+             (unsigned long long)held.st_dev, (unsigned long long)held.st_ino);
+    result = quarantine_move(dir_fd, name, fd, path, &held, &method);
+    if (result == ACT_SUCCESS || result == ACT_UNLINK_ERROR)
+    {
+        fchmod(fd, 0); // the quarantined inode can no longer be run or read by users
+        if (quarantine_sidecar(dir_fd, name, path, virus_name, &held, method) != ACT_SUCCESS &&
+            result == ACT_SUCCESS)
+        {
+            result = ACT_SIDECAR_ERROR; // 7
+        }
+        fsync(dir_fd);
+    }
+    close(dir_fd);
+    return result;
+#endif
+}
+
+/**
+ * @brief Prints the outcome of run_action() for a file.
+ *
+ * Nothing is printed for ACTION_REPORT.
+ *
+ * @param [in] action Action from @ref Detection_Actions.
+ * @param [in] quarantine_dir Quarantine directory (for ACTION_QUARANTINE).
+ * @param [in] result Return value of run_action().
+ * @param [in] path Path of the file.
+ * @param [in] line_start 1 to start the message with a newline, 0 to end it with one.
+ * @return Return value of printf(), 0 if nothing was printed.
+ */
+int report_action(int action, const char *quarantine_dir, int result, const char *path, int line_start)
+{
+    // Declare all the variables:
+    const char *description;
+
+    if (action == ACTION_REPORT)
+    {
+        return 0;
+    }
+
+    switch (result)
+    {
+        case ACT_SUCCESS: // case 0
+        {
+            return (action == ACTION_QUARANTINE)
+                   ? printf("%sQuarantined FILE(%s) in %s%s", line_start ? "\n" : "", path, quarantine_dir,
+                            line_start ? "" : "\n")
+                   : printf("%sTruncated FILE(%s)%s", line_start ? "\n" : "", path, line_start ? "" : "\n");
+        }
+        case ACT_STAT_ERROR: // case 2
+        {
+            description = "cannot stat the scanned descriptor";
+            break;
+        }
+        case ACT_QUARANTINE_DIR_ERROR: // case 3
+        {
+            description = "cannot create or open the quarantine directory";
+            break;
+        }
+        case ACT_CROSS_DEVICE: // case 4
+        {
+            description = "the quarantine directory is on another file system";
+            break;
+        }
+        case ACT_MOVE_ERROR: // case 5
+        {
+            description = "cannot move or link the file into the quarantine directory";
+            break;
+        }
+        case ACT_UNLINK_ERROR: // case 6
+        {
+            description = "linked into the quarantine directory but the original path cannot be removed";
+            break;
+        }
+        case ACT_SIDECAR_ERROR: // case 7
+        {
+            description = "quarantined but the metadata sidecar cannot be written";
+            break;
+        }
+        case ACT_FILE_CHANGED: // case 8
+        {
+            description = "the path names another file than the scanned one";
+            break;
+        }
+        case ACT_TRUNCATE_ERROR: // case 9
+        {
+            description = "cannot open the file for writing or truncate it";
+            break;
+        }
+        case ACT_NOT_SUPPORTED: // case 10
+        {
+            description = "not supported on this platform";
+            break;
+        }
+        case ACT_FILE_DELETED: // case 11
+        {
+            description = "the file was deleted after the scan";
+            break;
+        }
+        default:
+        {
+            description = "invalid argument";
+            break;
+        }
+    } // switch
+
+    return printf("%sCannot %s FILE(%s): %s%s", line_start ? "\n" : "",
+                  (action == ACTION_QUARANTINE) ? "quarantine" : "truncate", path, description,
+                  line_start ? "" : "\n");
+}
+
+#if defined(__linux__) && defined(FAN_OPEN_EXEC_PERM)
+/**
+ * @brief One slot of the on-access verdict cache.
+ *
+ * A verdict is reused only while the inode, size, mtime and ctime are unchanged,
+ * so any write or metadata change makes the cached verdict stale.
+ */
+typedef struct
+{
+    dev_t dev; /**< Device of the scanned file. */
+    ino_t ino; /**< Inode of the scanned file. */
+    off_t size; /**< Size at scan time. */
+    struct timespec mtime; /**< Modification time at scan time. */
+    struct timespec ctime; /**< Status change time at scan time. */
+    int virus_flag; /**< 1 if infected, 0 if clean. */
+    int valid; /**< 1 if the slot holds a verdict. */
+} VerdictCacheEntry;
+
+/**
+ * @brief Direct-mapped cache of scan verdicts shared by all on-access threads.
+ */
+typedef struct
+{
+    VerdictCacheEntry *entries; /**< VERDICT_CACHE_SIZE slots. */
+    pthread_mutex_t lock; /**< Protects entries. */
+} VerdictCache;
+
+/**
+ * @enum Scan_Priorities
+ * @brief Priority classes of on-access events (lower value is served first).
+ */
+enum Scan_Priorities
+{
+    /** @brief A process waits for the verdict (exec permission event). */
+    SCAN_PRIORITY_INTERACTIVE = 0,
+
+    /** @brief Background scan of a written file, only fills the verdict cache. */
+    SCAN_PRIORITY_BULK = 1
+};
+
+/**
+ * @enum Scan_Verdicts
+ * @brief Outcome of one on-access scan.
+ */
+enum Scan_Verdicts
+{
+    /** @brief No signature matched (or the file is not a regular file). */
+    SCAN_VERDICT_CLEAN = 0,
+
+    /** @brief A signature matched. */
+    SCAN_VERDICT_INFECTED = 1,
+
+    /** @brief The deadline passed before the scan finished; nothing is known about the file. */
+    SCAN_VERDICT_LATE = 2
+};
+
+/**
+ * @brief fanotify event waiting for a worker.
+ */
+typedef struct
+{
+    int fd; /**< Descriptor handed over by the kernel. */
+    uint64_t mask; /**< Event mask (FAN_OPEN_EXEC_PERM or FAN_CLOSE_WRITE). */
+    int priority; /**< Class from @ref Scan_Priorities. */
+    uint64_t deadline_ns; /**< CLOCK_MONOTONIC time by which the event must be answered. */
+    uint64_t sequence; /**< Arrival number, keeps equal deadlines in FIFO order. */
+} ScanEvent;
+
+/**
+ * @brief Bounded earliest-deadline-first queue between the fanotify reader and the workers.
+ *
+ * A binary min-heap ordered by priority class, then deadline, then arrival, so
+ * every exec is served before any background scan, and each class in EDF order.
+ */
+typedef struct
+{
+    ScanEvent *events; /**< SCAN_QUEUE_SIZE slots, events[0] is the most urgent. */
+    size_t count; /**< Number of queued events. */
+    uint64_t sequence; /**< Arrival number of the next pushed event. */
+    int stop; /**< 1 once no more events will be pushed. */
+    pthread_mutex_t lock; /**< Protects the fields above. */
+    pthread_cond_t not_empty; /**< Signalled on push and on stop. */
+} ScanQueue;
+
+/**
+ * @brief State shared by the fanotify reader and the worker pool.
+ */
+typedef struct
+{
+    int fan_fd; /**< fanotify group descriptor. */
+    AvEngine *engine; /**< Scanning engine shared by the workers. */
+    VerdictCache cache; /**< Verdicts of recently scanned files. */
+    ScanQueue queue; /**< Events waiting for a worker. */
+    int numa_flag; /**< 1 if workers are bound to NUMA nodes (av_engine_bind_thread()). */
+    int action; /**< Action on infected files, from @ref Detection_Actions. */
+    const char *quarantine_dir; /**< Quarantine directory of ACTION_QUARANTINE. */
+} OnAccessContext;
+
+/**
+ * @brief Start argument of one worker thread.
+ */
+typedef struct
+{
+    OnAccessContext *ctx; /**< Shared state. */
+    size_t index; /**< Number of the worker (selects its NUMA node). */
+} OnAccessWorker;
+
+/** @brief Set by the SIGINT/SIGTERM handler to stop on-access scanning. */
+static volatile sig_atomic_t on_access_stop = 0;
+
+/**
+ * @brief SIGINT/SIGTERM handler for on-access mode.
+ *
+ * @param [in] signal_number Received signal (unused).
+ */
+static void on_access_signal(int signal_number)
+{
+    (void)signal_number;
+    on_access_stop = 1;
+}
+
+/**
+ * @brief Returns the cache slot of a file (hash of device and inode).
+ *
+ * @param [in] st File status.
+ */
+static size_t verdict_cache_slot(const struct stat *st)
+{
+    // Declare all the variables:
+    uint64_t key = ((uint64_t)st->st_dev * 0x9E3779B97F4A7C15u) ^ (uint64_t)st->st_ino;
+
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDu;
+    key ^= key >> 33;
+    return (size_t)(key & (VERDICT_CACHE_SIZE - 1));
+}
+
+/**
+ * @brief Looks up a still valid verdict for a file.
+ *
+ * @param [in] cache Verdict cache.
+ * @param [in] st Current file status.
+ * @param [out] virus_flag Cached verdict.
+ * @return 1 on cache hit, 0 on miss.
+ */
+static int verdict_cache_lookup(VerdictCache *cache, const struct stat *st, int *virus_flag)
+{
+    // Declare all the variables:
+    const VerdictCacheEntry *entry = &cache->entries[verdict_cache_slot(st)];
+    int hit = 0;
+
+    pthread_mutex_lock(&cache->lock);
+    if (entry->valid && entry->dev == st->st_dev && entry->ino == st->st_ino &&
+        entry->size == st->st_size &&
+        entry->mtime.tv_sec == st->st_mtim.tv_sec && entry->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+        entry->ctime.tv_sec == st->st_ctim.tv_sec && entry->ctime.tv_nsec == st->st_ctim.tv_nsec)
+    {
+        *virus_flag = entry->virus_flag;
+        hit = 1;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    return hit;
+}
+
+/**
+ * @brief Stores the verdict of a file, replacing whatever used the slot.
+ *
+ * @param [in] cache Verdict cache.
+ * @param [in] st File status at scan time.
+ * @param [in] virus_flag Verdict.
+ */
+static void verdict_cache_store(VerdictCache *cache, const struct stat *st, int virus_flag)
+{
+    // Declare all the variables:
+    VerdictCacheEntry *entry = &cache->entries[verdict_cache_slot(st)];
+
+    pthread_mutex_lock(&cache->lock);
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->size = st->st_size;
+    entry->mtime = st->st_mtim;
+    entry->ctime = st->st_ctim;
+    entry->virus_flag = virus_flag;
+    entry->valid = 1;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * @brief Returns 1 if event a must be served before event b.
+ *
+ * @param [in] a First event.
+ * @param [in] b Second event.
+ */
+static int scan_event_before(const ScanEvent *a, const ScanEvent *b)
+{
+    if (a->priority != b->priority)
+    {
+        return a->priority < b->priority;
+    }
+    if (a->deadline_ns != b->deadline_ns)
+    {
+        return a->deadline_ns < b->deadline_ns;
+    }
+    return a->sequence < b->sequence;
+}
+
+/**
+ * @brief Restores the heap order around one slot whose event has changed.
+ *
+ * @param [in] queue Event queue (locked).
+ * @param [in] index Changed slot.
+ */
+static void scan_queue_fix(ScanQueue *queue, size_t index)
+{
+    // Declare all the variables:
+    ScanEvent moved = queue->events[index];
+    size_t child;
+
+    while (index > 0 && scan_event_before(&moved, &queue->events[(index - 1) / 2])) // sift up
+    {
+        queue->events[index] = queue->events[(index - 1) / 2];
+        index = (index - 1) / 2;
+    }
+    while ((child = 2 * index + 1) < queue->count) // sift down
+    {
+        if (child + 1 < queue->count && scan_event_before(&queue->events[child + 1], &queue->events[child]))
+        {
+            child++;
+        }
+        if (!scan_event_before(&queue->events[child], &moved))
+        {
+            break;
+        }
+        queue->events[index] = queue->events[child];
+        index = child;
+    }
+    queue->events[index] = moved;
+}
+
+/**
+ * @brief Removes the event in one slot of the heap.
+ *
+ * @param [in] queue Event queue (locked, not empty).
+ * @param [in] index Slot to remove.
+ * @param [out] event Removed event.
+ */
+static void scan_queue_remove(ScanQueue *queue, size_t index, ScanEvent *event)
+{
+    *event = queue->events[index];
+    queue->count--;
+    if (index < queue->count)
+    {
+        queue->events[index] = queue->events[queue->count];
+        scan_queue_fix(queue, index);
+    }
+}
+
+/**
+ * @brief Adds an event to the queue without blocking.
+ *
+ * When the queue is full, an interactive event takes the place of the background
+ * event with the latest deadline, which is handed back to the caller to drop.
+ *
+ * @param [in] queue Event queue.
+ * @param [in] event Event to add.
+ * @param [out] evicted Background event dropped to make room (valid if 1 is returned).
+ * @return 0 on success, 1 on success with an evicted event, -1 if the queue is full.
+ */
+static int scan_queue_push(ScanQueue *queue, const ScanEvent *event, ScanEvent *evicted)
+{
+    // Declare all the variables:
+    size_t i, victim = SCAN_QUEUE_SIZE;
+    int result = 0;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count == SCAN_QUEUE_SIZE)
+    {
+        for (i = 0; i < queue->count && event->priority == SCAN_PRIORITY_INTERACTIVE; i++)
+        {
+            if (queue->events[i].priority == SCAN_PRIORITY_BULK &&
+                (victim == SCAN_QUEUE_SIZE || queue->events[i].deadline_ns > queue->events[victim].deadline_ns))
             {
-                message = "\nError in function:\n"
-                          "int fclose(FILE *stream);\n"
-                          "Description: Failed to close scan file\n";
+                victim = i;
+            }
+        }
+        if (victim == SCAN_QUEUE_SIZE)
+        {
+            pthread_mutex_unlock(&queue->lock);
+            return -1;
+        }
+        scan_queue_remove(queue, victim, evicted);
+        result = 1;
+    }
+
+    queue->events[queue->count] = *event;
+    queue->events[queue->count].sequence = queue->sequence++;
+    queue->count++;
+    scan_queue_fix(queue, queue->count - 1);
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+
+    return result;
+}
+
+/**
+ * @brief Takes the most urgent event, waiting while the queue is empty.
+ *
+ * @param [in] queue Event queue.
+ * @param [out] event Taken event.
+ * @return 0 on success, -1 if the queue is stopped and drained.
+ */
+static int scan_queue_pop(ScanQueue *queue, ScanEvent *event)
+{
+    // Declare all the variables:
+    int result = -1;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && !queue->stop)
+    {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+    if (queue->count > 0)
+    {
+        scan_queue_remove(queue, 0, event);
+        result = 0;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return result;
+}
+
+/**
+ * @brief Takes the most urgent event if it is interactive, without waiting.
+ *
+ * @param [in] queue Event queue.
+ * @param [out] event Taken event.
+ * @return 0 on success, -1 if no interactive event is queued.
+ */
+static int scan_queue_pop_urgent(ScanQueue *queue, ScanEvent *event)
+{
+    // Declare all the variables:
+    int result = -1;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count > 0 && queue->events[0].priority == SCAN_PRIORITY_INTERACTIVE)
+    {
+        scan_queue_remove(queue, 0, event);
+        result = 0;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return result;
+}
+
+/**
+ * @brief Answers a fanotify permission event.
+ *
+ * @param [in] fan_fd fanotify group descriptor.
+ * @param [in] fd Descriptor of the event.
+ * @param [in] response FAN_ALLOW or FAN_DENY.
+ */
+static void on_access_respond(int fan_fd, int fd, uint32_t response)
+{
+    // Declare all the variables:
+    struct fanotify_response answer;
+
+    answer.fd = fd;
+    answer.response = response;
+    while (write(fan_fd, &answer, sizeof(answer)) < 0 && errno == EINTR);
+}
+
+/**
+ * @brief Gets the current path of a descriptor from /proc/self/fd.
+ *
+ * @param [in] fd Descriptor.
+ * @param [out] path Path, empty if unknown.
+ * @param [in] size Size of the path buffer.
+ */
+static void on_access_fd_path(int fd, char *path, size_t size)
+{
+    // Declare all the variables:
+    char link[64];
+    ssize_t length;
+
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    length = readlink(link, path, size - 1);
+    if (length < 0)
+    {
+        length = 0;
+    }
+    path[length] = '\0';
+}
+
+/**
+ * @brief Prints the verdict of a scan together with the path of the descriptor.
+ *
+ * Clean files are not printed.
+ *
+ * @param [in] fd Descriptor of the scanned file.
+ * @param [in] verdict Verdict from @ref Scan_Verdicts.
+ * @param [in] virus_name Name of the matched signature (for SCAN_VERDICT_INFECTED).
+ */
+static void on_access_report(int fd, int verdict, const char *virus_name)
+{
+    // Declare all the variables:
+    char path[MAX_FS_ADRESS_SIZE * 4];
+
+    if (verdict == SCAN_VERDICT_CLEAN)
+    {
+        return;
+    }
+
+    on_access_fd_path(fd, path, sizeof(path));
+
+    if (verdict == SCAN_VERDICT_INFECTED)
+    {
+        printf("Find VIRUS(%s) in FILE(%s)\n", virus_name, path);
+    }
+    else
+    {
+        printf("Not scanned in time: FILE(%s)\n", path);
+    }
+    fflush(stdout);
+}
+
+/**
+ * @brief Scans one event's descriptor, using and filling the verdict cache.
+ *
+ * A detection is reported when the file is scanned, not again on cache hits.
+ * A scan that misses the deadline of the control is reported as late and not cached,
+ * unless it matched a signature before the deadline: that is a detection like any other.
+ *
+ * @param [in] ctx On-access context.
+ * @param [in] fd Descriptor of the event.
+ * @param [in] flags Options from @ref Av_Scan_Flags.
+ * @param [in] control Deadline and yield callback of the scan.
+ * @return Verdict from @ref Scan_Verdicts (SCAN_VERDICT_CLEAN if the file could not be scanned).
+ */
+static int on_access_scan(OnAccessContext *ctx, int fd, int flags, const AvScanControl *control)
+{
+    // Declare all the variables:
+    AvScanResult result;
+    struct stat st;
+    char path[MAX_FS_ADRESS_SIZE * 4];
+    int verdict = SCAN_VERDICT_CLEAN, status, traced_flag;
+    uint64_t span;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        return SCAN_VERDICT_CLEAN;
+    }
+    if (verdict_cache_lookup(&ctx->cache, &st, &verdict))
+    {
+        return verdict;
+    }
+
+    traced_flag = (av_trace_now() != 0);
+    if (traced_flag) // the path costs a readlink(), taken only for the trace
+    {
+        on_access_fd_path(fd, path, sizeof(path));
+        av_trace_file_begin(path);
+    }
+
+    status = av_scan_fd_control(ctx->engine, fd, flags, control, &result);
+    span = av_trace_now();
+    if (status == AV_DEADLINE_EXPIRED && result.hit_count == 0)
+    {
+        on_access_report(fd, SCAN_VERDICT_LATE, NULL);
+        verdict = SCAN_VERDICT_LATE;
+    }
+    else if (status == AV_SUCCESS || status == AV_DEADLINE_EXPIRED)
+    {
+        verdict = (result.hit_count > 0) ? SCAN_VERDICT_INFECTED : SCAN_VERDICT_CLEAN;
+        on_access_report(fd, verdict, (result.hit_count > 0) ? result.hits[0].virus_name : NULL);
+        verdict_cache_store(&ctx->cache, &st, verdict);
+        if (verdict == SCAN_VERDICT_INFECTED && ctx->action != ACTION_REPORT)
+        {
+            av_trace_span("output", span);
+            span = av_trace_now();
+            on_access_fd_path(fd, path, sizeof(path));
+            status = run_action(ctx->action, ctx->quarantine_dir, fd, path, result.hits[0].virus_name);
+            report_action(ctx->action, ctx->quarantine_dir, status, path, 0);
+            fflush(stdout);
+            av_trace_span("action", span);
+            span = 0;
+        }
+        av_free_result(&result);
+    }
+
+    av_trace_span("output", span);
+    if (traced_flag)
+    {
+        av_trace_file_end();
+    }
+    return verdict;
+}
+
+/**
+ * @brief Serves one event: scans it, answers a permission event and closes the descriptor.
+ *
+ * Only an infected file is denied, also when the match was found before a missed
+ * deadline; a late verdict without a match allows the exec, so one slow file never
+ * blocks a process for longer than its budget.
+ *
+ * @param [in] ctx On-access context.
+ * @param [in] event Event to serve.
+ * @param [in] yield Callback run between chunks of the scan (NULL for none).
+ */
+static void on_access_serve(OnAccessContext *ctx, const ScanEvent *event, AvYieldCallback yield)
+{
+    // Declare all the variables:
+    AvScanControl control;
+    int verdict;
+
+    control.deadline_ns = event->deadline_ns;
+    control.yield = yield;
+    control.yield_arg = ctx;
+    verdict = on_access_scan(ctx, event->fd,
+                             AV_SCAN_FIRST_HIT | AV_SCAN_SINGLE_THREAD |
+                             ((event->priority == SCAN_PRIORITY_BULK) ? AV_SCAN_IO_LIMIT : 0),
+                             &control);
+
+    if (event->mask & FAN_OPEN_EXEC_PERM)
+    {
+        on_access_respond(ctx->fan_fd, event->fd, (verdict == SCAN_VERDICT_INFECTED) ? FAN_DENY : FAN_ALLOW);
+    }
+    close(event->fd);
+}
+
+/**
+ * @brief Yield callback of background scans: serves execs that arrived meanwhile.
+ *
+ * Runs between two chunks of a background scan, so an exec never waits for a
+ * large written file to be scanned to the end. The execs are scanned without
+ * a yield callback of their own.
+ *
+ * @param [in] arg Pointer to the OnAccessContext.
+ */
+static void on_access_yield(void *arg)
+{
+    // Declare all the variables:
+    OnAccessContext *ctx = arg;
+    ScanEvent event;
+
+    while (scan_queue_pop_urgent(&ctx->queue, &event) == 0)
+    {
+        on_access_serve(ctx, &event, NULL);
+    }
+}
+
+/**
+ * @brief Worker thread: scans queued events in EDF order and answers permission events.
+ *
+ * Execs are served first; background scans give way to execs between chunks
+ * (see on_access_yield()). Events that miss their deadline, in the queue or
+ * during the scan, get the "not scanned in time" verdict and execs are allowed.
+ *
+ * With NUMA binding, worker N runs on node N modulo the number of nodes, next
+ * to the signature replica of that node.
+ *
+ * @param [in] arg Pointer to the OnAccessWorker.
+ * @return Always NULL.
+ */
+static void *on_access_worker(void *arg)
+{
+    // Declare all the variables:
+    const OnAccessWorker *worker = arg;
+    OnAccessContext *ctx = worker->ctx;
+    ScanEvent event;
+
+    if (ctx->numa_flag)
+    {
+        av_engine_bind_thread(ctx->engine, worker->index);
+    }
+
+    while (scan_queue_pop(&ctx->queue, &event) == 0)
+    {
+        on_access_serve(ctx, &event, (event.priority == SCAN_PRIORITY_BULK) ? on_access_yield : NULL);
+    }
+
+    return NULL;
+}
+#endif
+
+/**
+ * @brief Runs on-access scanning of a mount point with fanotify.
+ *
+ * Every exec of a file on the mount (FAN_OPEN_EXEC_PERM) waits for a verdict:
+ * infected files are denied, everything else is allowed. Files closed after
+ * writing (FAN_CLOSE_WRITE) are scanned in the background so that the next exec
+ * finds their verdict in the cache. The kernel hands over an open descriptor
+ * for every event; it is scanned with av_scan_fd() and never reopened by path.
+ *
+ * Latency: cached verdicts are answered directly by the event reader; other
+ * events go to an earliest-deadline-first queue in front of a pool of worker
+ * threads. Execs (deadline budget_ms) always go before background scans
+ * (deadline DEFAULT_BULK_BUDGET_MS), take the queue place of a background scan
+ * when it is full, and are served between the chunks of a running background
+ * scan. An exec is allowed with a "not scanned in time" verdict if the queue is
+ * full of execs or if it is not scanned within budget_ms.
+ *
+ * Background scans share the I/O limit (bandwidth and reads per second), so a
+ * burst of written files does not starve other users of the disk; execs are
+ * never throttled. With numa_flag the signatures are replicated per NUMA node
+ * and the workers are spread over the nodes.
+ *
+ * Runs until SIGINT or SIGTERM. Requires CAP_SYS_ADMIN and Linux 5.0+.
+ *
+ * @param [in] sign_path Path to the signature file.
+ * @param [in] mount_path Any path on the mount to watch.
+ * @param [in] workers Number of worker threads (1..MAX_ON_ACCESS_WORKERS).
+ * @param [in] budget_ms Latency budget of one exec in milliseconds (<= 0 for default).
+ * @param [in] io_bytes_per_second Read bandwidth of background scans (0 = unlimited).
+ * @param [in] io_reads_per_second Read operations per second of background scans (0 = unlimited).
+ * @param [in] numa_flag 1 to replicate signatures per NUMA node and bind the workers.
+ * @param [in] detection_action Action on newly detected files, from @ref Detection_Actions.
+ * @param [in] quarantine_dir Quarantine directory of ACTION_QUARANTINE.
+ * @return Error code from @ref Error_Codes_OA.
+ */
+int run_on_access(const char *sign_path, const char *mount_path, size_t workers, long budget_ms,
+                  uint64_t io_bytes_per_second, uint64_t io_reads_per_second, int numa_flag,
+                  int detection_action, const char *quarantine_dir)
+{
+    if (sign_path == NULL)
+    {
+        return OA_NULL_SIGN_PATH_POINTER; // 1
+    }
+    if (mount_path == NULL)
+    {
+        return OA_NULL_MOUNT_PATH_POINTER; // 2
+    }
+
+#if !defined(__linux__) || !defined(FAN_OPEN_EXEC_PERM)
+    (void)workers;
+    (void)budget_ms;
+    (void)io_bytes_per_second;
+    (void)io_reads_per_second;
+    (void)numa_flag;
+    (void)detection_action;
+    (void)quarantine_dir;
+    return OA_NOT_SUPPORTED; // 9
+#else
+    // Declare all the variables:
+    OnAccessContext ctx;
+    pthread_t threads[MAX_ON_ACCESS_WORKERS];
+    OnAccessWorker worker_args[MAX_ON_ACCESS_WORKERS];
+    struct fanotify_event_metadata buffer[256];
+    const struct fanotify_event_metadata *metadata;
+    struct sigaction action;
+    sigset_t stop_signals, old_mask;
+    struct pollfd pfd;
+    struct stat st;
+    ScanEvent event, evicted;
+    size_t started = 0, i;
+    ssize_t length;
+    pid_t self = getpid();
+    int result = OA_SUCCESS, virus_flag;
+
+    if (workers == 0 || workers > MAX_ON_ACCESS_WORKERS)
+    {
+        workers = DEFAULT_ON_ACCESS_WORKERS;
+    }
+    if (budget_ms <= 0)
+    {
+        budget_ms = DEFAULT_ON_ACCESS_BUDGET_MS;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    if (av_engine_create(&ctx.engine) != AV_SUCCESS)
+    {
+        return OA_CONTEXT_MALLOC_ERROR; // 6
+    }
+    if (numa_flag && av_engine_set_numa(ctx.engine) != AV_SUCCESS) // before loading: replicas are made by the load
+    {
+        av_engine_destroy(ctx.engine);
+        return OA_NUMA_ERROR; // 10
+    }
+    ctx.numa_flag = numa_flag;
+    ctx.action = detection_action;
+    ctx.quarantine_dir = quarantine_dir;
+    av_engine_set_io_limit(ctx.engine, io_bytes_per_second, io_reads_per_second);
+    if (av_engine_load(ctx.engine, sign_path) != AV_SUCCESS)
+    {
+        av_engine_destroy(ctx.engine);
+        return OA_SIGNATURE_BASE_ERROR; // 3
+    }
+
+    ctx.fan_fd = fanotify_init(FAN_CLASS_CONTENT | FAN_CLOEXEC | FAN_NONBLOCK,
+                               O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+    if (ctx.fan_fd < 0)
+    {
+        av_engine_destroy(ctx.engine);
+        return OA_FANOTIFY_INIT_ERROR; // 4
+    }
+
+    if (fanotify_mark(ctx.fan_fd, FAN_MARK_ADD | FAN_MARK_MOUNT,
+                      FAN_OPEN_EXEC_PERM | FAN_CLOSE_WRITE, AT_FDCWD, mount_path) != 0)
+    {
+        close(ctx.fan_fd);
+        av_engine_destroy(ctx.engine);
+        return OA_FANOTIFY_MARK_ERROR; // 5
+    }
+
+    ctx.cache.entries = calloc(VERDICT_CACHE_SIZE, sizeof(VerdictCacheEntry));
+    ctx.queue.events = calloc(SCAN_QUEUE_SIZE, sizeof(ScanEvent));
+    if (ctx.cache.entries == NULL || ctx.queue.events == NULL)
+    {
+        free(ctx.cache.entries);
+        free(ctx.queue.events);
+        close(ctx.fan_fd);
+        av_engine_destroy(ctx.engine);
+        return OA_CONTEXT_MALLOC_ERROR; // 6
+    }
+    pthread_mutex_init(&ctx.cache.lock, NULL);
+    pthread_mutex_init(&ctx.queue.lock, NULL);
+    pthread_cond_init(&ctx.queue.not_empty, NULL);
+
+    // No SA_RESTART: a signal must interrupt poll() so the loop sees on_access_stop
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_access_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    on_access_stop = 0;
+
+    // Workers inherit a mask blocking SIGINT/SIGTERM, so only this thread receives them
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+    for (started = 0; started < workers; started++)
+    {
+        worker_args[started].ctx = &ctx;
+        worker_args[started].index = started;
+        if (pthread_create(&threads[started], NULL, on_access_worker, &worker_args[started]) != 0)
+        {
+            result = OA_WORKER_CREATE_ERROR; // 7
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    pfd.fd = ctx.fan_fd;
+    pfd.events = POLLIN;
+
+    while (result == OA_SUCCESS && !on_access_stop)
+    {
+        if (poll(&pfd, 1, -1) < 0)
+        {
+            if (errno != EINTR)
+            {
+                result = OA_EVENT_READ_ERROR; // 8
+            }
+            continue;
+        }
+
+        length = read(ctx.fan_fd, buffer, sizeof(buffer));
+        if (length < 0)
+        {
+            if (errno != EAGAIN && errno != EINTR)
+            {
+                result = OA_EVENT_READ_ERROR; // 8
+            }
+            continue;
+        }
+
+        for (metadata = buffer; FAN_EVENT_OK(metadata, length); metadata = FAN_EVENT_NEXT(metadata, length))
+        {
+            if (metadata->vers != FANOTIFY_METADATA_VERSION)
+            {
+                result = OA_EVENT_READ_ERROR; // 8
                 break;
             }
-            default:
+            if (metadata->fd < 0) // queue overflow, no descriptor
             {
-                message = "\nError in function:"
-                          "int scan_file(const char *file_path, VirusSignature *vs);\n"
-                          "Description: Unknown error occurred while scaninng signature\n";
-                break;
+                continue;
             }
-        }
 
-        if (printf("%s", message) < 0)
-        {
-            printf("\nError in function:\n"
-                   "int printf(const char *restrict format, ...);\n"
-                   "Description: Failed to output message\n");
-            return MAIN_SF_PRINTF_ERROR; // 9
+            event.fd = metadata->fd;
+            event.mask = metadata->mask;
+            if (event.mask & FAN_OPEN_EXEC_PERM)
+            {
+                event.priority = SCAN_PRIORITY_INTERACTIVE;
+                event.deadline_ns = monotonic_ns() + (uint64_t)budget_ms * 1000000u;
+            }
+            else
+            {
+                event.priority = SCAN_PRIORITY_BULK;
+                event.deadline_ns = monotonic_ns() + (uint64_t)DEFAULT_BULK_BUDGET_MS * 1000000u;
+            }
+
+            if (event.mask & FAN_OPEN_EXEC_PERM)
+            {
+                // Our own accesses and cached verdicts are answered without a worker
+                if (metadata->pid == self)
+                {
+                    on_access_respond(ctx.fan_fd, event.fd, FAN_ALLOW);
+                    close(event.fd);
+                    continue;
+                }
+                if (fstat(event.fd, &st) == 0 &&
+                    verdict_cache_lookup(&ctx.cache, &st, &virus_flag))
+                {
+                    on_access_respond(ctx.fan_fd, event.fd, virus_flag ? FAN_DENY : FAN_ALLOW);
+                    close(event.fd);
+                    continue;
+                }
+            }
+
+            switch (scan_queue_push(&ctx.queue, &event, &evicted))
+            {
+                case 1: // an exec took the place of a background scan
+                {
+                    on_access_report(evicted.fd, SCAN_VERDICT_LATE, NULL);
+                    close(evicted.fd);
+                    break;
+                }
+                case -1: // all workers busy, queue full
+                {
+                    if (event.mask & FAN_OPEN_EXEC_PERM)
+                    {
+                        on_access_report(event.fd, SCAN_VERDICT_LATE, NULL);
+                        on_access_respond(ctx.fan_fd, event.fd, FAN_ALLOW);
+                    }
+                    close(event.fd);
+                    break;
+                }
+                default:
+                {
+                    break;
+                }
+            }
         }
-        return MAIN_SF_ERROR; // 10
     }
 
-    return MAIN_SUCCESS; // 0
+    // Let workers drain the queue (expired permission events are allowed), then stop
+    pthread_mutex_lock(&ctx.queue.lock);
+    ctx.queue.stop = 1;
+    pthread_cond_broadcast(&ctx.queue.not_empty);
+    pthread_mutex_unlock(&ctx.queue.lock);
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&ctx.queue.not_empty);
+    pthread_mutex_destroy(&ctx.queue.lock);
+    pthread_mutex_destroy(&ctx.cache.lock);
+    free(ctx.queue.events);
+    free(ctx.cache.entries);
+    close(ctx.fan_fd);
+    av_engine_destroy(ctx.engine);
+
+    return result;
+#endif
 }
 
+#ifndef _WIN32
 /**
- * @brief Reads a virus signature from a file.
- *
- * This function loads the virus signature, offset, and name
- * from a text file into a VirusSignature structure.
+ * @brief Set of 64-bit path hashes (open addressing, linear probing).
+ */
+typedef struct
+{
+    uint64_t *slots; /**< Hashes; 0 marks an empty slot. */
+    size_t capacity; /**< Number of slots (power of two). */
+    size_t count; /**< Number of stored hashes. */
+} PathSet;
+
+/**
+ * @brief Append-only sweep journal with batched writes.
+ */
+typedef struct
+{
+    int fd; /**< Journal file, opened with O_APPEND. */
+    char buffer[JOURNAL_BUFFER_SIZE]; /**< Records not written yet. */
+    size_t used; /**< Bytes used in the buffer. */
+    size_t pending; /**< Records in the buffer. */
+    uint64_t synced_ns; /**< Time of the last write and fdatasync(). */
+    int error_flag; /**< 1 after a failed write or fdatasync(). */
+} Journal;
+
+/**
+ * @brief State of one sweep process.
+ */
+typedef struct
+{
+    AvEngine *engine; /**< Engine with the signature base. */
+    Journal journal; /**< Where completed paths are recorded. */
+    PathSet done; /**< Hashes of paths the journal records as completed. */
+    char **items; /**< Work items (paths) of the journal, in order. */
+    size_t item_count; /**< Number of work items. */
+    size_t item_capacity; /**< Allocated work items. */
+    PathSet item_set; /**< Hashes of the work items (no duplicates). */
+    char path[SWEEP_MAX_PATH]; /**< Path being visited. */
+    uint64_t scanned; /**< Files scanned by this run. */
+    uint64_t infected; /**< Infected files found by this run. */
+    uint64_t unreadable; /**< Files and directories that could not be read. */
+    uint64_t skipped; /**< Files and subtrees skipped as completed. */
+    int action; /**< Action on infected files, from @ref Detection_Actions. */
+    const char *quarantine_dir; /**< Quarantine directory of ACTION_QUARANTINE. */
+} SweepContext;
+
+/** @brief Set by the SIGINT/SIGTERM handler to stop a sweep (the journal is synced first). */
+static volatile sig_atomic_t sweep_stop = 0;
+
+/**
+ * @brief SIGINT/SIGTERM handler for sweep mode.
  *
- * File format should be:
- * @code
- * 4D 5A 90 00 03 00 00 00 1234 ExampleVirus
- * @endcode
+ * @param [in] signal_number Received signal (unused).
+ */
+static void sweep_signal(int signal_number)
+{
+    (void)signal_number;
+    sweep_stop = 1;
+}
+
+/**
+ * @brief Returns the FNV-1a hash of a path (never 0).
  *
- * Example usage:
- * @code
- * VirusSignature vs;
- * int result = read_signature("signature.txt", &vs);
- * if (result == RS_SUCCESS)
- * {
- *     printf("Signature loaded: %s\n", vs.virus_name);
- * }
- * else
- * {
- *     printf("Error code: %d\n", result);
- * }
- * @endcode
+ * @param [in] path Path to hash.
+ * @param [in] length Number of characters of the path to hash.
+ */
+static uint64_t path_hash(const char *path, size_t length)
+{
+    // Declare all the variables:
+    uint64_t hash = 14695981039346656037ull;
+    size_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        hash = (hash ^ (unsigned char)path[i]) * 1099511628211ull;
+    }
+    return (hash == 0) ? 1 : hash;
+}
+
+/**
+ * @brief Checks whether a hash is in the set.
  *
- * @param [in] file_path Path to the file containing the signature.
- * @param [out] vs Pointer to the VirusSignature structure to be filled.
- * @return Error code from @ref Error_Codes_RS.
+ * @param [in] set Path set.
+ * @param [in] hash Hash from path_hash().
+ * @return 1 if present, 0 otherwise.
  */
-int read_signature(const char *file_path, VirusSignature *vs)
+static int path_set_contains(const PathSet *set, uint64_t hash)
 {
-    if (file_path == NULL)
+    // Declare all the variables:
+    size_t slot;
+
+    if (set->capacity == 0)
     {
-        return RS_NULL_FILE_PATH_POINTER; // 1
+        return 0;
     }
-    if (vs == NULL)
+    for (slot = (size_t)hash & (set->capacity - 1); set->slots[slot] != 0; slot = (slot + 1) & (set->capacity - 1))
     {
-        return RS_NULL_VSTRUCT_POINTER; // 2
+        if (set->slots[slot] == hash)
+        {
+            return 1;
+        }
     }
+    return 0;
+}
 
+/**
+ * @brief Adds a hash to the set, doubling it when half full.
+ *
+ * @param [in,out] set Path set.
+ * @param [in] hash Hash from path_hash().
+ * @return 0 on success (also when already present), -1 if the set cannot grow.
+ */
+static int path_set_add(PathSet *set, uint64_t hash)
+{
     // Declare all the variables:
-    size_t i;
-    FILE *file = fopen(file_path, "r");
+    uint64_t *old_slots = set->slots;
+    size_t old_capacity = set->capacity;
+    size_t slot, i;
 
-    if (file == NULL)
+    if ((set->count + 1) * 2 > set->capacity)
     {
-        return RS_FILE_FOPEN_ERROR; // 3
+        set->capacity = (old_capacity == 0) ? 1024 : old_capacity * 2;
+        set->slots = calloc(set->capacity, sizeof(uint64_t));
+        if (set->slots == NULL)
+        {
+            set->slots = old_slots;
+            set->capacity = old_capacity;
+            return -1;
+        }
+        set->count = 0;
+        for (i = 0; i < old_capacity; i++)
+        {
+            if (old_slots[i] != 0)
+            {
+                path_set_add(set, old_slots[i]);
+            }
+        }
+        free(old_slots);
     }
 
-    for (i = 0; i < sizeof(vs->signature) / sizeof(vs->signature[0]); i++)
+    for (slot = (size_t)hash & (set->capacity - 1); set->slots[slot] != 0; slot = (slot + 1) & (set->capacity - 1))
     {
-        if (fscanf(file, "%hhx", &vs->signature[i]) != 1)
+        if (set->slots[slot] == hash)
         {
-            fclose(file);
-            return RS_SIGNATURE_FSCANF_ERROR; // 4
+            return 0;
         }
     }
+    set->slots[slot] = hash;
+    set->count++;
+    return 0;
+}
+
+/**
+ * @brief Writes the buffered records to the journal and syncs it.
+ *
+ * The whole buffer goes out in one write() under an exclusive flock(), so
+ * processes sharing a journal never interleave or read each other's partial batches.
+ *
+ * @param [in,out] journal Journal.
+ * @param [in] lock_flag 1 to take the lock, 0 if the caller already holds it.
+ * @return 0 on success, -1 on a write or fdatasync() error (error_flag is set).
+ */
+static int journal_flush(Journal *journal, int lock_flag)
+{
+    // Declare all the variables:
+    size_t written = 0;
+    ssize_t length;
 
-    if (fscanf(file, "%zx", &vs->offset) != 1)
+    if (journal->used == 0 || journal->error_flag)
     {
-        fclose(file);
-        return RS_OFFSET_FSCANF_ERROR; // 5
+        return journal->error_flag ? -1 : 0;
     }
 
-    if (fscanf(file, "%s", vs->virus_name) != 1)
+    if (lock_flag)
     {
-        fclose(file);
-        return RS_VNAME_FSCANF_ERROR; // 6
+        while (flock(journal->fd, LOCK_EX) != 0 && errno == EINTR);
     }
-
-    if (fclose(file) != 0)
+    while (written < journal->used)
+    {
+        length = write(journal->fd, journal->buffer + written, journal->used - written);
+        if (length < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (length <= 0)
+        {
+            journal->error_flag = 1;
+            break;
+        }
+        written += (size_t)length;
+    }
+    if (!journal->error_flag && fdatasync(journal->fd) != 0)
+    {
+        journal->error_flag = 1;
+    }
+    if (lock_flag)
     {
-        fclose(file);
-        return RS_FILE_FCLOSE_ERROR; // 7
+        flock(journal->fd, LOCK_UN);
     }
-    return RS_SUCCESS; // 0
+
+    journal->used = 0;
+    journal->pending = 0;
+    journal->synced_ns = monotonic_ns();
+    return journal->error_flag ? -1 : 0;
 }
 
 /**
- * @brief Checks if the specified file has execution permissions.
- *
- * This function evaluates the file at the given path to determine if it is
- * executable. It sets the provided flag to indicate the result of the check.
- *
- * @param [in] file_path The path to the file to be checked for execution permissions.
- * @param [out] exe_flag A pointer to an integer that will be updated to 1 if the file
- *                 is executable, or 0 if it is not.
+ * @brief Appends one record to the journal.
  *
- * @note This function is useful for validating file executable permission before attempting
- *       to scan a file.
+ * A record is one line: a tag, a space, the virus name and a space for 'V'
+ * records, and the path with '\\' and newlines escaped. The buffer is written
+ * and synced every JOURNAL_BATCH_RECORDS records or JOURNAL_BATCH_MS milliseconds.
  *
- * @return Errors code from @ref Error_Codes_EXE.
+ * @param [in,out] journal Journal.
+ * @param [in] tag 'W' work item, 'F' clean file, 'V' infected file, 'D' completed subtree, 'E' unreadable path.
+ * @param [in] virus_name Virus name of a 'V' record, NULL otherwise.
+ * @param [in] path Path of the record.
+ * @param [in] lock_flag Passed to journal_flush().
+ * @return 0 on success, -1 on a write error.
  */
-int is_exec(const char *file_path, int *exe_flag)
+static int journal_append(Journal *journal, char tag, const char *virus_name, const char *path, int lock_flag)
 {
-    if (file_path == NULL)
+    // Declare all the variables:
+    size_t needed = 4 + 2 * strlen(path) + ((virus_name != NULL) ? strlen(virus_name) : 0);
+    char *out;
+
+    if (journal->used + needed > JOURNAL_BUFFER_SIZE && journal_flush(journal, lock_flag) != 0)
+    {
+        return -1;
+    }
+
+    out = journal->buffer + journal->used;
+    *out++ = tag;
+    *out++ = ' ';
+    if (virus_name != NULL)
     {
-        return EXE_NULL_FILE_PATH_POINTER; // 1
+        memcpy(out, virus_name, strlen(virus_name));
+        out += strlen(virus_name);
+        *out++ = ' ';
     }
+    out = escape_path(out, path);
+    *out++ = '\n';
+    journal->used = (size_t)(out - journal->buffer);
+    journal->pending++;
 
-    if (exe_flag == NULL)
+    if (journal->pending >= JOURNAL_BATCH_RECORDS ||
+        monotonic_ns() - journal->synced_ns >= (uint64_t)JOURNAL_BATCH_MS * 1000000u)
     {
-        return EXE_NULL_EFLAG_POINTER; // 2
+        return journal_flush(journal, lock_flag);
     }
+    return 0;
+}
 
+/**
+ * @brief Parses one journal line in place.
+ *
+ * @param [in,out] line Line read by getline(), without being changed by the caller.
+ * @param [in] length Length returned by getline().
+ * @param [out] path Unescaped path inside the line.
+ * @return Tag of the record, or 0 if the line is torn or malformed.
+ */
+static char journal_parse(char *line, size_t length, char **path)
+{
     // Declare all the variables:
-    uint16_t MZ1 = 0, MZ2 = 0;
-    FILE *file;
-    int MZ_flag = 0;
+    char *in, *out;
+    char tag;
 
-    file = fopen(file_path, "rb");
-    if (file == NULL)
+    if (length < 3 || line[length - 1] != '\n' || strlen(line) != length || line[1] != ' ')
     {
-        return EXE_FILE_FOPEN_ERROR; // 3
+        return 0; // cut by a crash, or zeros of a block that never reached the disk
     }
-
-    if (fread(&MZ1, sizeof(MZ1), 1, file) != 1)
+    tag = line[0];
+    if (tag != 'W' && tag != 'F' && tag != 'V' && tag != 'D' && tag != 'E')
     {
-        fclose(file);
-        return EXE_BUFFER_FREAD_ERROR; // 4
+        return 0;
     }
 
-    if (fclose(file) != 0)
+    line[length - 1] = '\0';
+    in = line + 2;
+    if (tag == 'V')
     {
-        fclose(file);
-        return EXE_FILE_FCLOSE_ERROR; // 5
+        in = strchr(in, ' ');
+        if (in == NULL)
+        {
+            return 0;
+        }
+        in++;
     }
-    MZ2 = (('Z' << 8) | 'M'); // MZ bytes in hexadecimal format
-    if (MZ1 == MZ2)
+    *path = in;
+    for (out = in; *in != '\0'; in++)
     {
-        MZ_flag = 1; //
+        if (*in == '\\' && (in[1] == 'n' || in[1] == '\\'))
+        {
+            in++;
+            *out++ = (*in == 'n') ? '\n' : '\\';
+        }
+        else
+        {
+            *out++ = *in;
+        }
     }
-
-    *exe_flag = MZ_flag;
-    return EXE_SUCCESS; // 0
+    *out = '\0';
+    return (*path[0] == '\0') ? 0 : tag;
 }
 
 /**
- * @brief Calculates the size of a file.
+ * @brief Adds a work item to the sweep, ignoring duplicates.
  *
- * This function determines the total number of bytes in the file specified
- * by the given path and stores the result in a provided variable.
+ * @param [in,out] ctx Sweep context.
+ * @param [in] path Path of the item.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int sweep_add_item(SweepContext *ctx, const char *path)
+{
+    // Declare all the variables:
+    uint64_t hash = path_hash(path, strlen(path));
+    char **items;
+
+    if (path_set_contains(&ctx->item_set, hash))
+    {
+        return 0;
+    }
+    if (ctx->item_count == ctx->item_capacity)
+    {
+        items = realloc(ctx->items, ((ctx->item_capacity == 0) ? 64 : ctx->item_capacity * 2) * sizeof(char *));
+        if (items == NULL)
+        {
+            return -1;
+        }
+        ctx->items = items;
+        ctx->item_capacity = (ctx->item_capacity == 0) ? 64 : ctx->item_capacity * 2;
+    }
+    ctx->items[ctx->item_count] = strdup(path);
+    if (ctx->items[ctx->item_count] == NULL || path_set_add(&ctx->item_set, hash) != 0)
+    {
+        free(ctx->items[ctx->item_count]);
+        return -1;
+    }
+    ctx->item_count++;
+    return 0;
+}
+
+/**
+ * @brief Reads the journal: work items, completed subtrees and completed files.
  *
- * Example usage:
- * @code
- * size_t file_size = 0;
- * int result = calculate_file_size("target.exe", &file_size);
- * if (result == CFS_SUCCESS)
- * {
- *     printf("File size: %zu bytes\n", file_size);
- * }
- * else
- * {
- *     printf("Error calculating file size: %d\n", result);
- * }
- * @endcode
+ * The first pass collects the work items and the completed subtrees ('D', 'E');
+ * the second keeps completed files ('F', 'V') only if their directory is not
+ * completed, so memory grows with the directories left unfinished by the
+ * interrupted run rather than with the number of files swept. Reading stops at
+ * the first torn or malformed line; the caller truncates the journal there.
  *
- * @param [in] file_path Path to the file.
- * @param [out] file_size Pointer to a variable to store the resulting file size.
- * @return Error code from @ref Error_Codes_CFS.
+ * @param [in,out] ctx Sweep context.
+ * @param [in] journal_path Path of the journal.
+ * @param [out] valid_length Length of the well-formed start of the journal.
+ * @return SW_SUCCESS, SW_JOURNAL_READ_ERROR or SW_MALLOC_ERROR.
  */
-int calculate_file_size(const char *file_path, size_t *file_size)
+static int journal_load(SweepContext *ctx, const char *journal_path, off_t *valid_length)
 {
-    if (file_path == NULL)
+    // Declare all the variables:
+    FILE *file;
+    char *line = NULL, *path, *slash;
+    size_t line_capacity = 0;
+    ssize_t length;
+    off_t offset;
+    int pass, result = SW_SUCCESS;
+    char tag;
+
+    file = fopen(journal_path, "r");
+    if (file == NULL)
     {
-        return CFS_NULL_FILE_PATH_POINTER; // 1
+        return SW_JOURNAL_READ_ERROR; // 5
     }
 
-    if (file_size == NULL)
+    *valid_length = 0;
+    for (pass = 0; pass < 2 && result == SW_SUCCESS; pass++)
     {
-        return CFS_NULL_FILE_SIZE_POINTER; // 2
+        rewind(file);
+        offset = 0;
+        while (!(pass == 1 && offset >= *valid_length) &&
+               (length = getline(&line, &line_capacity, file)) > 0)
+        {
+            tag = journal_parse(line, (size_t)length, &path);
+            if (tag == 0)
+            {
+                break; // pass 0 only: pass 1 stops at valid_length
+            }
+            offset += length;
+
+            if (pass == 0 && tag == 'W')
+            {
+                if (sweep_add_item(ctx, path) != 0)
+                {
+                    result = SW_MALLOC_ERROR; // 7
+                    break;
+                }
+            }
+            else if ((pass == 0 && (tag == 'D' || tag == 'E')) || (pass == 1 && (tag == 'F' || tag == 'V')))
+            {
+                slash = strrchr(path, '/');
+                if (pass == 1 && slash != NULL && slash != path &&
+                    path_set_contains(&ctx->done, path_hash(path, (size_t)(slash - path))))
+                {
+                    continue; // the whole directory is completed
+                }
+                if (path_set_add(&ctx->done, path_hash(path, strlen(path))) != 0)
+                {
+                    result = SW_MALLOC_ERROR; // 7
+                    break;
+                }
+            }
+        }
+        if (pass == 0)
+        {
+            *valid_length = offset;
+        }
+        if (ferror(file) && result == SW_SUCCESS)
+        {
+            result = SW_JOURNAL_READ_ERROR; // 5
+        }
     }
 
+    free(line);
+    fclose(file);
+    return result;
+}
+
+/**
+ * @brief Cuts a new journal into work items: the entries @p depth levels below the root.
+ *
+ * Files above that depth are work items too, so the items cover the whole tree.
+ *
+ * @param [in,out] ctx Sweep context; ctx->path holds the directory or file to plan.
+ * @param [in] depth Remaining depth.
+ * @return 0 on success, -1 on a journal or allocation error.
+ */
+static int sweep_plan(SweepContext *ctx, size_t depth)
+{
     // Declare all the variables:
-    long size;
-    FILE *file = fopen(file_path, "rb");
+    DIR *dir;
+    struct dirent *entry;
+    struct stat st;
+    size_t length = strlen(ctx->path);
+    const char *separator = (length > 0 && ctx->path[length - 1] == '/') ? "" : "/";
+    int result = 0;
+
+    if (lstat(ctx->path, &st) != 0 || (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode)))
+    {
+        return 0; // vanished, or not something to scan
+    }
+    dir = (depth > 0 && S_ISDIR(st.st_mode)) ? opendir(ctx->path) : NULL;
+    if (dir == NULL)
+    {
+        if (sweep_add_item(ctx, ctx->path) != 0)
+        {
+            return -1;
+        }
+        return journal_append(&ctx->journal, 'W', NULL, ctx->path, 0);
+    }
 
-    if (file == NULL)
+    while (result == 0 && (entry = readdir(dir)) != NULL)
     {
-        return CFS_FILE_FOPEN_ERROR; // 3
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            length + 1 + strlen(entry->d_name) >= SWEEP_MAX_PATH)
+        {
+            continue;
+        }
+        sprintf(ctx->path + length, "%s%s", separator, entry->d_name);
+        result = sweep_plan(ctx, depth - 1);
+        ctx->path[length] = '\0';
     }
+    closedir(dir);
+    return result;
+}
 
-    if (fseek(file, 0, SEEK_END) != 0)
+/**
+ * @brief Scans the regular file at ctx->path and records it in the journal.
+ *
+ * @param [in,out] ctx Sweep context.
+ */
+static void sweep_file(SweepContext *ctx)
+{
+    // Declare all the variables:
+    AvScanResult scan;
+    int fd, result;
+    uint64_t span;
+
+    av_trace_file_begin(ctx->path);
+    span = av_trace_now();
+    fd = open(ctx->path, O_RDONLY | O_NOFOLLOW | O_NOCTTY | O_CLOEXEC);
+    av_trace_span("open", span);
+    result = (fd < 0) ? AV_FILE_OPEN_ERROR : av_scan_fd(ctx->engine, fd, AV_SCAN_FIRST_HIT, &scan);
+    if (result != AV_SUCCESS)
     {
-        fclose(file);
-        return CFS_END_FSEEK_ERROR; // 4
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        ctx->unreadable++;
+        span = av_trace_now();
+        printf("\nCannot scan FILE(%s): %s", ctx->path, av_strerror(result));
+        journal_append(&ctx->journal, 'E', NULL, ctx->path, 1);
+        av_trace_span("output", span);
+        av_trace_file_end();
+        return;
     }
 
-    size = ftell(file);
+    ctx->scanned++;
+    if (scan.hit_count > 0)
+    {
+        ctx->infected++;
+        printf("\nFind VIRUS(%s) in FILE(%s)", scan.hits[0].virus_name, ctx->path);
+        span = av_trace_now();
+        result = run_action(ctx->action, ctx->quarantine_dir, fd, ctx->path, scan.hits[0].virus_name);
+        av_trace_span("action", span);
+        span = av_trace_now();
+        report_action(ctx->action, ctx->quarantine_dir, result, ctx->path, 1);
+        fflush(stdout);
+        journal_append(&ctx->journal, 'V', scan.hits[0].virus_name, ctx->path, 1);
+    }
+    else
+    {
+        span = av_trace_now();
+        journal_append(&ctx->journal, 'F', NULL, ctx->path, 1);
+    }
+    av_trace_span("output", span); // report and journal record (a batch write every JOURNAL_BATCH_RECORDS)
+    av_free_result(&scan);
+    close(fd);
+    av_trace_file_end();
+}
 
-    if (size == -1)
+/**
+ * @brief Sweeps the directory at ctx->path, skipping what the journal records as completed.
+ *
+ * The directory is recorded as a completed subtree after all its entries, so a
+ * restarted sweep skips it without reading it again.
+ *
+ * @param [in,out] ctx Sweep context.
+ */
+static void sweep_directory(SweepContext *ctx)
+{
+    // Declare all the variables:
+    DIR *dir;
+    struct dirent *entry;
+    struct stat st;
+    size_t length = strlen(ctx->path);
+    const char *separator = (length > 0 && ctx->path[length - 1] == '/') ? "" : "/";
+
+    dir = opendir(ctx->path);
+    if (dir == NULL)
     {
-        fclose(file);
-        return CFS_SIZE_FTELL_ERROR; // 5
+        ctx->unreadable++;
+        printf("\nCannot read DIRECTORY(%s): %s", ctx->path, strerror(errno));
+        journal_append(&ctx->journal, 'E', NULL, ctx->path, 1);
+        return;
     }
 
-    *file_size = size;
+    while (!sweep_stop && !ctx->journal.error_flag && (entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+        if (length + 1 + strlen(entry->d_name) >= SWEEP_MAX_PATH)
+        {
+            ctx->unreadable++;
+            printf("\nPath too long in DIRECTORY(%s): %s", ctx->path, entry->d_name);
+            continue;
+        }
+
+        sprintf(ctx->path + length, "%s%s", separator, entry->d_name);
+        if (path_set_contains(&ctx->done, path_hash(ctx->path, strlen(ctx->path))))
+        {
+            ctx->skipped++;
+        }
+        else if (lstat(ctx->path, &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            sweep_directory(ctx);
+        }
+        else if (lstat(ctx->path, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            sweep_file(ctx);
+        }
+        ctx->path[length] = '\0';
+    }
+    closedir(dir);
 
-    if (fclose(file) != 0)
+    if (!sweep_stop && !ctx->journal.error_flag)
     {
-        fclose(file);
-        return CFS_FILE_FCLOSE_ERROR; // 6
+        journal_append(&ctx->journal, 'D', NULL, ctx->path, 1);
     }
-    return CFS_SUCCESS; // 0
 }
+#endif
 
 /**
- * @brief Scans a file for a virus signature at a specific offset.
+ * @brief Sweeps a directory tree with a checkpoint journal, resuming an interrupted sweep.
  *
- * This function reads the file at the specified offset from the VirusSignature structure
- * and compares the content against the known virus signature. The result is returned
- * via the virus_flag parameter (1 = infected, 0 = clean).
-
- * Example usage:
- * @code
- * VirusSignature vs;
- * int virus_found = 0;
+ * The journal is an append-only text file with one record per line:
+ * "W <path>" work item, "F <path>" clean file, "V <virus> <path>" infected file,
+ * "D <path>" completed subtree and "E <path>" unreadable path. Records are
+ * buffered and written with one fdatasync() per batch (JOURNAL_BATCH_RECORDS
+ * records or JOURNAL_BATCH_MS milliseconds), so a crash costs at most one batch
+ * of rescans.
  *
- * if (scan_file("target.exe", &vs, &virus_found) != SF_SUCCESS) {
- *     // Handle error
- * }
+ * When the journal has no work items yet, the entries @p plan_depth levels below
+ * @p root_path are recorded as work items (under flock(), so only the first of
+ * several processes started together does it). Work item i belongs to shard
+ * i % shard_count: processes started with the same journal and shards
+ * 0..shard_count-1 split the tree between them and append to the same journal.
+ * Running the same command again skips every completed file and subtree.
  *
- * if (virus_found) {
- *     printf("Virus detected: %s\n", vs.name);
- * }
- * @endcode
+ * Paths are remembered as 64-bit hashes, so memory stays small on very large trees.
  *
- * @param [in] file_path Path to the file to scan (must not be NULL)
- * @param [in] vs VirusSignature containing signature, offset and name (must not be NULL)
- * @param [out] virus_flag Output flag for detection result (must not be NULL)
- * @return SF_SUCCESS (0) on success, error code from @ref Error_Codes_SF on failure
+ * @param [in] sign_path Path to the signature file.
+ * @param [in] journal_path Path to the journal (created if missing).
+ * @param [in] root_path Root of the tree; may be NULL if the journal has work items.
+ * @param [in] shard Shard of this process (0..shard_count-1).
+ * @param [in] shard_count Number of processes sharing the journal (1 for a single process).
+ * @param [in] plan_depth Depth of the work items of a new journal.
+ * @param [in] detection_action Action on infected files, from @ref Detection_Actions.
+ * @param [in] quarantine_dir Quarantine directory of ACTION_QUARANTINE.
+ * @return Error code from @ref Error_Codes_SW.
  */
-int scan_file(const char *file_path, VirusSignature *vs, int *virus_flag)
+int run_sweep(const char *sign_path, const char *journal_path, const char *root_path,
+              size_t shard, size_t shard_count, size_t plan_depth, int detection_action, const char *quarantine_dir)
 {
-    if (file_path == NULL)
+    if (sign_path == NULL)
     {
-        return SF_NULL_FILE_PATH_POINTER; // 1
+        return SW_NULL_SIGN_PATH_POINTER; // 1
     }
-
-    if (vs == NULL)
+    if (journal_path == NULL)
     {
-        return SF_NULL_VSTRUCT_POINTER; // 2
+        return SW_NULL_JOURNAL_PATH_POINTER; // 2
     }
-
-    if (virus_flag == NULL)
+    if (shard_count == 0 || shard >= shard_count)
     {
-        return SF_NULL_VFLAG_POINTER; // 3
+        return SW_INVALID_SHARD; // 8
     }
 
+#ifdef _WIN32
+    (void)root_path;
+    (void)plan_depth;
+    (void)detection_action;
+    (void)quarantine_dir;
+    return SW_NOT_SUPPORTED; // 11
+#else
     // Declare all the variables:
-    unsigned char buffer[MAX_SIGNATURE_LENGTH];
-    size_t element_size, elements_number;
-    int flag = 0; // flag for virus flag;
-    FILE *file;
+    SweepContext *ctx;
+    struct sigaction action;
+    struct stat st;
+    char *root = NULL;
+    off_t valid_length;
+    size_t i;
+    int result;
 
-    file = fopen(file_path, "rb");
-    if (file == NULL)
+    ctx = calloc(1, sizeof(SweepContext));
+    if (ctx == NULL)
     {
-        return SF_FILE_FOPEN_ERROR; // 4
+        return SW_MALLOC_ERROR; // 7
     }
-
-    if (fseek(file, vs->offset, SEEK_SET) != 0)
+    if (av_engine_create(&ctx->engine) != AV_SUCCESS)
     {
-        fclose(file);
-        return SF_OFFSET_FSEEK_ERROR; // 14
+        free(ctx);
+        return SW_MALLOC_ERROR; // 7
+    }
+    if (av_engine_load(ctx->engine, sign_path) != AV_SUCCESS)
+    {
+        av_engine_destroy(ctx->engine);
+        free(ctx);
+        return SW_SIGNATURE_BASE_ERROR; // 3
     }
 
-    element_size = sizeof(buffer[0]);
-    elements_number = sizeof(buffer)/sizeof(buffer[0]);
-
-    if (fread(buffer, element_size, elements_number, file) != elements_number)
+    ctx->journal.fd = open(journal_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (ctx->journal.fd < 0)
     {
-        fclose(file);
-        return SF_BUFFER_FREAD_ERROR; // 15
+        av_engine_destroy(ctx->engine);
+        free(ctx);
+        return SW_JOURNAL_OPEN_ERROR; // 4
     }
-    // if equal -> memcmp should be 0 -> virus in file -> file is not safe
-    if (memcmp(buffer, vs->signature, elements_number) == 0)
+    ctx->journal.synced_ns = monotonic_ns();
+    ctx->action = detection_action;
+    ctx->quarantine_dir = quarantine_dir;
+
+    // 1) load and repair the journal -> 2) plan a new one -> 3) sweep the items of this shard
+    while (flock(ctx->journal.fd, LOCK_EX) != 0 && errno == EINTR);
+    result = journal_load(ctx, journal_path, &valid_length);
+    if (result == SW_SUCCESS && fstat(ctx->journal.fd, &st) == 0 && st.st_size > valid_length &&
+        ftruncate(ctx->journal.fd, valid_length) != 0)
     {
-        // if flag = 1 -> virus in file; else if flag = 0 -> virus not in file
-        flag = 1; // virus in file
+        result = SW_JOURNAL_WRITE_ERROR; // 6
     }
-    //else flag = 0. This could be either an error in the memcmp function itself or the fact that there is no virus
-    if (fclose(file) != 0)
+    if (result == SW_SUCCESS && ctx->item_count == 0)
     {
-        fclose(file);
-        return SF_FILE_FCLOSE_ERROR; // 16
+        root = (root_path != NULL) ? realpath(root_path, NULL) : NULL;
+        if (root == NULL || strlen(root) >= SWEEP_MAX_PATH)
+        {
+            result = SW_ROOT_ERROR; // 9
+        }
+        else
+        {
+            strcpy(ctx->path, root);
+            if (sweep_plan(ctx, plan_depth) != 0 || journal_flush(&ctx->journal, 0) != 0)
+            {
+                result = ctx->journal.error_flag ? SW_JOURNAL_WRITE_ERROR : SW_MALLOC_ERROR; // 6 : 7
+            }
+            else if (ctx->item_count == 0)
+            {
+                result = SW_ROOT_ERROR; // 9
+            }
+        }
+        free(root);
     }
+    flock(ctx->journal.fd, LOCK_UN);
+
+    if (result == SW_SUCCESS)
+    {
+        // No SA_RESTART is needed: the walk checks sweep_stop between entries
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = sweep_signal;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+        sweep_stop = 0;
+
+        for (i = shard; i < ctx->item_count && !sweep_stop && !ctx->journal.error_flag; i += shard_count)
+        {
+            strcpy(ctx->path, ctx->items[i]);
+            if (path_set_contains(&ctx->done, path_hash(ctx->path, strlen(ctx->path))))
+            {
+                ctx->skipped++;
+            }
+            else if (lstat(ctx->path, &st) == 0 && S_ISDIR(st.st_mode))
+            {
+                sweep_directory(ctx);
+            }
+            else if (lstat(ctx->path, &st) == 0 && S_ISREG(st.st_mode))
+            {
+                sweep_file(ctx);
+            }
+            else
+            {
+                journal_append(&ctx->journal, 'E', NULL, ctx->path, 1); // vanished since the plan
+            }
+        }
 
-    *virus_flag = flag;
+        journal_flush(&ctx->journal, 1);
+        printf("\nSweep: %llu files scanned, %llu infected, %llu unreadable, %llu files and directories already done\n",
+               (unsigned long long)ctx->scanned, (unsigned long long)ctx->infected,
+               (unsigned long long)ctx->unreadable, (unsigned long long)ctx->skipped);
+        if (ctx->journal.error_flag)
+        {
+            result = SW_JOURNAL_WRITE_ERROR; // 6
+        }
+        else if (sweep_stop)
+        {
+            result = SW_INTERRUPTED; // 10
+        }
+    }
 
-    return SF_SUCCESS; // 0
+    for (i = 0; i < ctx->item_count; i++)
+    {
+        free(ctx->items[i]);
+    }
+    free(ctx->items);
+    free(ctx->item_set.slots);
+    free(ctx->done.slots);
+    close(ctx->journal.fd);
+    av_engine_destroy(ctx->engine);
+    free(ctx);
+    return result;
+#endif
 }
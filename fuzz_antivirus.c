@@ -0,0 +1,1298 @@
+/**
+ * @brief Fuzz and differential test harness for the scanning engines of libantivirus.c.
+ *
+ * Every input is turned into a signature set and a target file, and the file is
+ * scanned by each engine:
+ * - scan_file() for every fixed-offset signature (the original fseek + memcmp path);
+ * - scan_fd() (first page reuse, pread, single-thread floating search);
+ * - scan_fd_hits() and scan_buffer_hits() (every match, from a descriptor or from memory);
+ *   scan_fd_hits() runs traced into rings that wrap, then the trace is dumped
+ *   (tracing must not change the hits);
+ * - scan_iovec_hits() on the data cut into segments of 0..12 bytes (carry across segments);
+ * - av_scan_fd(), av_scan_buffer() and av_scan_iovec() (library API on a loaded engine);
+ * - av_scan_fd_control() with a yield callback and the I/O limiter (must not change
+ *   the hits), with a deadline that has already passed (must give AV_DEADLINE_EXPIRED)
+ *   and with one that passes after the first chunk (the hits found by then must be kept);
+ * - av_scan_fd() with AV_SCAN_FIRST_HIT (a verdict, and only real hits);
+ * - scan_fd_floating() with 1..4 threads (chunk carry, range split, merge), collecting
+ *   every match and stopping at the first floating signature.
+ *
+ * Every input is also turned into a PE file with one section of random (from a
+ * generator seeded by the input) or low-entropy (input bytes masked to 4 bits) data,
+ * marked as code or as data. The section entropy of scan_fd_hits(), av_scan_fd() and
+ * av_scan_buffer() must equal the entropy computed here from the section bytes, and
+ * only random code must be flagged as packed (see entropy_check()).
+ *
+ * Half of the inputs also get a rule on two of the signatures ("#a >= K and not
+ * $b in (L..H) or @b[2] - @a == D"), whose verdict is worked out directly from
+ * the data (see reference_rule()).
+ *
+ * Built with -DAV_STATIC_SIGNATURES, the compiled-in signatures are also planted into
+ * each file and searched by scan_buffer_hits() and scan_iovec_hits() (the generated
+ * unrolled matcher) and by av_scan_buffer() on a new engine (see static_check()).
+ *
+ * The results are compared with a naive reference that runs memcmp() at the
+ * signature offset (fixed signatures) or at every position (floating signatures).
+ * Any difference is a bug in a fast path and is reported with its input.
+ *
+ * Chunks and ranges are made tiny here, so that even short inputs cross chunk
+ * and range borders.
+ *
+ * libFuzzer:
+ * @code
+ * clang -g -O1 -fsanitize=fuzzer,address -DFUZZ_LIBFUZZER -pthread fuzz_antivirus.c -o fuzz_antivirus -lm
+ * ./fuzz_antivirus corpus/
+ * @endcode
+ *
+ * AFL (one input file per run) or random differential testing:
+ * @code
+ * gcc -O2 -pthread fuzz_antivirus.c -o fuzz_antivirus -lm
+ * afl-fuzz -i corpus -o findings -- ./fuzz_antivirus @@
+ * ./fuzz_antivirus -n 100000 -s 42
+ * @endcode
+ */
+#define SCAN_CHUNK_SIZE 61 // odd sizes so chunk borders fall everywhere
+#define PARALLEL_SCAN_MIN_RANGE 97
+#define MAX_SPARSE_FIRST_BYTES 1 // both prefilter loops with at most FUZZ_MAX_SIGNATURES signatures
+#define HISTOGRAM_SPLIT_MIN 24 // chunks and sections counted both ways
+#include "libantivirus.c"
+
+/**
+ * @def FUZZ_MAX_SIGNATURES
+ * @brief Maximum number of signatures taken from one input.
+ */
+#define FUZZ_MAX_SIGNATURES 8
+
+/**
+ * @def FUZZ_MAX_THREADS
+ * @brief scan_fd_floating() is run with 1..FUZZ_MAX_THREADS threads.
+ */
+#define FUZZ_MAX_THREADS 4
+
+/**
+ * @def FUZZ_TRACE_EVENTS
+ * @brief Slots of the trace rings, few enough that a scan wraps them.
+ */
+#define FUZZ_TRACE_EVENTS 16
+
+/**
+ * @def FUZZ_RANDOM_FILE_SIZE
+ * @brief Maximum size of a random target file in differential mode.
+ */
+#define FUZZ_RANDOM_FILE_SIZE 2048
+
+/** @brief Number of mismatches found so far. */
+static size_t fuzz_mismatches = 0;
+
+/**
+ * @brief Rule added to the signature set of one input, with the parameters of its condition.
+ */
+typedef struct
+{
+    unsigned char a[MAX_SIGNATURE_LENGTH]; /**< Bytes of atom $a. */
+    unsigned char b[MAX_SIGNATURE_LENGTH]; /**< Bytes of atom $b. */
+    int file_type; /**< File type of the rule. */
+    size_t min_count; /**< K of "#a >= K". */
+    uint64_t low; /**< L of "$b in (L..H)". */
+    uint64_t high; /**< H of "$b in (L..H)". */
+    uint64_t distance; /**< D of "@b[2] - @a == D". */
+} FuzzRule;
+
+/**
+ * @brief Yield callback of av_scan_fd_control(): counts the calls.
+ *
+ * @param [in] arg Counter (size_t).
+ */
+static void fuzz_yield(void *arg)
+{
+    (*(size_t *)arg)++;
+}
+
+/**
+ * @brief Yield callback of av_scan_fd_control(): sleeps until the deadline has passed.
+ *
+ * @param [in] arg Deadline (uint64_t, CLOCK_MONOTONIC nanoseconds).
+ */
+static void fuzz_late_yield(void *arg)
+{
+    // Declare all the variables:
+    uint64_t deadline_ns = *(const uint64_t *)arg;
+    uint64_t now = monotonic_ns();
+    struct timespec pause;
+
+    if (now <= deadline_ns)
+    {
+        pause.tv_sec = (time_t)((deadline_ns - now + 1000) / 1000000000ull);
+        pause.tv_nsec = (long)((deadline_ns - now + 1000) % 1000000000ull);
+        nanosleep(&pause, NULL);
+    }
+}
+
+/**
+ * @brief Reports a mismatch between an engine and the reference.
+ *
+ * Under libFuzzer the process is aborted, so the input is saved as a crash.
+ *
+ * @param [in] engine Name of the engine that disagreed.
+ * @param [in] detail What differed.
+ */
+static void fuzz_report(const char *engine, const char *detail)
+{
+    fprintf(stderr, "MISMATCH in %s: %s\n", engine, detail);
+    fuzz_mismatches++;
+#ifdef FUZZ_LIBFUZZER
+    abort();
+#endif
+}
+
+/**
+ * @brief Naive reference: every signature of the subset, memcmp at every candidate position.
+ *
+ * @param [in] sb Signature base.
+ * @param [in] file_type Detected file type.
+ * @param [in] data File contents.
+ * @param [in] size File size.
+ * @param [in] floating 0 to collect fixed hits, 1 floating hits, 2 floating hits with rule atoms.
+ * @param [out] hits Hits sorted by offset, then signature.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+static int reference_scan(const SignatureBase *sb, int file_type, const unsigned char *data, size_t size,
+                          int floating, ScanHits *hits)
+{
+    // Declare all the variables:
+    const VirusSignature *vs;
+    size_t i, position;
+
+    hits->items = NULL;
+    hits->count = 0;
+    hits->capacity = 0;
+
+    for (position = 0; position + MAX_SIGNATURE_LENGTH <= size; position++)
+    {
+        for (i = 0; i < sb->subset_sizes[file_type]; i++)
+        {
+            vs = &sb->signatures[sb->subsets[file_type][i]];
+            if ((vs->offset == SIGNATURE_ANY_OFFSET) != (floating != 0))
+            {
+                continue;
+            }
+            if (floating == 1 && sb->subsets[file_type][i] >= sb->count - sb->atom_count) // atoms are not reported
+            {
+                continue;
+            }
+            if (!floating && vs->offset != position)
+            {
+                continue;
+            }
+            if (memcmp(data + position, vs->signature, MAX_SIGNATURE_LENGTH) == 0 &&
+                add_scan_hit(hits, sb->subsets[file_type][i], position) != 0)
+            {
+                return -1;
+            }
+        }
+    }
+
+    if (hits->count > 1)
+    {
+        qsort(hits->items, hits->count, sizeof(hits->items[0]), compare_scan_hits);
+    }
+    return 0;
+}
+
+/**
+ * @brief Reference verdict of the fuzz rule, worked out from the data without the rule engine.
+ *
+ * @param [in] rule Fuzz rule (NULL if the input has none).
+ * @param [in] sb Signature base with the rule.
+ * @param [in] file_type Detected file type.
+ * @param [in] data File contents.
+ * @param [in] size File size.
+ * @param [out] hits The rule's hit if its condition holds, else empty.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+static int reference_rule(const FuzzRule *rule, const SignatureBase *sb, int file_type, const unsigned char *data,
+                          size_t size, ScanHits *hits)
+{
+    // Declare all the variables:
+    size_t count_a = 0, count_b = 0, position;
+    uint64_t first_a = 0, first_b = 0, second_b = 0;
+    int b_in_range = 0, verdict;
+
+    hits->items = NULL;
+    hits->count = 0;
+    hits->capacity = 0;
+    if (rule == NULL || (rule->file_type != file_type && rule->file_type != FT_ANY))
+    {
+        return 0;
+    }
+
+    for (position = 0; position + MAX_SIGNATURE_LENGTH <= size; position++)
+    {
+        if (memcmp(data + position, rule->a, MAX_SIGNATURE_LENGTH) == 0 && count_a++ == 0)
+        {
+            first_a = position;
+        }
+        if (memcmp(data + position, rule->b, MAX_SIGNATURE_LENGTH) == 0)
+        {
+            first_b = (count_b == 0) ? position : first_b;
+            second_b = (count_b == 1) ? position : second_b;
+            count_b++;
+            b_in_range |= (position >= rule->low && position <= rule->high);
+        }
+    }
+
+    verdict = (count_a >= rule->min_count && !b_in_range) ||
+              (count_a > 0 && count_b > 1 && second_b - first_a == rule->distance);
+    if (!verdict)
+    {
+        return 0;
+    }
+    if (count_a > 0 && count_b > 0)
+    {
+        position = (size_t)((first_a < first_b) ? first_a : first_b);
+    }
+    else
+    {
+        position = (size_t)((count_a > 0) ? first_a : (count_b > 0) ? first_b : 0);
+    }
+    return add_scan_hit(hits, sb->rules[0].signature_index, position);
+}
+
+/**
+ * @brief Returns 1 if two sorted hits lists are equal.
+ */
+static int same_hits(const ScanHits *a, const ScanHits *b)
+{
+    return a->count == b->count &&
+           (a->count == 0 || memcmp(a->items, b->items, a->count * sizeof(a->items[0])) == 0);
+}
+
+/**
+ * @brief Returns 1 if every hit of a list is also in a reference list.
+ */
+static int hits_within(const ScanHits *hits, const ScanHits *reference)
+{
+    // Declare all the variables:
+    size_t i, j;
+    int found;
+
+    for (i = 0; i < hits->count; i++)
+    {
+        found = 0;
+        for (j = 0; j < reference->count && !found; j++)
+        {
+            found = (compare_scan_hits(&hits->items[i], &reference->items[j]) == 0);
+        }
+        if (!found)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Returns 1 if every hit of a library result is a reference hit (same name and offset).
+ *
+ * @param [in] sb Signature base of the references.
+ * @param [in] result Library scan result.
+ * @param [in] fixed_reference Reference fixed-offset hits.
+ * @param [in] floating_reference Reference floating hits.
+ * @param [in] rule_reference Reference rule hits (NULL if rules must not be reported).
+ */
+static int result_within(const SignatureBase *sb, const AvScanResult *result, const ScanHits *fixed_reference,
+                         const ScanHits *floating_reference, const ScanHits *rule_reference)
+{
+    // Declare all the variables:
+    const ScanHits *references[3] = {fixed_reference, floating_reference, rule_reference};
+    const ScanHit *hit;
+    size_t i, j, k;
+    int found;
+
+    for (i = 0; i < result->hit_count; i++)
+    {
+        found = 0;
+        for (k = 0; k < 3 && !found; k++)
+        {
+            for (j = 0; references[k] != NULL && j < references[k]->count && !found; j++)
+            {
+                hit = &references[k]->items[j];
+                found = (hit->offset == result->hits[i].offset &&
+                         strcmp(sb->signatures[hit->signature_index].virus_name, result->hits[i].virus_name) == 0);
+            }
+        }
+        if (!found)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Checks a complete hits list (fixed matches in any order, floating ones, then rules) against the reference.
+ *
+ * @param [in] engine Name of the engine that produced the hits.
+ * @param [in] sb Signature base.
+ * @param [in] hits Hits to check.
+ * @param [in] fixed_reference Reference fixed-offset hits.
+ * @param [in] floating_reference Reference floating hits.
+ * @param [in] rule_reference Reference rule hits (NULL to leave rule hits unchecked).
+ */
+static void check_all_hits(const char *engine, const SignatureBase *sb, const ScanHits *hits,
+                           const ScanHits *fixed_reference, const ScanHits *floating_reference,
+                           const ScanHits *rule_reference)
+{
+    // Declare all the variables:
+    ScanHits fixed = {NULL, 0, 0};
+    ScanHits floating = {NULL, 0, 0};
+    ScanHits rules = {NULL, 0, 0};
+    char detail[256];
+    size_t i;
+    int floating_seen = 0, rule_seen = 0, order_flag = 1;
+
+    for (i = 0; i < hits->count; i++)
+    {
+        if (sb->signatures[hits->items[i].signature_index].offset == SIGNATURE_RULE_OFFSET)
+        {
+            rule_seen = 1;
+            add_scan_hit(&rules, hits->items[i].signature_index, hits->items[i].offset);
+        }
+        else if (sb->signatures[hits->items[i].signature_index].offset == SIGNATURE_ANY_OFFSET)
+        {
+            order_flag &= !rule_seen; // rules come last
+            floating_seen = 1;
+            add_scan_hit(&floating, hits->items[i].signature_index, hits->items[i].offset);
+        }
+        else
+        {
+            order_flag &= !floating_seen && !rule_seen; // fixed matches must come first
+            add_scan_hit(&fixed, hits->items[i].signature_index, hits->items[i].offset);
+        }
+    }
+    if (fixed.count > 1)
+    {
+        qsort(fixed.items, fixed.count, sizeof(fixed.items[0]), compare_scan_hits);
+    }
+
+    if (!order_flag || !same_hits(&fixed, fixed_reference) || !same_hits(&floating, floating_reference) ||
+        (rule_reference != NULL && !same_hits(&rules, rule_reference)))
+    {
+        snprintf(detail, sizeof(detail), "%zu fixed + %zu floating + %zu rule hits, reference %zu + %zu + %zu%s",
+                 fixed.count, floating.count, rules.count, fixed_reference->count, floating_reference->count,
+                 (rule_reference != NULL) ? rule_reference->count : rules.count, order_flag ? "" : " (out of order)");
+        fuzz_report(engine, detail);
+    }
+
+    free_scan_hits(&fixed);
+    free_scan_hits(&floating);
+    free_scan_hits(&rules);
+}
+
+/**
+ * @brief Checks the verdict of a library scan against the reference.
+ *
+ * @param [in] engine Name of the function that produced the result.
+ * @param [in] result Library scan result.
+ * @param [in] expected Number of reference hits.
+ */
+static void check_av_result(const char *engine, const AvScanResult *result, size_t expected)
+{
+    // Declare all the variables:
+    char detail[256];
+
+    if (result->hit_count != expected)
+    {
+        snprintf(detail, sizeof(detail), "%zu hits, reference %zu", result->hit_count, expected);
+        fuzz_report(engine, detail);
+    }
+}
+
+/**
+ * @brief Cuts data into short segments (0..12 bytes, sizes taken from the position and the data).
+ *
+ * @param [in] data Bytes to cut.
+ * @param [in] size Number of bytes.
+ * @param [out] iov Segments; room for 2 * size + 1 entries.
+ * @return Number of segments.
+ */
+static size_t split_segments(const unsigned char *data, size_t size, struct iovec *iov)
+{
+    // Declare all the variables:
+    size_t count = 0, position = 0, length;
+
+    while (position < size)
+    {
+        length = (position * 7 + data[position]) % 13;
+        if (length > size - position)
+        {
+            length = size - position;
+        }
+        iov[count].iov_base = (void *)(data + position);
+        iov[count].iov_len = length;
+        count++;
+        position += length;
+        if (length == 0) // keep an empty segment, then move on
+        {
+            iov[count].iov_base = (void *)(data + position);
+            iov[count].iov_len = 1;
+            count++;
+            position++;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * @brief Writes a buffer to a new temporary file.
+ *
+ * @param [in] data Bytes to write.
+ * @param [in] size Number of bytes.
+ * @param [out] path Template, replaced by the file name.
+ * @return Descriptor of the file, or -1 on error.
+ */
+static int write_temp_file(const unsigned char *data, size_t size, char *path)
+{
+    // Declare all the variables:
+    int fd = mkstemp(path);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (size > 0 && write(fd, data, size) != (ssize_t)size)
+    {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Returns the Shannon entropy of bytes in bits per byte, computed directly.
+ */
+static double reference_entropy(const unsigned char *data, size_t size)
+{
+    // Declare all the variables:
+    uint64_t counts[256] = {0};
+    double entropy = 0.0, p;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        counts[data[i]]++;
+    }
+    for (i = 0; i < 256 && size > 0; i++)
+    {
+        if (counts[i] != 0)
+        {
+            p = (double)counts[i] / (double)size;
+            entropy -= p * log2(p);
+        }
+    }
+    return entropy;
+}
+
+/**
+ * @brief Checks the packed-file triage on a PE file built from the input.
+ *
+ * The file has a 512-byte header and one ".text" section of at least MIN_ENTROPY_BYTES
+ * bytes: random bytes from a generator seeded by the data, or the data masked to 4 bits
+ * (entropy 4 at most), marked as code or as initialized data. Only random code must set
+ * the packed flag, and every engine must report the entropy of the section bytes.
+ * Some files get a second, ".rsrc" data section in the header, apart from ".text" or
+ * overlapping its start, so the file entropy is summed from the sections or counted whole.
+ *
+ * @param [in] engine Engine with loaded signatures.
+ * @param [in] sb The same signature base.
+ * @param [in] data Input the section is made from.
+ * @param [in] size Size of the input.
+ */
+static void entropy_check(AvEngine *engine, const SignatureBase *sb, const unsigned char *data, size_t size)
+{
+    // Declare all the variables:
+    char target_path[] = "/tmp/fuzz_peXXXXXX";
+    char detail[256];
+    unsigned char *file;
+    EntropyStats *stats;
+    AvScanResult result;
+    ScanHits hits;
+    uint64_t state = 0xcbf29ce484222325ull;
+    size_t section_size = MIN_ENTROPY_BYTES + size % 4096, i;
+    size_t rsrc_offset = 0x100, rsrc_size = 0, section_count = 1;
+    int random_flag = (size > 0) && (data[0] & 1), code_flag = (size == 0) || (data[0] & 2) == 0;
+    int expected_flag, engine_type, fd, status;
+    double expected_section, expected_rsrc = 0.0, expected_file;
+
+    file = calloc(1, 512 + section_size);
+    stats = malloc(sizeof(*stats));
+    if (file == NULL || stats == NULL)
+    {
+        free(file);
+        free(stats);
+        return;
+    }
+
+    // "MZ", e_lfanew = 0x40, "PE\0\0", COFF header with one section and no optional header
+    file[0] = 'M';
+    file[1] = 'Z';
+    file[0x3C] = 0x40;
+    memcpy(file + 0x40, "PE\0\0\x4c\x01\x01\x00", 8);
+    memcpy(file + 0x58, ".text", 5);
+    for (i = 0; i < 4; i++)
+    {
+        file[0x58 + 16 + i] = (unsigned char)(section_size >> (8 * i)); // raw size
+        file[0x58 + 20 + i] = (unsigned char)(512u >> (8 * i)); // raw offset
+        file[0x58 + 36 + i] = (unsigned char)((code_flag ? 0x60000020u : 0x40000040u) >> (8 * i));
+    }
+    if (size > 0 && (data[0] & 4) != 0) // ".rsrc" up to ".text", or 64 bytes into it
+    {
+        rsrc_size = 512 - rsrc_offset + ((data[0] & 8) ? 64 : 0);
+        section_count = 2;
+        file[0x46] = 2;
+        memcpy(file + 0x80, ".rsrc", 5);
+        for (i = 0; i < 4; i++)
+        {
+            file[0x80 + 16 + i] = (unsigned char)(rsrc_size >> (8 * i));
+            file[0x80 + 20 + i] = (unsigned char)(rsrc_offset >> (8 * i));
+            file[0x80 + 36 + i] = (unsigned char)(0x40000040u >> (8 * i));
+        }
+        for (i = 0x100; i < 0x180; i++)
+        {
+            file[i] = data[i % size];
+        }
+    }
+
+    for (i = 0; i < size; i++)
+    {
+        state = (state ^ data[i]) * 0x100000001b3ull;
+    }
+    for (i = 0; i < section_size; i++)
+    {
+        if (random_flag) // xorshift64*
+        {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            file[512 + i] = (unsigned char)((state * 0x2545F4914F6CDD1Dull) >> 56);
+        }
+        else
+        {
+            file[512 + i] = (unsigned char)(((size > 0) ? data[i % size] : i) & 0x0F);
+        }
+    }
+
+    expected_flag = random_flag && code_flag;
+    expected_section = reference_entropy(file + 512, section_size);
+    expected_rsrc = reference_entropy(file + rsrc_offset, rsrc_size);
+    expected_file = reference_entropy(file, 512 + section_size);
+
+    fd = write_temp_file(file, 512 + section_size, target_path);
+    if (fd < 0)
+    {
+        free(file);
+        free(stats);
+        return;
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        status = (i == 0) ? av_scan_buffer(engine, file, 512 + section_size, AV_SCAN_ENTROPY, &result)
+                          : av_scan_fd(engine, fd, AV_SCAN_ENTROPY, &result);
+        if (status != AV_SUCCESS)
+        {
+            fuzz_report((i == 0) ? "av_scan_buffer (entropy)" : "av_scan_fd (entropy)", "returned an error");
+            continue;
+        }
+        if (result.packed_flag != expected_flag ||
+            (expected_flag && (strcmp(result.packed_section, ".text") != 0 ||
+                               fabs(result.packed_entropy - expected_section) > 1e-9)))
+        {
+            snprintf(detail, sizeof(detail), "packed %d in \"%s\" at %.6f, reference %d at %.6f",
+                     result.packed_flag, result.packed_section, result.packed_entropy, expected_flag, expected_section);
+            fuzz_report((i == 0) ? "av_scan_buffer (entropy)" : "av_scan_fd (entropy)", detail);
+        }
+        av_free_result(&result);
+    }
+
+    // Tiny chunks and ranges: the section is counted in pieces by several threads and summed
+    if (scan_fd_hits(fd, sb, 0, FUZZ_MAX_THREADS, NULL, &engine_type, &hits, stats) != SFD_SUCCESS)
+    {
+        fuzz_report("scan_fd_hits (entropy)", "returned an error");
+    }
+    else
+    {
+        free_scan_hits(&hits);
+        if (engine_type != FT_PE || stats->section_count != section_count || stats->sections[0].bytes != section_size ||
+            stats->bytes != 512 + section_size || stats->packed_flag != expected_flag ||
+            fabs(stats->sections[0].entropy - expected_section) > 1e-9 || fabs(stats->entropy - expected_file) > 1e-9 ||
+            (section_count == 2 && (stats->sections[1].bytes != rsrc_size ||
+                                    fabs(stats->sections[1].entropy - expected_rsrc) > 1e-9)))
+        {
+            snprintf(detail, sizeof(detail), "type %d, %zu sections, section %.6f, file %.6f, packed %d, "
+                     "reference %.6f, %.6f, %d", engine_type, stats->section_count,
+                     (stats->section_count > 0) ? stats->sections[0].entropy : 0.0, stats->entropy,
+                     stats->packed_flag, expected_section, expected_file, expected_flag);
+            fuzz_report("scan_fd_hits (entropy)", detail);
+        }
+    }
+
+    close(fd);
+    unlink(target_path);
+    free(file);
+    free(stats);
+}
+
+/**
+ * @brief Runs all engines on one signature file and target file and compares them with the reference.
+ *
+ * @param [in] signature_text Contents of the signature file.
+ * @param [in] rule Rule written at the end of signature_text (NULL if none).
+ * @param [in] data Contents of the target file.
+ * @param [in] size Size of the target file.
+ */
+static void differential_check(const char *signature_text, const FuzzRule *rule, const unsigned char *data, size_t size)
+{
+    // Declare all the variables:
+    char sign_path[] = "/tmp/fuzz_sigXXXXXX";
+    char target_path[] = "/tmp/fuzz_dataXXXXXX";
+    char detail[256];
+    SignatureBase sb;
+    ScanHits fixed_reference, floating_reference, atom_reference, rule_reference, hits;
+    AvEngine *engine = NULL;
+    AvScanResult result;
+    AvScanControl control;
+    uint64_t late_deadline;
+    size_t yields = 0, expected, signature_hits, early_hits;
+    struct iovec *iov;
+    size_t iovcnt = 0;
+    const VirusSignature *vs;
+    size_t i, threads, signature_index = 0;
+    int sign_fd, fd, file_type = FT_UNKNOWN, engine_type, virus_flag, expected_flag, status;
+
+    sign_fd = write_temp_file((const unsigned char *)signature_text, strlen(signature_text), sign_path);
+    if (sign_fd < 0)
+    {
+        return;
+    }
+    close(sign_fd);
+    if (read_signature_base(sign_path, &sb) != RSB_SUCCESS)
+    {
+        unlink(sign_path);
+        return;
+    }
+    if (av_engine_create(&engine) == AV_SUCCESS)
+    {
+        av_engine_set_io_limit(engine, 1ull << 40, 1ull << 30); // charged, but never sleeps
+        av_engine_set_numa(engine); // replicas where the machine has several nodes
+    }
+    if (engine == NULL || av_engine_load(engine, sign_path) != AV_SUCCESS)
+    {
+        fuzz_report("av_engine_load", "failed on a file read_signature_base() accepted");
+        av_engine_destroy(engine);
+        free_signature_base(&sb);
+        unlink(sign_path);
+        return;
+    }
+    unlink(sign_path);
+
+    fd = write_temp_file(data, size, target_path);
+    if (fd < 0)
+    {
+        av_engine_destroy(engine);
+        free_signature_base(&sb);
+        return;
+    }
+
+    detect_file_type(data, (size < FILE_HEADER_PAGE_SIZE) ? size : FILE_HEADER_PAGE_SIZE, &file_type);
+    if (reference_scan(&sb, file_type, data, size, 0, &fixed_reference) != 0 ||
+        reference_scan(&sb, file_type, data, size, 1, &floating_reference) != 0 ||
+        reference_scan(&sb, file_type, data, size, 2, &atom_reference) != 0 ||
+        reference_rule(rule, &sb, file_type, data, size, &rule_reference) != 0)
+    {
+        free_scan_hits(&fixed_reference);
+        free_scan_hits(&floating_reference);
+        free_scan_hits(&atom_reference);
+        free_scan_hits(&rule_reference);
+        close(fd);
+        unlink(target_path);
+        av_engine_destroy(engine);
+        free_signature_base(&sb);
+        return;
+    }
+    expected = fixed_reference.count + floating_reference.count + rule_reference.count;
+
+    // scan_file(): one fixed signature at a time, by path
+    for (i = 0; i < sb.subset_sizes[file_type]; i++)
+    {
+        vs = &sb.signatures[sb.subsets[file_type][i]];
+        if (vs->offset == SIGNATURE_ANY_OFFSET || vs->offset + MAX_SIGNATURE_LENGTH > size)
+        {
+            continue;
+        }
+        virus_flag = 0;
+        if (scan_file(target_path, (VirusSignature *)vs, &virus_flag) != SF_SUCCESS)
+        {
+            fuzz_report("scan_file", "returned an error");
+            continue;
+        }
+        expected_flag = (memcmp(data + vs->offset, vs->signature, MAX_SIGNATURE_LENGTH) == 0);
+        if (virus_flag != expected_flag)
+        {
+            snprintf(detail, sizeof(detail), "signature %zu: flag %d, reference %d",
+                     sb.subsets[file_type][i], virus_flag, expected_flag);
+            fuzz_report("scan_file", detail);
+        }
+    }
+
+    // scan_fd_floating(): every thread count must give exactly the reference hits (rule atoms too)
+    for (threads = 1; threads <= FUZZ_MAX_THREADS; threads++)
+    {
+        if (scan_fd_floating(fd, &sb, file_type, 0, threads, NULL, &hits, NULL) != SFF_SUCCESS)
+        {
+            fuzz_report("scan_fd_floating", "returned an error");
+            continue;
+        }
+        if (!same_hits(&hits, &atom_reference))
+        {
+            snprintf(detail, sizeof(detail), "%zu threads: %zu hits, reference %zu",
+                     threads, hits.count, atom_reference.count);
+            fuzz_report("scan_fd_floating", detail);
+        }
+        free_scan_hits(&hits);
+    }
+
+    // scan_fd_floating() with first_hit: real hits only, at least one floating signature if there is
+    // one, and the complete list (for the rules) if there is none
+    for (threads = 1; threads <= FUZZ_MAX_THREADS; threads++)
+    {
+        if (scan_fd_floating(fd, &sb, file_type, 1, threads, NULL, &hits, NULL) != SFF_SUCCESS)
+        {
+            fuzz_report("scan_fd_floating (first hit)", "returned an error");
+            continue;
+        }
+        for (i = 0, signature_hits = 0; i < hits.count; i++)
+        {
+            signature_hits += (hits.items[i].signature_index < sb.count - sb.atom_count);
+        }
+        if (!hits_within(&hits, &atom_reference) || (signature_hits > 0) != (floating_reference.count > 0) ||
+            (floating_reference.count == 0 && !same_hits(&hits, &atom_reference)))
+        {
+            snprintf(detail, sizeof(detail), "%zu threads: %zu hits (%zu signatures), reference %zu (%zu signatures)",
+                     threads, hits.count, signature_hits, atom_reference.count, floating_reference.count);
+            fuzz_report("scan_fd_floating (first hit)", detail);
+        }
+        free_scan_hits(&hits);
+    }
+
+    // scan_fd(): detection flag, and the reported signature must really be in the file
+    if (scan_fd(fd, &sb, &virus_flag, &signature_index) != SFD_SUCCESS)
+    {
+        fuzz_report("scan_fd", "returned an error");
+    }
+    else
+    {
+        expected_flag = (expected > 0);
+        if (virus_flag != expected_flag)
+        {
+            snprintf(detail, sizeof(detail), "flag %d, reference %d", virus_flag, expected_flag);
+            fuzz_report("scan_fd", detail);
+        }
+        else if (virus_flag)
+        {
+            expected_flag = 0;
+            for (i = 0; i < fixed_reference.count; i++)
+            {
+                expected_flag |= (fixed_reference.items[i].signature_index == signature_index);
+            }
+            for (i = 0; i < floating_reference.count; i++)
+            {
+                expected_flag |= (floating_reference.items[i].signature_index == signature_index);
+            }
+            for (i = 0; i < rule_reference.count; i++)
+            {
+                expected_flag |= (rule_reference.items[i].signature_index == signature_index);
+            }
+            if (!expected_flag)
+            {
+                snprintf(detail, sizeof(detail), "reported signature %zu is not in the file", signature_index);
+                fuzz_report("scan_fd", detail);
+            }
+        }
+    }
+
+    // scan_fd_hits() and scan_buffer_hits(): every match, and the detected type
+    av_trace_enable(FUZZ_TRACE_EVENTS);
+    av_trace_file_begin("fuzz;input\n\"");
+    status = scan_fd_hits(fd, &sb, 0, 2, NULL, &engine_type, &hits, NULL);
+    av_trace_file_end();
+    av_trace_enable(0);
+    if (av_trace_dump("/dev/null", (size % 2 == 0) ? AV_TRACE_CHROME : AV_TRACE_FOLDED) != AV_SUCCESS)
+    {
+        fuzz_report("av_trace_dump", "returned an error");
+    }
+    if (status != SFD_SUCCESS)
+    {
+        fuzz_report("scan_fd_hits", "returned an error");
+    }
+    else
+    {
+        check_all_hits((engine_type == file_type) ? "scan_fd_hits" : "scan_fd_hits (file type)",
+                       &sb, &hits, &fixed_reference, &floating_reference, &rule_reference);
+        free_scan_hits(&hits);
+    }
+    if (scan_buffer_hits(data, size, &sb, 0, &engine_type, &hits, NULL) != SBH_SUCCESS)
+    {
+        fuzz_report("scan_buffer_hits", "returned an error");
+    }
+    else
+    {
+        check_all_hits((engine_type == file_type) ? "scan_buffer_hits" : "scan_buffer_hits (file type)",
+                       &sb, &hits, &fixed_reference, &floating_reference, &rule_reference);
+        free_scan_hits(&hits);
+    }
+
+    iov = malloc((2 * size + 1) * sizeof(*iov));
+    if (iov != NULL)
+    {
+        iovcnt = split_segments(data, size, iov);
+        if (scan_iovec_hits(iov, iovcnt, &sb, 0, &engine_type, &hits, NULL) != SBH_SUCCESS)
+        {
+            fuzz_report("scan_iovec_hits", "returned an error");
+        }
+        else
+        {
+            check_all_hits((engine_type == file_type) ? "scan_iovec_hits" : "scan_iovec_hits (file type)",
+                           &sb, &hits, &fixed_reference, &floating_reference, &rule_reference);
+            free_scan_hits(&hits);
+        }
+    }
+
+    // Library API: same number of hits through the engine
+    if (av_scan_fd(engine, fd, AV_SCAN_ENTROPY, &result) != AV_SUCCESS)
+    {
+        fuzz_report("av_scan_fd", "returned an error");
+    }
+    else
+    {
+        check_av_result("av_scan_fd", &result, expected);
+        av_free_result(&result);
+    }
+    control.deadline_ns = monotonic_ns() + 60ull * 1000000000ull;
+    control.yield = fuzz_yield;
+    control.yield_arg = &yields;
+    if (av_scan_fd_control(engine, fd, AV_SCAN_IO_LIMIT, &control, &result) != AV_SUCCESS)
+    {
+        fuzz_report("av_scan_fd_control", "returned an error");
+    }
+    else
+    {
+        check_av_result("av_scan_fd_control", &result, expected);
+        av_free_result(&result);
+    }
+    control.deadline_ns = 1; // long gone
+    if (av_scan_fd_control(engine, fd, AV_SCAN_DEFAULT, &control, &result) != AV_DEADLINE_EXPIRED)
+    {
+        fuzz_report("av_scan_fd_control", "ignored a passed deadline");
+    }
+    av_free_result(&result);
+
+    // Deadline passing after the first chunk: what was found by then is kept and real, no rules
+    for (i = 0, early_hits = 0; i < floating_reference.count; i++)
+    {
+        early_hits += (floating_reference.items[i].offset + MAX_SIGNATURE_LENGTH <= SCAN_CHUNK_SIZE);
+    }
+    late_deadline = monotonic_ns() + 1000000;
+    control.deadline_ns = late_deadline;
+    control.yield = fuzz_late_yield;
+    control.yield_arg = &late_deadline;
+    status = av_scan_fd_control(engine, fd, AV_SCAN_SINGLE_THREAD, &control, &result);
+    if (status != AV_SUCCESS && status != AV_DEADLINE_EXPIRED)
+    {
+        fuzz_report("av_scan_fd_control (late)", "returned an error");
+    }
+    else if (!result_within(&sb, &result, &fixed_reference, &floating_reference,
+                            (status == AV_SUCCESS) ? &rule_reference : NULL) ||
+             (status == AV_SUCCESS && result.hit_count != expected) ||
+             (status == AV_DEADLINE_EXPIRED && early_hits > 0 && result.hit_count == 0))
+    {
+        snprintf(detail, sizeof(detail), "%s with %zu hits, reference %zu",
+                 (status == AV_SUCCESS) ? "finished" : "late", result.hit_count, expected);
+        fuzz_report("av_scan_fd_control (late)", detail);
+    }
+    av_free_result(&result);
+
+    // First hit: a verdict, and only hits that are really in the file; rules only without a signature
+    if (av_scan_fd(engine, fd, AV_SCAN_FIRST_HIT, &result) != AV_SUCCESS)
+    {
+        fuzz_report("av_scan_fd (first hit)", "returned an error");
+    }
+    else
+    {
+        if ((result.hit_count > 0) != (expected > 0) ||
+            !result_within(&sb, &result, &fixed_reference, &floating_reference,
+                           (fixed_reference.count + floating_reference.count > 0) ? NULL : &rule_reference))
+        {
+            snprintf(detail, sizeof(detail), "%zu hits, reference %zu", result.hit_count, expected);
+            fuzz_report("av_scan_fd (first hit)", detail);
+        }
+        av_free_result(&result);
+    }
+    if (av_scan_buffer(engine, data, size, AV_SCAN_ENTROPY, &result) != AV_SUCCESS)
+    {
+        fuzz_report("av_scan_buffer", "returned an error");
+    }
+    else
+    {
+        check_av_result("av_scan_buffer", &result, expected);
+        av_free_result(&result);
+    }
+    if (iov != NULL)
+    {
+        if (av_scan_iovec(engine, iov, (int)iovcnt, AV_SCAN_ENTROPY, &result) != AV_SUCCESS)
+        {
+            fuzz_report("av_scan_iovec", "returned an error");
+        }
+        else
+        {
+            check_av_result("av_scan_iovec", &result, expected);
+            av_free_result(&result);
+        }
+        free(iov);
+    }
+    entropy_check(engine, &sb, data, size);
+
+    free_scan_hits(&fixed_reference);
+    free_scan_hits(&floating_reference);
+    free_scan_hits(&atom_reference);
+    free_scan_hits(&rule_reference);
+    close(fd);
+    unlink(target_path);
+    av_engine_destroy(engine);
+    free_signature_base(&sb);
+}
+
+#ifdef AV_STATIC_SIGNATURES
+/**
+ * @brief Checks the generated matcher of the compiled-in signatures against the reference.
+ *
+ * A floating signature of static_signature_base is planted into a copy of the data
+ * (chosen and placed by the data itself), then the file is scanned with the static
+ * base, which takes the unrolled matcher, and with an engine that starts with it.
+ * Compiled-in rules are not checked against a reference, only counted.
+ *
+ * @param [in] data Target file.
+ * @param [in] size Size of the target file.
+ */
+static void static_check(const unsigned char *data, size_t size)
+{
+    // Declare all the variables:
+    const SignatureBase *sb = &static_signature_base;
+    ScanHits fixed_reference, floating_reference, hits;
+    AvEngine *engine = NULL;
+    AvScanResult result;
+    struct iovec *iov;
+    unsigned char *copy;
+    size_t iovcnt, i, position, expected = 0;
+    int file_type = FT_UNKNOWN, engine_type;
+
+    copy = malloc(size + 1);
+    if (copy == NULL)
+    {
+        return;
+    }
+    if (size > 0)
+    {
+        memcpy(copy, data, size);
+    }
+    if (size >= MAX_SIGNATURE_LENGTH + 2)
+    {
+        position = 2 + (size_t)data[size - 1] % (size - MAX_SIGNATURE_LENGTH - 1); // keep the magic number
+        for (i = 0; i < sb->count; i++)
+        {
+            if (sb->signatures[(i + data[0]) % sb->count].offset == SIGNATURE_ANY_OFFSET)
+            {
+                memcpy(copy + position, sb->signatures[(i + data[0]) % sb->count].signature, MAX_SIGNATURE_LENGTH);
+                break;
+            }
+        }
+    }
+
+    detect_file_type(copy, (size < FILE_HEADER_PAGE_SIZE) ? size : FILE_HEADER_PAGE_SIZE, &file_type);
+    if (reference_scan(sb, file_type, copy, size, 0, &fixed_reference) != 0 ||
+        reference_scan(sb, file_type, copy, size, 1, &floating_reference) != 0)
+    {
+        free_scan_hits(&fixed_reference);
+        free_scan_hits(&floating_reference);
+        free(copy);
+        return;
+    }
+
+    if (scan_buffer_hits(copy, size, sb, 0, &engine_type, &hits, NULL) != SBH_SUCCESS)
+    {
+        fuzz_report("static scan_buffer_hits", "returned an error");
+    }
+    else
+    {
+        check_all_hits("static scan_buffer_hits", sb, &hits, &fixed_reference, &floating_reference, NULL);
+        expected = hits.count; // rules included
+        free_scan_hits(&hits);
+    }
+
+    iov = malloc((2 * size + 1) * sizeof(*iov));
+    if (iov != NULL)
+    {
+        iovcnt = split_segments(copy, size, iov);
+        if (scan_iovec_hits(iov, iovcnt, sb, 0, &engine_type, &hits, NULL) != SBH_SUCCESS)
+        {
+            fuzz_report("static scan_iovec_hits", "returned an error");
+        }
+        else
+        {
+            check_all_hits("static scan_iovec_hits", sb, &hits, &fixed_reference, &floating_reference, NULL);
+            free_scan_hits(&hits);
+        }
+        free(iov);
+    }
+
+    if (av_engine_create(&engine) != AV_SUCCESS)
+    {
+        fuzz_report("static av_engine_create", "returned an error");
+    }
+    else if (av_scan_buffer(engine, copy, size, AV_SCAN_DEFAULT, &result) != AV_SUCCESS)
+    {
+        fuzz_report("static av_scan_buffer", "returned an error");
+    }
+    else
+    {
+        check_av_result("static av_scan_buffer", &result, expected);
+        av_free_result(&result);
+    }
+
+    av_engine_destroy(engine);
+    free_scan_hits(&fixed_reference);
+    free_scan_hits(&floating_reference);
+    free(copy);
+}
+#endif
+
+/**
+ * @brief libFuzzer entry point; also used for single AFL inputs.
+ *
+ * Input layout: one byte with the number of signatures, then for each signature
+ * a flags byte (bit 0 floating, bit 1 take the bytes from the target data,
+ * bits 2..5 file type, bit 6 of the first one: add the fuzz rule, bit 7: reuse
+ * the 4-byte anchor of the previous signature, or all its bytes if the offset is
+ * odd), two offset bytes and eight signature bytes. The remaining bytes are the target file.
+ *
+ * @param [in] input Fuzz input.
+ * @param [in] length Size of the input.
+ * @return Always 0.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *input, size_t length)
+{
+    // Declare all the variables:
+    char text[FUZZ_MAX_SIGNATURES * 80 + 256];
+    unsigned char signature[MAX_SIGNATURE_LENGTH];
+    unsigned char previous[MAX_SIGNATURE_LENGTH];
+    const unsigned char *data;
+    FuzzRule rule;
+    size_t count, header, size, offset, used = 0, i, k;
+    unsigned flags;
+
+    if (length < 1)
+    {
+        return 0;
+    }
+    count = (input[0] % FUZZ_MAX_SIGNATURES) + 1;
+    header = 1 + count * (3 + MAX_SIGNATURE_LENGTH);
+    if (length < header)
+    {
+        return 0;
+    }
+    data = input + header;
+    size = length - header;
+
+    text[0] = '\0';
+    for (i = 0; i < count; i++)
+    {
+        const uint8_t *record = input + 1 + i * (3 + MAX_SIGNATURE_LENGTH);
+
+        flags = record[0];
+        offset = (size_t)record[1] | ((size_t)record[2] << 8);
+        if ((flags & 2) && size >= MAX_SIGNATURE_LENGTH) // plant: copy the bytes from the file
+        {
+            memcpy(signature, data + offset % (size - MAX_SIGNATURE_LENGTH + 1), MAX_SIGNATURE_LENGTH);
+        }
+        else
+        {
+            memcpy(signature, record + 3, MAX_SIGNATURE_LENGTH);
+        }
+        if ((flags & 0x80) && i > 0) // same anchor in the prefilter, or a duplicate signature
+        {
+            memcpy(signature, previous, (offset & 1) ? MAX_SIGNATURE_LENGTH : 4);
+        }
+        memcpy(previous, signature, MAX_SIGNATURE_LENGTH);
+
+        for (k = 0; k < MAX_SIGNATURE_LENGTH; k++)
+        {
+            used += (size_t)snprintf(text + used, sizeof(text) - used, "%02x ", signature[k]);
+        }
+        if (flags & 1)
+        {
+            used += (size_t)snprintf(text + used, sizeof(text) - used, "* ");
+        }
+        else
+        {
+            used += (size_t)snprintf(text + used, sizeof(text) - used, "%zx ", offset % (size + 1));
+        }
+        used += (size_t)snprintf(text + used, sizeof(text) - used, "FUZZ%zu %s\n",
+                                 i, file_type_names[((flags >> 2) & 15) % (FT_ANY + 1)]);
+
+        if (i == 0) // the rule takes its atoms and parameters from the first two signatures
+        {
+            memcpy(rule.a, signature, MAX_SIGNATURE_LENGTH);
+            rule.file_type = (int)(((flags >> 2) & 15) % (FT_ANY + 1));
+            rule.low = offset % (size + 1);
+        }
+        else if (i == 1)
+        {
+            memcpy(rule.b, signature, MAX_SIGNATURE_LENGTH);
+            rule.min_count = record[1] % 4;
+            rule.high = rule.low + record[2] % 64;
+            rule.distance = record[1] % 32;
+        }
+    }
+
+    if (count < 2 || (input[1] & 0x40) == 0)
+    {
+        differential_check(text, NULL, data, size);
+    }
+    else
+    {
+        used += (size_t)snprintf(text + used, sizeof(text) - used, "rule FUZZRULE %s\n$a =", file_type_names[rule.file_type]);
+        for (k = 0; k < MAX_SIGNATURE_LENGTH; k++)
+        {
+            used += (size_t)snprintf(text + used, sizeof(text) - used, " %02x", rule.a[k]);
+        }
+        used += (size_t)snprintf(text + used, sizeof(text) - used, "\n$b =");
+        for (k = 0; k < MAX_SIGNATURE_LENGTH; k++)
+        {
+            used += (size_t)snprintf(text + used, sizeof(text) - used, " %02x", rule.b[k]);
+        }
+        snprintf(text + used, sizeof(text) - used,
+                 "\ncondition: #a >= %zu and not $b in (0x%llx..%llu) or @b[2] - @a == %llu\nend\n", rule.min_count,
+                 (unsigned long long)rule.low, (unsigned long long)rule.high, (unsigned long long)rule.distance);
+        differential_check(text, &rule, data, size);
+    }
+#ifdef AV_STATIC_SIGNATURES
+    static_check(data, size);
+#endif
+    return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+/**
+ * @brief Builds one random input: a file of a random type with planted signatures.
+ *
+ * @param [out] input Buffer for the input.
+ * @param [in] capacity Size of the buffer.
+ * @return Size of the built input.
+ */
+static size_t random_input(uint8_t *input, size_t capacity)
+{
+    // Declare all the variables:
+    static const unsigned char *const magics[] =
+    {
+        (const unsigned char *)"MZ", (const unsigned char *)"\x7F" "ELF", (const unsigned char *)"%PDF-",
+        (const unsigned char *)"PK\x03\x04", (const unsigned char *)"#!"
+    };
+    size_t count = (size_t)rand() % FUZZ_MAX_SIGNATURES + 1;
+    size_t header = 1 + count * (3 + MAX_SIGNATURE_LENGTH);
+    size_t size = (size_t)rand() % FUZZ_RANDOM_FILE_SIZE;
+    size_t magic, i;
+
+    if (header + size > capacity)
+    {
+        size = capacity - header;
+    }
+
+    input[0] = (uint8_t)(count - 1);
+    for (i = 1; i < header + size; i++)
+    {
+        input[i] = (uint8_t)(rand() % 4); // small alphabet -> many partial and repeated matches
+    }
+    for (i = 0; i < count; i++)
+    {
+        input[1 + i * (3 + MAX_SIGNATURE_LENGTH)] = (uint8_t)rand();
+    }
+
+    magic = (size_t)rand() % (sizeof(magics) / sizeof(magics[0]) + 1);
+    if (magic < sizeof(magics) / sizeof(magics[0]) && size >= strlen((const char *)magics[magic]))
+    {
+        memcpy(input + header, magics[magic], strlen((const char *)magics[magic]));
+    }
+
+    return header + size;
+}
+
+/**
+ * @brief Standalone driver: runs one input file (AFL) or random differential tests.
+ *
+ * @code
+ * fuzz_antivirus <input file>
+ * fuzz_antivirus [-n iterations] [-s seed]
+ * @endcode
+ *
+ * @param [in] argc Number of command line arguments.
+ * @param [in] argv Command line arguments.
+ * @return 0 if all engines agreed with the reference, 1 otherwise.
+ */
+int main(int argc, char *argv[])
+{
+    // Declare all the variables:
+    static uint8_t input[1 + FUZZ_MAX_SIGNATURES * (3 + MAX_SIGNATURE_LENGTH) + FUZZ_RANDOM_FILE_SIZE];
+    unsigned long iterations = 10000, n;
+    unsigned int seed = 1;
+    size_t length;
+    FILE *file;
+    int i;
+
+    if (argc == 2 && argv[1][0] != '-')
+    {
+        file = fopen(argv[1], "rb");
+        if (file == NULL)
+        {
+            return 1;
+        }
+        length = fread(input, 1, sizeof(input), file);
+        fclose(file);
+        LLVMFuzzerTestOneInput(input, length);
+        return fuzz_mismatches != 0;
+    }
+
+    for (i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-n") == 0)
+        {
+            iterations = strtoul(argv[i + 1], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            seed = (unsigned int)strtoul(argv[i + 1], NULL, 10);
+        }
+    }
+
+    srand(seed);
+    for (n = 0; n < iterations; n++)
+    {
+        length = random_input(input, sizeof(input));
+        LLVMFuzzerTestOneInput(input, length);
+    }
+
+    printf("%lu inputs, %zu mismatches (seed %u)\n", iterations, fuzz_mismatches, seed);
+    return fuzz_mismatches != 0;
+}
+#endif
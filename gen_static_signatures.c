@@ -0,0 +1,381 @@
+/**
+ * @brief Generator of compiled-in signatures for libantivirus (embedded builds).
+ *
+ * Reads a signature file with the library's own parser and writes a C header with
+ * - the signatures and their per-type subsets as static const data (a ready
+ *   SignatureBase, so nothing is parsed or allocated at run time);
+ * - one unrolled floating signature matcher per file type: a switch on the first
+ *   byte and one 64-bit word compare per signature, with every pattern a constant;
+ * - the rules with their conditions already compiled.
+ *
+ * libantivirus.c built with -DAV_STATIC_SIGNATURES includes the header; engines then
+ * start with these signatures (see av_engine_create()) and use the unrolled matcher.
+ *
+ * @code
+ * gcc -O2 -pthread gen_static_signatures.c -o gen_static_signatures -lm
+ * ./gen_static_signatures signature.txt static_signatures.h
+ * gcc -O2 -pthread -DAV_STATIC_SIGNATURES -c libantivirus.c
+ * @endcode
+ */
+#include "libantivirus.c"
+
+/**
+ * @enum Error_Codes_GSS
+ * @brief Error codes of the generator (exit status).
+ *
+ * GSS - Generate Static Signatures.
+ *
+ * @retval Error_Codes_GSS See the enum for possible return values.
+ */
+enum Error_Codes_GSS
+{
+    /** @brief No errors, the header was written. */
+    GSS_SUCCESS = 0,
+
+    /** @brief Wrong number of command line arguments. */
+    GSS_USAGE_ERROR = 1,
+
+    /** @brief The signature file could not be read (see read_signature_base()). */
+    GSS_SIGNATURE_BASE_ERROR = 2,
+
+    /** @brief The output file could not be created. */
+    GSS_OUTPUT_FOPEN_ERROR = 3,
+
+    /** @brief Failed to write or close the output file. */
+    GSS_OUTPUT_WRITE_ERROR = 4
+};
+
+/**
+ * @brief Writes a virus name as a C string literal.
+ *
+ * @param [in] file Output file.
+ * @param [in] name Zero-terminated name.
+ */
+static void write_string_literal(FILE *file, const char *name)
+{
+    // Declare all the variables:
+    const unsigned char *c;
+
+    fputc('"', file);
+    for (c = (const unsigned char *)name; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            fprintf(file, "\\%c", *c);
+        }
+        else if (*c < 0x20 || *c >= 0x7F)
+        {
+            fprintf(file, "\\%03o", *c);
+        }
+        else
+        {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+/**
+ * @brief Names of the rule node kinds, indexed by @ref Rule_Node_Kinds.
+ */
+static const char *const rule_node_kind_names[] =
+{
+    "RN_NUMBER", "RN_FILESIZE", "RN_FILETYPE", "RN_FOUND", "RN_COUNT", "RN_OFFSET", "RN_AT", "RN_IN", "RN_OF",
+    "RN_ADD", "RN_SUB", "RN_EQ", "RN_NE", "RN_LT", "RN_LE", "RN_GT", "RN_GE", "RN_NOT", "RN_AND", "RN_OR"
+};
+
+/**
+ * @brief Writes the rules (atoms and compiled conditions) as static const data.
+ *
+ * @param [in] file Output file.
+ * @param [in] sb Loaded signature base with at least one rule.
+ */
+static void write_rules(FILE *file, const SignatureBase *sb)
+{
+    // Declare all the variables:
+    const Rule *rule;
+    const RuleNode *node;
+    size_t i, k;
+
+    fprintf(file, "static const Rule static_rules[%zu] =\n{\n", sb->rule_count);
+    for (i = 0; i < sb->rule_count; i++)
+    {
+        rule = &sb->rules[i];
+        fprintf(file, "    { %zu, {", rule->signature_index);
+        for (k = 0; k < rule->atom_count; k++)
+        {
+            fprintf(file, "%s%zu", (k == 0) ? "" : ", ", rule->atoms[k]);
+        }
+        fprintf(file, "%s}, %zu,\n      {", (rule->atom_count == 0) ? "0" : "", rule->atom_count);
+        for (k = 0; k < rule->node_count; k++)
+        {
+            node = &rule->nodes[k];
+            fprintf(file, "%s\n       {%s, %zu, %zu, %zu, 0x%llXull}", (k == 0) ? "" : ",", rule_node_kind_names[node->kind],
+                    node->left, node->right, node->atom, (unsigned long long)node->value);
+        }
+        fprintf(file, "\n      },\n      %zu, %zu }, // ", rule->node_count, rule->root);
+        write_string_literal(file, sb->signatures[rule->signature_index].virus_name);
+        fprintf(file, "\n");
+    }
+    fprintf(file, "};\n\n");
+}
+
+/**
+ * @brief Writes the signatures, subsets and the SignatureBase built from them.
+ *
+ * @param [in] file Output file.
+ * @param [in] sb Loaded signature base.
+ */
+static void write_signature_data(FILE *file, const SignatureBase *sb)
+{
+    // Declare all the variables:
+    const VirusSignature *vs;
+    size_t type, i, k;
+
+    fprintf(file, "static const VirusSignature static_signatures[%zu] =\n{\n", sb->count);
+    for (i = 0; i < sb->count; i++)
+    {
+        vs = &sb->signatures[i];
+        fprintf(file, "    { {");
+        for (k = 0; k < MAX_SIGNATURE_LENGTH; k++)
+        {
+            fprintf(file, "%s0x%02X", (k == 0) ? "" : ", ", vs->signature[k]);
+        }
+        if (vs->offset == SIGNATURE_ANY_OFFSET)
+        {
+            fprintf(file, "}, SIGNATURE_ANY_OFFSET, ");
+        }
+        else if (vs->offset == SIGNATURE_RULE_OFFSET)
+        {
+            fprintf(file, "}, SIGNATURE_RULE_OFFSET, ");
+        }
+        else
+        {
+            fprintf(file, "}, 0x%zXu, ", vs->offset);
+        }
+        write_string_literal(file, vs->virus_name);
+        fprintf(file, ", FT_%s },\n", file_type_names[vs->file_type]);
+    }
+    fprintf(file, "};\n\n");
+
+    for (type = 0; type < FT_ANY; type++)
+    {
+        if (sb->subset_sizes[type] > 0)
+        {
+            fprintf(file, "static const size_t static_subset_%s[] = {", file_type_names[type]);
+            for (i = 0; i < sb->subset_sizes[type]; i++)
+            {
+                fprintf(file, "%s%zu", (i == 0) ? "" : ", ", sb->subsets[type][i]);
+            }
+            fprintf(file, "};\n");
+        }
+        if (sb->floating_subset_sizes[type] > 0)
+        {
+            fprintf(file, "static const size_t static_floating_subset_%s[] = {", file_type_names[type]);
+            for (i = 0; i < sb->floating_subset_sizes[type]; i++)
+            {
+                fprintf(file, "%s%zu", (i == 0) ? "" : ", ", sb->floating_subsets[type][i]);
+            }
+            fprintf(file, "};\n");
+        }
+    }
+
+    if (sb->rule_count > 0)
+    {
+        write_rules(file, sb);
+    }
+
+    // The pointers are only ever read; the casts drop const to fit SignatureBase
+    fprintf(file, "\nstatic const SignatureBase static_signature_base =\n{\n");
+    fprintf(file, "    (VirusSignature *)static_signatures,\n    %zu,\n    {", sb->count);
+    for (type = 0; type < FT_ANY; type++)
+    {
+        if (sb->subset_sizes[type] > 0)
+        {
+            fprintf(file, "%s(size_t *)static_subset_%s", (type == 0) ? "" : ", ", file_type_names[type]);
+        }
+        else
+        {
+            fprintf(file, "%sNULL", (type == 0) ? "" : ", ");
+        }
+    }
+    fprintf(file, "},\n    {");
+    for (type = 0; type < FT_ANY; type++)
+    {
+        fprintf(file, "%s%zu", (type == 0) ? "" : ", ", sb->subset_sizes[type]);
+    }
+    fprintf(file, "},\n    {");
+    for (type = 0; type < FT_ANY; type++)
+    {
+        if (sb->floating_subset_sizes[type] > 0)
+        {
+            fprintf(file, "%s(size_t *)static_floating_subset_%s", (type == 0) ? "" : ", ", file_type_names[type]);
+        }
+        else
+        {
+            fprintf(file, "%sNULL", (type == 0) ? "" : ", ");
+        }
+    }
+    fprintf(file, "},\n    {");
+    for (type = 0; type < FT_ANY; type++)
+    {
+        fprintf(file, "%s%zu", (type == 0) ? "" : ", ", sb->floating_subset_sizes[type]);
+    }
+    fprintf(file, "},\n    {\n");
+    for (type = 0; type < FT_ANY; type++)
+    {
+        fprintf(file, "        {");
+        if (sb->floating_subset_sizes[type] == 0) // no first bytes
+        {
+            fprintf(file, "0");
+        }
+        for (k = 0; k < sizeof(sb->floating_first_bytes[type]) && sb->floating_subset_sizes[type] > 0; k++)
+        {
+            fprintf(file, "%s0x%02X", (k == 0) ? "" : ", ", sb->floating_first_bytes[type][k]);
+        }
+        fprintf(file, "}%s\n", (type + 1 < FT_ANY) ? "," : "");
+    }
+    fprintf(file, "    },\n    %s,\n    %zu,\n    %zu,\n",
+            (sb->rule_count > 0) ? "(Rule *)static_rules" : "NULL", sb->rule_count, sb->atom_count);
+    // No anchors or Bloom filters: the generated matchers replace that prefilter
+    fprintf(file, "    {NULL},\n    {NULL},\n    {0}\n};\n\n");
+}
+
+/**
+ * @brief Writes the unrolled floating signature matchers.
+ *
+ * One function per file type with floating signatures: a switch on the byte at
+ * each position, then a word compare against each signature starting with it,
+ * in signature order (the order match_floating() reports them in).
+ *
+ * @param [in] file Output file.
+ * @param [in] sb Loaded signature base.
+ */
+static void write_floating_matchers(FILE *file, const SignatureBase *sb)
+{
+    // Declare all the variables:
+    const VirusSignature *vs;
+    size_t type, i, k;
+    unsigned byte;
+
+    for (type = 0; type < FT_ANY; type++)
+    {
+        if (sb->floating_subset_sizes[type] == 0)
+        {
+            continue;
+        }
+
+        fprintf(file, "/**\n * @brief Unrolled match_floating() for files of type %s.\n */\n", file_type_names[type]);
+        fprintf(file, "static int static_match_floating_%s(const unsigned char *buffer, size_t last, uint64_t base_offset,\n"
+                      "                                    ScanHits *hits)\n", file_type_names[type]);
+        fprintf(file, "{\n    // Declare all the variables:\n    size_t position;\n    uint64_t word;\n\n");
+        fprintf(file, "    for (position = 0; position <= last; position++)\n    {\n");
+        fprintf(file, "        switch (buffer[position])\n        {\n");
+        for (byte = 0; byte < 256; byte++)
+        {
+            if ((sb->floating_first_bytes[type][byte >> 3] & (1u << (byte & 7))) == 0)
+            {
+                continue;
+            }
+            fprintf(file, "            case 0x%02X:\n            {\n", byte);
+            fprintf(file, "                memcpy(&word, buffer + position, sizeof(word));\n");
+            for (i = 0; i < sb->floating_subset_sizes[type]; i++)
+            {
+                vs = &sb->signatures[sb->floating_subsets[type][i]];
+                if (vs->signature[0] != byte)
+                {
+                    continue;
+                }
+                fprintf(file, "                if (word == STATIC_SIGNATURE_WORD(");
+                for (k = 0; k < MAX_SIGNATURE_LENGTH; k++)
+                {
+                    fprintf(file, "%s0x%02X", (k == 0) ? "" : ", ", vs->signature[k]);
+                }
+                fprintf(file, ") &&\n                    add_scan_hit(hits, %zu, base_offset + position) != 0) // ",
+                        sb->floating_subsets[type][i]);
+                write_string_literal(file, vs->virus_name);
+                fprintf(file, "\n                {\n                    return -1;\n                }\n");
+            }
+            fprintf(file, "                break;\n            }\n");
+        }
+        fprintf(file, "            default:\n            {\n                break;\n            }\n");
+        fprintf(file, "        }\n    }\n\n    return 0;\n}\n\n");
+    }
+
+    fprintf(file, "/**\n * @brief Runs the unrolled matcher of a file type (see match_floating()).\n */\n");
+    fprintf(file, "static int static_match_floating(int file_type, const unsigned char *buffer, size_t last, uint64_t base_offset,\n"
+                  "                                 ScanHits *hits)\n{\n");
+    fprintf(file, "    switch (file_type)\n    {\n");
+    for (type = 0; type < FT_ANY; type++)
+    {
+        if (sb->floating_subset_sizes[type] > 0)
+        {
+            fprintf(file, "        case FT_%s: return static_match_floating_%s(buffer, last, base_offset, hits);\n",
+                    file_type_names[type], file_type_names[type]);
+        }
+    }
+    fprintf(file, "        default: (void)buffer; (void)last; (void)base_offset; (void)hits; return 0;\n");
+    fprintf(file, "    }\n}\n");
+}
+
+/**
+ * @brief Entry point of the generator.
+ *
+ * @code
+ * gen_static_signatures <signature file> <output header>
+ * @endcode
+ *
+ * @param [in] argc Number of command line arguments.
+ * @param [in] argv Command line arguments.
+ * @return Error code from @ref Error_Codes_GSS.
+ */
+int main(int argc, char *argv[])
+{
+    // Declare all the variables:
+    SignatureBase sb;
+    FILE *file;
+    int result;
+
+    if (argc != 3)
+    {
+        printf("Usage: %s <signature file> <output header>\n", argv[0]);
+        return GSS_USAGE_ERROR; // 1
+    }
+
+    result = read_signature_base(argv[1], &sb);
+    if (result != RSB_SUCCESS)
+    {
+        printf("\nError in function:\n"
+               "int read_signature_base(const char *file_path, SignatureBase *sb);\n"
+               "Description: %s\n", av_strerror(av_error_from_rsb(result)));
+        return GSS_SIGNATURE_BASE_ERROR; // 2
+    }
+
+    file = fopen(argv[2], "w");
+    if (file == NULL)
+    {
+        free_signature_base(&sb);
+        printf("\nError in function:\n"
+               "FILE *fopen(const char *restrict pathname, const char *restrict mode);\n"
+               "Description: Failed to create output file %s\n", argv[2]);
+        return GSS_OUTPUT_FOPEN_ERROR; // 3
+    }
+
+    fprintf(file, "/* Generated by gen_static_signatures from %s. Do not edit. */\n", argv[1]);
+    fprintf(file, "#ifndef STATIC_SIGNATURES_H\n#define STATIC_SIGNATURES_H\n\n");
+    write_signature_data(file, &sb);
+    write_floating_matchers(file, &sb);
+    fprintf(file, "\n#endif // STATIC_SIGNATURES_H\n");
+    free_signature_base(&sb);
+
+    if (ferror(file) | fclose(file))
+    {
+        remove(argv[2]);
+        printf("\nError in function:\n"
+               "int fclose(FILE *stream);\n"
+               "Description: Failed to write output file %s\n", argv[2]);
+        return GSS_OUTPUT_WRITE_ERROR; // 4
+    }
+
+    return GSS_SUCCESS; // 0
+}
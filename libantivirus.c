@@ -0,0 +1,5987 @@
+#ifndef _WIN32
+#define _GNU_SOURCE // pread() and other POSIX extensions
+#endif
+
+#include "libantivirus.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+/**
+ * @def MAX_SIGNATURE_LENGTH
+ * @brief Maximum length (in bytes) of a virus signature.
+ */
+#define MAX_SIGNATURE_LENGTH 8
+
+/**
+ * @def MAX_VIRUS_NAME_LENGTH
+ * @brief Maximum length (in characters) of a virus name string.
+ */
+#define MAX_VIRUS_NAME_LENGTH AV_MAX_VIRUS_NAME_LENGTH
+
+/**
+ * @def FILE_HEADER_PAGE_SIZE
+ * @brief Number of leading bytes (one page) read once per file for type detection.
+ */
+#define FILE_HEADER_PAGE_SIZE 4096
+
+/**
+ * @def MAX_MAGIC_LENGTH
+ * @brief Maximum length (in bytes) of a magic number in the file type table.
+ */
+#define MAX_MAGIC_LENGTH 8
+
+/**
+ * @def MAX_SIGNATURE_LINE_LENGTH
+ * @brief Maximum length (in characters) of one line of the signature file.
+ */
+#define MAX_SIGNATURE_LINE_LENGTH 512
+
+/**
+ * @def MAX_FILE_TYPE_NAME_LENGTH
+ * @brief Maximum length (in characters) of a file type name in the signature file.
+ */
+#define MAX_FILE_TYPE_NAME_LENGTH 16
+
+/**
+ * @def SIGNATURE_ANY_OFFSET
+ * @brief Offset value of a floating signature ("*" in the signature file), searched at any position.
+ */
+#define SIGNATURE_ANY_OFFSET ((size_t)-1)
+
+/**
+ * @def SIGNATURE_RULE_OFFSET
+ * @brief Offset value of the entry that names a rule; it is never searched itself.
+ */
+#define SIGNATURE_RULE_OFFSET ((size_t)-2)
+
+/**
+ * @def MAX_RULE_ATOMS
+ * @brief Maximum number of byte patterns ($name = ...) in one rule.
+ */
+#define MAX_RULE_ATOMS 16
+
+/**
+ * @def MAX_RULE_NODES
+ * @brief Maximum number of operators and operands in the condition of one rule.
+ */
+#define MAX_RULE_NODES 64
+
+/**
+ * @def MAX_RULE_ATOM_NAME_LENGTH
+ * @brief Maximum length (in characters, with the terminating zero) of an atom name in a rule.
+ */
+#define MAX_RULE_ATOM_NAME_LENGTH 32
+
+/**
+ * @def RANGE_OVERLAP
+ * @brief Bytes shared by neighbouring ranges and chunks: longest signature minus one.
+ */
+#define RANGE_OVERLAP (MAX_SIGNATURE_LENGTH - 1)
+
+/**
+ * @def BLOOM_BITS_PER_ANCHOR
+ * @brief Bloom filter bits per floating signature (with 2 hashes: about 1.4% false positives).
+ */
+#define BLOOM_BITS_PER_ANCHOR 16
+
+/**
+ * @def MIN_BLOOM_BITS_LOG2
+ * @brief log2 of the smallest Bloom filter (1024 bits).
+ */
+#define MIN_BLOOM_BITS_LOG2 10
+
+/**
+ * @def MAX_BLOOM_BITS_LOG2
+ * @brief log2 of the largest Bloom filter (8 MB); more signatures only raise false positives.
+ */
+#define MAX_BLOOM_BITS_LOG2 26
+
+/**
+ * @def MAX_SPARSE_FIRST_BYTES
+ * @brief Most distinct first bytes for which the first byte bitmap is tested before the Bloom filter.
+ *
+ * Can be redefined at compile time, like SCAN_CHUNK_SIZE.
+ */
+#ifndef MAX_SPARSE_FIRST_BYTES
+#define MAX_SPARSE_FIRST_BYTES 16
+#endif
+
+/**
+ * @def SCAN_CHUNK_SIZE
+ * @brief Number of bytes read at once when searching floating signatures.
+ *
+ * Can be redefined at compile time (the fuzz harness uses tiny chunks to hit chunk borders).
+ */
+#ifndef SCAN_CHUNK_SIZE
+#define SCAN_CHUNK_SIZE (1024 * 1024)
+#endif
+
+/**
+ * @def PARALLEL_SCAN_MIN_RANGE
+ * @brief Smallest range given to one thread; smaller files are scanned by fewer threads.
+ *
+ * Can be redefined at compile time, like SCAN_CHUNK_SIZE.
+ */
+#ifndef PARALLEL_SCAN_MIN_RANGE
+#define PARALLEL_SCAN_MIN_RANGE (16 * 1024 * 1024)
+#endif
+
+/**
+ * @def MAX_PE_SECTIONS
+ * @brief Maximum number of PE sections with their own byte statistics (the rest are ignored).
+ */
+#define MAX_PE_SECTIONS 32
+
+/**
+ * @def PACKED_ENTROPY_THRESHOLD
+ * @brief Shannon entropy (bits per byte) from which a code section is considered packed or encrypted.
+ */
+#define PACKED_ENTROPY_THRESHOLD 7.2
+
+/**
+ * @def MIN_ENTROPY_BYTES
+ * @brief Sections smaller than this (in bytes) are too short for a meaningful entropy.
+ */
+#define MIN_ENTROPY_BYTES 512
+
+/**
+ * @def HISTOGRAM_SPLIT_MIN
+ * @brief Shortest buffer counted word at a time into sub-histograms; shorter ones are counted byte by byte.
+ *
+ * Can be redefined at compile time, like SCAN_CHUNK_SIZE.
+ */
+#ifndef HISTOGRAM_SPLIT_MIN
+#define HISTOGRAM_SPLIT_MIN 1024
+#endif
+
+/**
+ * @def IO_LIMIT_BURST_MS
+ * @brief Reads may run ahead of the I/O limit by this many milliseconds worth of tokens.
+ */
+#define IO_LIMIT_BURST_MS 100
+
+/**
+ * @def IO_LIMIT_SLICE_MS
+ * @brief Longest sleep of a throttled read between two yields and deadline checks.
+ */
+#define IO_LIMIT_SLICE_MS 10
+
+/**
+ * @def MAX_NUMA_NODES
+ * @brief Maximum number of NUMA nodes with their own signature replica.
+ */
+#define MAX_NUMA_NODES 64
+
+/**
+ * @def NUMA_SYSFS_PATH
+ * @brief Directory with one nodeN/cpulist file per NUMA node (Linux sysfs).
+ *
+ * Can be redefined at compile time to test other topologies.
+ */
+#ifndef NUMA_SYSFS_PATH
+#define NUMA_SYSFS_PATH "/sys/devices/system/node"
+#endif
+
+/**
+ * @def TRACE_FILE_TAIL_LENGTH
+ * @brief Characters of a traced path kept in its span (the end of the path, with the terminating zero).
+ */
+#define TRACE_FILE_TAIL_LENGTH 64
+
+/**
+ * @def MAX_TRACE_FILE_DEPTH
+ * @brief Traced files that may be open at once on one thread (a scan run from a yield callback nests).
+ */
+#define MAX_TRACE_FILE_DEPTH 4
+
+
+/**
+ * @brief Represents a virus signature.
+ *
+ * Contains a byte array for the signature, an offset where the signature should be located,
+ * and the virus name.
+ */
+typedef struct
+{
+    unsigned char signature[MAX_SIGNATURE_LENGTH]; /**< Byte array representing the virus signature. */
+    size_t offset; /**< Offset in the file where the signature is expected (SIGNATURE_ANY_OFFSET = anywhere). */
+    char virus_name[MAX_VIRUS_NAME_LENGTH]; /**< Name of the virus. */
+    int file_type; /**< File type the signature applies to (see @ref File_Types). */
+} VirusSignature;
+
+/**
+ * @enum Rule_Node_Kinds
+ * @brief Operators and operands of a rule condition (see RuleNode).
+ */
+enum Rule_Node_Kinds
+{
+    /** @brief Constant value. */
+    RN_NUMBER = 0,
+
+    /** @brief Size of the file. */
+    RN_FILESIZE = 1,
+
+    /** @brief Detected file type (as is_exec() uses it); compared with type names (PE, ELF...). */
+    RN_FILETYPE = 2,
+
+    /** @brief $a: 1 if the atom matched at least once. */
+    RN_FOUND = 3,
+
+    /** @brief #a: number of matches of the atom. */
+    RN_COUNT = 4,
+
+    /** @brief \@a[left]: offset of the n-th match (1-based); undefined if there is none. */
+    RN_OFFSET = 5,
+
+    /** @brief $a at left: the atom matched at that offset. */
+    RN_AT = 6,
+
+    /** @brief $a in (left..right): the atom matched between the two offsets. */
+    RN_IN = 7,
+
+    /** @brief value of them: at least value atoms matched. */
+    RN_OF = 8,
+
+    /** @brief left + right. */
+    RN_ADD = 9,
+
+    /** @brief left - right. */
+    RN_SUB = 10,
+
+    /** @brief left == right. */
+    RN_EQ = 11,
+
+    /** @brief left != right. */
+    RN_NE = 12,
+
+    /** @brief left < right. */
+    RN_LT = 13,
+
+    /** @brief left <= right. */
+    RN_LE = 14,
+
+    /** @brief left > right. */
+    RN_GT = 15,
+
+    /** @brief left >= right. */
+    RN_GE = 16,
+
+    /** @brief not left. */
+    RN_NOT = 17,
+
+    /** @brief left and right. */
+    RN_AND = 18,
+
+    /** @brief left or right. */
+    RN_OR = 19
+};
+
+/**
+ * @brief One operator or operand of a rule condition.
+ */
+typedef struct
+{
+    int kind; /**< Node kind from @ref Rule_Node_Kinds. */
+    size_t left; /**< First operand (index in Rule.nodes). */
+    size_t right; /**< Second operand (index in Rule.nodes). */
+    size_t atom; /**< Atom the node refers to (index in Rule.atoms). */
+    uint64_t value; /**< Constant of RN_NUMBER and RN_OF. */
+} RuleNode;
+
+/**
+ * @brief A rule of the signature file: byte patterns (atoms) and a condition on their matches.
+ *
+ * The atoms are searched as floating signatures together with all the others, so a
+ * file is read once whatever the number of rules; the condition is then evaluated
+ * on the collected matches (see apply_rules()).
+ */
+typedef struct
+{
+    size_t signature_index; /**< Entry of the rule in SignatureBase.signatures (its name and type). */
+    size_t atoms[MAX_RULE_ATOMS]; /**< Signature indices of the atoms. */
+    size_t atom_count; /**< Number of atoms. */
+    RuleNode nodes[MAX_RULE_NODES]; /**< Condition, operands before the nodes using them. */
+    size_t node_count; /**< Number of nodes. */
+    size_t root; /**< Node whose value is the verdict. */
+} Rule;
+
+/**
+ * @brief One entry of the magic number table.
+ *
+ * Entries are grouped by their first byte (see magic_jump_table), so detection
+ * only compares the few entries that can start with the file's first byte.
+ */
+typedef struct
+{
+    size_t length; /**< Length of the magic number in bytes (0 terminates a bucket). */
+    unsigned char magic[MAX_MAGIC_LENGTH]; /**< Magic bytes expected at offset 0. */
+    int file_type; /**< Type id from @ref File_Types reported on match. */
+} MagicNumber;
+
+/**
+ * @brief Represents a base of virus signatures loaded from the signature file.
+ *
+ * Besides the signatures themselves, the base keeps for every detectable file type
+ * the list of signature indices that must be run against files of that type
+ * (signatures of this type plus FT_ANY signatures).
+ */
+typedef struct
+{
+    VirusSignature *signatures; /**< Array of loaded signatures. */
+    size_t count; /**< Number of loaded signatures. */
+    size_t *subsets[FT_ANY]; /**< Signature indices per detected file type. */
+    size_t subset_sizes[FT_ANY]; /**< Number of indices in each subset. */
+    size_t *floating_subsets[FT_ANY]; /**< Indices of floating signatures per detected file type. */
+    size_t floating_subset_sizes[FT_ANY]; /**< Number of indices in each floating subset. */
+    unsigned char floating_first_bytes[FT_ANY][32]; /**< Bitmap of first bytes of floating signatures per type. */
+    Rule *rules; /**< Rules of the signature file. */
+    size_t rule_count; /**< Number of rules. */
+    size_t atom_count; /**< The last atom_count signatures are rule atoms, never reported themselves. */
+    uint32_t *floating_anchors[FT_ANY]; /**< Anchor (first 4 bytes) of each floating subset entry; the subset is sorted by it. */
+    uint64_t *floating_blooms[FT_ANY]; /**< Bloom filter of the anchors per type (NULL for compiled-in bases). */
+    unsigned floating_bloom_shifts[FT_ANY]; /**< 32 - log2(bits of the filter): hash >> shift is a bit index. */
+} SignatureBase;
+
+/**
+ * @brief Byte statistics of one PE section.
+ */
+typedef struct
+{
+    char name[9]; /**< Section name (zero-terminated). */
+    uint32_t raw_offset; /**< Offset of the section data in the file. */
+    uint32_t raw_size; /**< Size of the section data in the file. */
+    uint32_t characteristics; /**< Section flags (IMAGE_SCN_*). */
+    uint64_t histogram[256]; /**< Number of occurrences of each byte value. */
+    uint64_t bytes; /**< Number of counted bytes. */
+    double entropy; /**< Shannon entropy in bits per byte (0..8). */
+} SectionStats;
+
+/**
+ * @brief Byte statistics of a whole file and of its PE sections, used to spot packed files.
+ */
+typedef struct
+{
+    SectionStats sections[MAX_PE_SECTIONS]; /**< Statistics of each section. */
+    size_t section_count; /**< Number of sections (0 for non-PE files). */
+    uint64_t histogram[256]; /**< Number of occurrences of each byte value in the file. */
+    uint64_t bytes; /**< Number of counted bytes. */
+    unsigned char order[MAX_PE_SECTIONS]; /**< Section indexes sorted by raw offset. */
+    int apart_flag; /**< 1 while histogram leaves out the bytes of the sections, which do not overlap. */
+    double entropy; /**< Shannon entropy of the whole file in bits per byte. */
+    int packed_flag; /**< 1 if a code section (or the whole file) has entropy above PACKED_ENTROPY_THRESHOLD. */
+    size_t packed_section; /**< Section that set packed_flag (section_count if it was the whole file). */
+} EntropyStats;
+
+/**
+ * @brief One signature match found in a file.
+ */
+typedef struct
+{
+    size_t signature_index; /**< Index of the matched signature in SignatureBase.signatures. */
+    uint64_t offset; /**< Offset of the first matched byte in the file. */
+} ScanHit;
+
+/**
+ * @brief Growable list of signature matches.
+ */
+typedef struct
+{
+    ScanHit *items; /**< Array of matches. */
+    size_t count; /**< Number of matches. */
+    size_t capacity; /**< Allocated number of matches. */
+} ScanHits;
+
+/**
+ * @brief Token bucket shared by the scans of one engine (see av_engine_set_io_limit()).
+ */
+typedef struct IoLimiter IoLimiter;
+
+/**
+ * @brief How a descriptor scan is scheduled: deadline, yield callback and I/O budget.
+ *
+ * Built by av_scan_fd_control() from AvScanControl and the engine's I/O limiter.
+ */
+typedef struct
+{
+    uint64_t deadline_ns; /**< CLOCK_MONOTONIC time after which the scan is abandoned (0 = none). */
+    AvYieldCallback yield; /**< Run on the calling thread between chunks (may be NULL). */
+    void *yield_arg; /**< Argument of yield. */
+    IoLimiter *limiter; /**< Charged before every read (NULL = unlimited). */
+} ScanControl;
+
+/**
+ * @brief Here is a list of all enums with links to the files they belong to:
+ *
+ * - The error naming convention follows this pattern:
+ *   The error is named by the current function (CF) + the error function (EF) = CF_VARIABLE_EF_ERROR:
+ *   Example: Error with the OFFSET variable in the FSCANF function.
+ *   RS - Read Signature (current function), fscanf(file, "%zx", &vs->offset) - error function.
+ *   The error name will be: RS_OFFSET_FSCANF_ERROR.
+ *
+ * - If there is an error with the variable value, the following naming convention is used:
+ *   Current function (CF) + error value (EV) + variable name (VN) = CF_EV_VN:
+ *   Example: Error with the variable FILE_PATH (VN) - NULL POINTER (EV) in the current function RS (Read Signature; CF).
+ *   The error will be named: RS_NULL_FILE_PATH_POINTER.
+ *
+ * - For special return values, I will also use an enum for simplification.
+ */
+
+/**
+ * @enum Error_Codes_RS
+ * @brief Error codes for the read_signature() function.
+ *
+ * These codes represent different failure scenarios that might occur
+ * when reading a virus signature from a file.
+ *
+ * @note Each error code corresponds to a specific issue during file handling or
+ *       signature parsing. Use these error codes to troubleshoot issues with
+ *       file reading operations in the `read_signature` function.
+ *
+ * @see read_signature() for function utilizing these error codes.
+ * @retval Error_Codes_RS See the enum for possible return values.
+ */
+enum Error_Codes_RS
+{
+    /** @brief No errors, function completed successfully. */
+    RS_SUCCESS = 0,
+
+    /** @brief File path argument is NULL. */
+    RS_NULL_FILE_PATH_POINTER = 1,
+
+    /** @brief Virus structure pointer is NULL. */
+    RS_NULL_VSTRUCT_POINTER = 2,
+
+    /** @brief Failed to open file. */
+    RS_FILE_FOPEN_ERROR = 3,
+
+    /** @brief Failed to read signature from file. */
+    RS_SIGNATURE_FSCANF_ERROR = 4,
+
+    /** @brief Failed to set file-position-indicator (offset). */
+    RS_OFFSET_FSCANF_ERROR = 5,
+
+    /** @brief Failed to read virus name from file. */
+    RS_VNAME_FSCANF_ERROR = 6,
+
+    /** @brief Failed to close file descriptor. */
+    RS_FILE_FCLOSE_ERROR = 7,
+
+    /** @brief Failed to read a signature line from file. */
+    RS_LINE_FGETS_ERROR = 8,
+
+    /** @brief Unknown file type name after the virus name. */
+    RS_FTYPE_SSCANF_ERROR = 9
+};
+
+/**
+ * @enum Error_Codes_RSB
+ * @brief Error codes for the read_signature_base() function.
+ *
+ * RSB - Read Signature Base.
+ * These codes represent different failure scenarios that might occur
+ * when loading every signature of the signature file.
+ *
+ * @see read_signature_base() for function utilizing these error codes.
+ * @retval Error_Codes_RSB See the enum for possible return values.
+ */
+enum Error_Codes_RSB
+{
+    /** @brief No errors, function completed successfully. */
+    RSB_SUCCESS = 0,
+
+    /** @brief File path argument is NULL. */
+    RSB_NULL_FILE_PATH_POINTER = 1,
+
+    /** @brief Signature base pointer is NULL. */
+    RSB_NULL_SBASE_POINTER = 2,
+
+    /** @brief Failed to open file. */
+    RSB_FILE_FOPEN_ERROR = 3,
+
+    /** @brief Failed to parse one of the signature lines. */
+    RSB_LINE_PARSE_ERROR = 4,
+
+    /** @brief Failed to allocate memory for signatures or subsets. */
+    RSB_BASE_MALLOC_ERROR = 5,
+
+    /** @brief Signature file contains no signatures. */
+    RSB_EMPTY_BASE = 6,
+
+    /** @brief Failed to close file descriptor. */
+    RSB_FILE_FCLOSE_ERROR = 7,
+
+    /** @brief Failed to read a line from file. */
+    RSB_LINE_FGETS_ERROR = 8,
+
+    /** @brief A rule is malformed (unknown atom, bad condition, too many atoms or nodes, no "end"). */
+    RSB_RULE_PARSE_ERROR = 9
+};
+
+/**
+ * @enum Error_Codes_RFH
+ * @brief Error codes for the read_file_header() function.
+ *
+ * RFH - Read File Header.
+ *
+ * @see read_file_header() for function utilizing these error codes.
+ * @retval Error_Codes_RFH See the enum for possible return values.
+ */
+enum Error_Codes_RFH
+{
+    /** @brief No errors, function completed successfully. */
+    RFH_SUCCESS = 0,
+
+    /** @brief File path argument is NULL. */
+    RFH_NULL_FILE_PATH_POINTER = 1,
+
+    /** @brief Header buffer pointer is NULL. */
+    RFH_NULL_BUFFER_POINTER = 2,
+
+    /** @brief Header size pointer is NULL. */
+    RFH_NULL_HSIZE_POINTER = 3,
+
+    /** @brief Failed to open the specified file. */
+    RFH_FILE_FOPEN_ERROR = 4,
+
+    /** @brief Failed to read the first page of the file. */
+    RFH_BUFFER_FREAD_ERROR = 5,
+
+    /** @brief Failed to close the file descriptor. */
+    RFH_FILE_FCLOSE_ERROR = 6
+};
+
+/**
+ * @enum Error_Codes_DFT
+ * @brief Error codes for the detect_file_type() function.
+ *
+ * DFT - Detect File Type.
+ *
+ * @see detect_file_type() for function utilizing these error codes.
+ * @retval Error_Codes_DFT See the enum for possible return values.
+ */
+enum Error_Codes_DFT
+{
+    /** @brief No errors, function completed successfully. */
+    DFT_SUCCESS = 0,
+
+    /** @brief Header buffer pointer is NULL. */
+    DFT_NULL_HEADER_POINTER = 1,
+
+    /** @brief File type pointer is NULL. */
+    DFT_NULL_FTYPE_POINTER = 2
+};
+
+/**
+ * @enum Error_Codes_EXE
+ * @brief Error codes for the is_exec() function.
+ *
+ * These codes represent different failure scenarios that might occur
+ * when checking 2 firsts bytes of file (Checking file if it's executable permission)
+ *
+ * @see is_exec() for function utilizing these error codes.
+ * @retval Error_Codes_EXE See the enum for possible return values.
+ */
+enum Error_Codes_EXE
+{
+    /** @brief No errors, function completed successfully. */
+    EXE_SUCCESS = 0,
+
+    /** @brief File path argument is NULL. */
+    EXE_NULL_FILE_PATH_POINTER = 1,
+
+    /** @brief Execution flag pointer is NULL. */
+    EXE_NULL_EFLAG_POINTER = 2,
+
+    /** @brief Failed to open the specified file. */
+    EXE_FILE_FOPEN_ERROR = 3,
+
+    /** @brief Failed to read data from the file into the buffer. */
+    EXE_BUFFER_FREAD_ERROR = 4,
+
+    /** @brief Failed to close the file descriptor. */
+    EXE_FILE_FCLOSE_ERROR = 5,
+};
+
+/**
+ * @enum Error_Codes_CFS
+ * @brief Error codes for the calculate_file_size() function.
+ *
+ * CFS - Calculate File Size.
+ * These error codes help to identify various issues that can occur
+ * while determining the size of a file.
+ *
+ * @note Each error code corresponds to a specific failure during file
+ *       handling or file size calculation.
+ *
+ * @see calculate_file_size() for function utilizing these error codes.
+ * @retval Error_Codes_CFS See the enum for possible return values.
+ */
+enum Error_Codes_CFS
+{
+    /** @brief No errors, function completed successfully. */
+    CFS_SUCCESS = 0,
+
+    /** @brief The file path argument is NULL. */
+    CFS_NULL_FILE_PATH_POINTER = 1,
+
+    /** @brief The file size pointer argument is NULL. */
+    CFS_NULL_FILE_SIZE_POINTER = 2,
+
+    /** @brief The file could not be opened. */
+    CFS_FILE_FOPEN_ERROR = 3,
+
+    /** @brief Failed to set file position to the end of the file. */
+    CFS_END_FSEEK_ERROR = 4,
+
+    /** @brief Failed to obtain the current value of the file-position indicator. */
+    CFS_SIZE_FTELL_ERROR = 5,
+
+    /** @brief The file could not be closed properly. */
+    CFS_FILE_FCLOSE_ERROR = 6
+};
+
+/**
+ * @enum Error_Codes_SF
+ * @brief Error codes for the scan_file() function.
+ *
+ * SF - Scan File.
+ * These error codes are used to report results and errors during
+ * the process of scanning a file for virus signatures.
+ *
+ * @note These error codes are specifically associated with the
+ * scanning process and help in identifying different types of failures
+ * or issues during file scanning.
+ *
+ * @see scan_file() for function utilizing these error codes.
+ * @retval Error_Codes_SF See the enum for possible return values.
+ */
+enum Error_Codes_SF
+{
+    /** @brief No errors, function completed successfully. */
+    SF_SUCCESS = 0,
+
+    /** @brief The file path argument is NULL. */
+    SF_NULL_FILE_PATH_POINTER = 1,
+
+    /** @brief The virus structure pointer is NULL. */
+    SF_NULL_VSTRUCT_POINTER = 2,
+
+    /** @brief The Virus Flag pointer is NULL. */
+    SF_NULL_VFLAG_POINTER = 3,
+
+    /** @brief The file could not be opened. */
+    SF_FILE_FOPEN_ERROR = 4,
+
+    /** @brief Failed to set the file position to the given offset. */
+    SF_OFFSET_FSEEK_ERROR = 5,
+
+    /** @brief Failed to read the signature from the file buffer. */
+    SF_BUFFER_FREAD_ERROR = 6,
+
+    /** @brief The file could not be closed properly during scanning. */
+    SF_FILE_FCLOSE_ERROR = 7,
+};
+
+/**
+ * @enum Error_Codes_SFD
+ * @brief Error codes for the scan_fd() function.
+ *
+ * SFD - Scan File Descriptor.
+ * Same scanning stages as read_file_header(), detect_file_type() and scan_file(),
+ * but on a descriptor that is already open (e.g. handed over by fanotify).
+ *
+ * @see scan_fd() for function utilizing these error codes.
+ * @retval Error_Codes_SFD See the enum for possible return values.
+ */
+enum Error_Codes_SFD
+{
+    /** @brief No errors, function completed successfully. */
+    SFD_SUCCESS = 0,
+
+    /** @brief File descriptor is negative. */
+    SFD_INVALID_FD = 1,
+
+    /** @brief Signature base pointer is NULL. */
+    SFD_NULL_SBASE_POINTER = 2,
+
+    /** @brief The Virus Flag pointer is NULL. */
+    SFD_NULL_VFLAG_POINTER = 3,
+
+    /** @brief Signature index pointer is NULL. */
+    SFD_NULL_SINDEX_POINTER = 4,
+
+    /** @brief Failed to get file status (size). */
+    SFD_FILE_FSTAT_ERROR = 5,
+
+    /** @brief Failed to read bytes from the descriptor. */
+    SFD_BUFFER_PREAD_ERROR = 6,
+
+    /** @brief Scanning of descriptors is not supported on this platform. */
+    SFD_NOT_SUPPORTED = 7,
+
+    /** @brief Search of floating signatures failed (see scan_fd_floating()). */
+    SFD_FLOATING_SCAN_ERROR = 8,
+
+    /** @brief Hits list pointer is NULL (scan_fd_hits()). */
+    SFD_NULL_HITS_POINTER = 9,
+
+    /** @brief Failed to allocate memory for hits (scan_fd_hits()). */
+    SFD_HITS_MALLOC_ERROR = 10,
+
+    /** @brief The deadline passed before the scan finished (scan_fd_hits()). */
+    SFD_DEADLINE_EXPIRED = 11
+};
+
+/**
+ * @enum Error_Codes_SBH
+ * @brief Error codes for the scan_buffer_hits() and scan_iovec_hits() functions.
+ *
+ * SBH - Scan Buffers for Hits.
+ *
+ * @see scan_iovec_hits() for function utilizing these error codes.
+ * @retval Error_Codes_SBH See the enum for possible return values.
+ */
+enum Error_Codes_SBH
+{
+    /** @brief No errors, function completed successfully. */
+    SBH_SUCCESS = 0,
+
+    /** @brief Buffer or segment pointer is NULL (and its size is not 0). */
+    SBH_NULL_BUFFER_POINTER = 1,
+
+    /** @brief Signature base pointer is NULL. */
+    SBH_NULL_SBASE_POINTER = 2,
+
+    /** @brief Hits list pointer is NULL. */
+    SBH_NULL_HITS_POINTER = 3,
+
+    /** @brief Failed to allocate memory for hits. */
+    SBH_HITS_MALLOC_ERROR = 4
+};
+
+/**
+ * @enum Error_Codes_SFF
+ * @brief Error codes for the scan_fd_floating() and scan_file_floating() functions.
+ *
+ * SFF - Scan File for Floating signatures.
+ *
+ * @see scan_fd_floating() for function utilizing these error codes.
+ * @retval Error_Codes_SFF See the enum for possible return values.
+ */
+enum Error_Codes_SFF
+{
+    /** @brief No errors, function completed successfully. */
+    SFF_SUCCESS = 0,
+
+    /** @brief File descriptor is negative or file path is NULL. */
+    SFF_INVALID_FILE = 1,
+
+    /** @brief Signature base pointer is NULL. */
+    SFF_NULL_SBASE_POINTER = 2,
+
+    /** @brief Hits list pointer is NULL. */
+    SFF_NULL_HITS_POINTER = 3,
+
+    /** @brief File type is not a detectable type. */
+    SFF_INVALID_FILE_TYPE = 4,
+
+    /** @brief The file could not be opened. */
+    SFF_FILE_OPEN_ERROR = 5,
+
+    /** @brief Failed to get file status (size). */
+    SFF_FILE_FSTAT_ERROR = 6,
+
+    /** @brief Failed to read a chunk of the file. */
+    SFF_BUFFER_PREAD_ERROR = 7,
+
+    /** @brief Failed to allocate chunk buffers or hits. */
+    SFF_HITS_MALLOC_ERROR = 8,
+
+    /** @brief Scanning of floating signatures is not supported on this platform. */
+    SFF_NOT_SUPPORTED = 9,
+
+    /** @brief The deadline passed between two chunks; the scan was abandoned. */
+    SFF_DEADLINE_EXPIRED = 10
+};
+
+/**
+ * @enum Error_Codes_IES
+ * @brief Error codes for the init_entropy_stats() function.
+ *
+ * IES - Init Entropy Statistics.
+ *
+ * @see init_entropy_stats() for function utilizing these error codes.
+ * @retval Error_Codes_IES See the enum for possible return values.
+ */
+enum Error_Codes_IES
+{
+    /** @brief No errors, function completed successfully. */
+    IES_SUCCESS = 0,
+
+    /** @brief Header buffer pointer is NULL. */
+    IES_NULL_HEADER_POINTER = 1,
+
+    /** @brief Statistics pointer is NULL. */
+    IES_NULL_STATS_POINTER = 2
+};
+
+// Declare all functions here:
+int read_signature(const char *file_path, VirusSignature *vs); // Reads a virus signature from a specified file.
+
+int parse_signature_line(const char *line, VirusSignature *vs); // Parses one line of the signature file.
+
+int read_signature_base(const char *file_path, SignatureBase *sb); // Reads every signature of the signature file.
+
+void free_signature_base(SignatureBase *sb); // Releases memory owned by a signature base.
+
+int read_file_header(const char *file_path, unsigned char *header, size_t *header_size); // Reads the first page of a file.
+
+int detect_file_type(const unsigned char *header, size_t header_size, int *file_type); // Detects file type by magic number.
+
+int is_exec(const char *file_path, int *exe_flag); // Checks if the specified file has execution permissions.
+
+int calculate_file_size(const char *file_path, size_t *file_size); // Calculates the size of a file specified by the file path.
+
+int scan_file(const char *file_path, VirusSignature *vs, int *virus_flag); // Scans a file specified by the file path for virus signatures.
+
+int scan_fd(int fd, const SignatureBase *sb, int *virus_flag, size_t *signature_index); // Scans an already open file descriptor.
+
+int scan_fd_hits(int fd, const SignatureBase *sb, int first_hit, size_t threads, const ScanControl *control, int *file_type, ScanHits *hits, EntropyStats *stats); // Scans a descriptor, collecting every match.
+
+int scan_buffer_hits(const unsigned char *buffer, size_t size, const SignatureBase *sb, int first_hit, int *file_type, ScanHits *hits, EntropyStats *stats); // Same, on bytes in memory.
+
+int scan_iovec_hits(const struct iovec *iov, size_t iovcnt, const SignatureBase *sb, int first_hit, int *file_type, ScanHits *hits, EntropyStats *stats); // Same, on scattered buffers.
+
+int scan_fd_floating(int fd, const SignatureBase *sb, int file_type, int first_hit, size_t threads, const ScanControl *control, ScanHits *hits, EntropyStats *stats); // Searches floating signatures in parallel ranges.
+
+int scan_file_floating(const char *file_path, const SignatureBase *sb, int file_type, size_t threads, ScanHits *hits, EntropyStats *stats); // Same, by file path.
+
+int init_entropy_stats(const unsigned char *header, size_t header_size, EntropyStats *stats); // Prepares byte statistics (PE sections from the header).
+
+void finish_entropy_stats(EntropyStats *stats); // Computes entropies and the packed flag.
+
+void free_scan_hits(ScanHits *hits); // Releases memory owned by a hits list.
+
+/**
+ * @brief Reads a virus signature from a file.
+ *
+ * This function loads the virus signature, offset, name and optional file type
+ * from the first signature line of a text file into a VirusSignature structure.
+ *
+ * File format should be:
+ * @code
+ * 4D 5A 90 00 03 00 00 00 1234 ExampleVirus
+ * @endcode
+ *
+ * Example usage:
+ * @code
+ * VirusSignature vs;
+ * int result = read_signature("signature.txt", &vs);
+ * if (result == RS_SUCCESS)
+ * {
+ *     printf("Signature loaded: %s\n", vs.virus_name);
+ * }
+ * else
+ * {
+ *     printf("Error code: %d\n", result);
+ * }
+ * @endcode
+ *
+ * @param [in] file_path Path to the file containing the signature.
+ * @param [out] vs Pointer to the VirusSignature structure to be filled.
+ * @return Error code from @ref Error_Codes_RS.
+ */
+int read_signature(const char *file_path, VirusSignature *vs)
+{
+    if (file_path == NULL)
+    {
+        return RS_NULL_FILE_PATH_POINTER; // 1
+    }
+    if (vs == NULL)
+    {
+        return RS_NULL_VSTRUCT_POINTER; // 2
+    }
+
+    // Declare all the variables:
+    char line[MAX_SIGNATURE_LINE_LENGTH];
+    const char *cursor;
+    int result;
+    FILE *file = fopen(file_path, "r");
+
+    if (file == NULL)
+    {
+        return RS_FILE_FOPEN_ERROR; // 3
+    }
+
+    // Skip blank lines and '#' comments before the first signature
+    do
+    {
+        if (fgets(line, sizeof(line), file) == NULL)
+        {
+            fclose(file);
+            return RS_LINE_FGETS_ERROR; // 8
+        }
+        cursor = line;
+        while (*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n')
+        {
+            cursor++;
+        }
+    } while (*cursor == '\0' || *cursor == '#');
+
+    result = parse_signature_line(line, vs);
+    if (result != RS_SUCCESS)
+    {
+        fclose(file);
+        return result;
+    }
+
+    if (fclose(file) != 0)
+    {
+        return RS_FILE_FCLOSE_ERROR; // 7
+    }
+    return RS_SUCCESS; // 0
+}
+
+/**
+ * @brief Names of file types as written in the signature file, indexed by @ref File_Types.
+ */
+static const char *const file_type_names[FT_ANY + 1] =
+{
+    "UNKNOWN", "PE", "ELF", "MACHO", "PDF", "OLE", "ZIP", "GZIP", "SCRIPT", "ANY"
+};
+
+/**
+ * @brief Parses one line of the signature file.
+ *
+ * Line format is:
+ * @code
+ * <HEX SIGNATURE> <HEX OFFSET> <VIRUS NAME> [FILE TYPE]
+ * @endcode
+ * where the offset may be "*" for a floating signature searched at any position, and the optional file type is one of UNKNOWN, PE, ELF, MACHO, PDF, OLE, ZIP,
+ * GZIP, SCRIPT or ANY. Lines without a file type apply to PE files only, which
+ * keeps old signature files working as before.
+ *
+ * @param [in] line Zero-terminated signature line.
+ * @param [out] vs Pointer to the VirusSignature structure to be filled.
+ * @return Error code from @ref Error_Codes_RS.
+ */
+int parse_signature_line(const char *line, VirusSignature *vs)
+{
+    if (line == NULL)
+    {
+        return RS_NULL_FILE_PATH_POINTER; // 1
+    }
+    if (vs == NULL)
+    {
+        return RS_NULL_VSTRUCT_POINTER; // 2
+    }
+
+    // Declare all the variables:
+    char type_name[MAX_FILE_TYPE_NAME_LENGTH];
+    size_t i;
+    int consumed = 0;
+
+    for (i = 0; i < sizeof(vs->signature) / sizeof(vs->signature[0]); i++)
+    {
+        if (sscanf(line, "%hhx%n", &vs->signature[i], &consumed) != 1)
+        {
+            return RS_SIGNATURE_FSCANF_ERROR; // 4
+        }
+        line += consumed;
+    }
+
+    consumed = 0;
+    if (sscanf(line, " *%n", &consumed) == 0 && consumed > 0) // "*" -> floating signature
+    {
+        vs->offset = SIGNATURE_ANY_OFFSET;
+    }
+    else if (sscanf(line, "%zx%n", &vs->offset, &consumed) != 1)
+    {
+        return RS_OFFSET_FSCANF_ERROR; // 5
+    }
+    line += consumed;
+
+    // 255 = MAX_VIRUS_NAME_LENGTH - 1
+    if (sscanf(line, "%255s%n", vs->virus_name, &consumed) != 1)
+    {
+        return RS_VNAME_FSCANF_ERROR; // 6
+    }
+    line += consumed;
+
+    // 15 = MAX_FILE_TYPE_NAME_LENGTH - 1
+    if (sscanf(line, "%15s", type_name) != 1)
+    {
+        vs->file_type = FT_PE; // no type -> old format, PE only
+        return RS_SUCCESS; // 0
+    }
+
+    for (i = 0; i <= FT_ANY; i++)
+    {
+        if (strcmp(type_name, file_type_names[i]) == 0)
+        {
+            vs->file_type = (int)i;
+            return RS_SUCCESS; // 0
+        }
+    }
+    return RS_FTYPE_SSCANF_ERROR; // 9
+}
+
+/**
+ * @def RULE_NO_NODE
+ * @brief Returned by the rule condition parser on a syntax error or when a rule has too many nodes.
+ */
+#define RULE_NO_NODE ((size_t)-1)
+
+/**
+ * @brief State of the rule condition parser.
+ */
+typedef struct
+{
+    const char *cursor; /**< Next character of the condition. */
+    Rule *rule; /**< Rule receiving the nodes. */
+    char (*atom_names)[MAX_RULE_ATOM_NAME_LENGTH]; /**< Names of the rule's atoms, by index in Rule.atoms. */
+} RuleParser;
+
+/**
+ * @brief Returns 1 if c may appear in a keyword or an atom name.
+ */
+static int is_rule_name_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+/**
+ * @brief Consumes a symbol ("(", "..", "<=", ...) if it comes next.
+ *
+ * @return 1 if the symbol was consumed, 0 otherwise.
+ */
+static int rule_symbol(RuleParser *parser, const char *symbol)
+{
+    // Declare all the variables:
+    size_t length = strlen(symbol);
+
+    while (*parser->cursor == ' ' || *parser->cursor == '\t')
+    {
+        parser->cursor++;
+    }
+    if (strncmp(parser->cursor, symbol, length) != 0)
+    {
+        return 0;
+    }
+    parser->cursor += length;
+    return 1;
+}
+
+/**
+ * @brief Consumes a keyword ("and", "filesize", ...) if it comes next as a whole word.
+ *
+ * @return 1 if the keyword was consumed, 0 otherwise.
+ */
+static int rule_keyword(RuleParser *parser, const char *keyword)
+{
+    // Declare all the variables:
+    const char *saved = parser->cursor;
+
+    if (rule_symbol(parser, keyword) && !is_rule_name_char(*parser->cursor))
+    {
+        return 1;
+    }
+    parser->cursor = saved;
+    return 0;
+}
+
+/**
+ * @brief Appends a node to the rule.
+ *
+ * @return Index of the node, or RULE_NO_NODE if an operand failed to parse or the rule is full.
+ */
+static size_t rule_node(RuleParser *parser, int kind, size_t left, size_t right, size_t atom, uint64_t value)
+{
+    // Declare all the variables:
+    Rule *rule = parser->rule;
+    RuleNode *node;
+
+    if (left == RULE_NO_NODE || right == RULE_NO_NODE || rule->node_count == MAX_RULE_NODES)
+    {
+        return RULE_NO_NODE;
+    }
+
+    node = &rule->nodes[rule->node_count];
+    node->kind = kind;
+    node->left = left;
+    node->right = right;
+    node->atom = atom;
+    node->value = value;
+    return rule->node_count++;
+}
+
+/**
+ * @brief Reads the atom name after '$', '#' or '@'.
+ *
+ * @return Index of the atom in Rule.atoms, or MAX_RULE_ATOMS if the rule has no atom of that name.
+ */
+static size_t rule_atom(RuleParser *parser)
+{
+    // Declare all the variables:
+    size_t length = 0, i;
+
+    while (is_rule_name_char(parser->cursor[length]))
+    {
+        length++;
+    }
+    for (i = 0; i < parser->rule->atom_count; i++)
+    {
+        if (strlen(parser->atom_names[i]) == length && strncmp(parser->atom_names[i], parser->cursor, length) == 0)
+        {
+            parser->cursor += length;
+            return i;
+        }
+    }
+    return MAX_RULE_ATOMS;
+}
+
+static size_t parse_rule_or(RuleParser *parser); // Parses a whole condition (lowest precedence).
+
+static size_t parse_rule_sum(RuleParser *parser); // Parses terms joined by + and -.
+
+/**
+ * @brief Parses the part of an atom test after "$name": nothing, "at <offset>" or "in (<from>..<to>)".
+ */
+static size_t parse_rule_found(RuleParser *parser, size_t atom)
+{
+    // Declare all the variables:
+    size_t low, high;
+
+    if (rule_keyword(parser, "at"))
+    {
+        return rule_node(parser, RN_AT, parse_rule_sum(parser), 0, atom, 0);
+    }
+    if (!rule_keyword(parser, "in"))
+    {
+        return rule_node(parser, RN_FOUND, 0, 0, atom, 0);
+    }
+
+    if (!rule_symbol(parser, "("))
+    {
+        return RULE_NO_NODE;
+    }
+    low = parse_rule_sum(parser);
+    if (!rule_symbol(parser, ".."))
+    {
+        return RULE_NO_NODE;
+    }
+    high = parse_rule_sum(parser);
+    if (!rule_symbol(parser, ")"))
+    {
+        return RULE_NO_NODE;
+    }
+    return rule_node(parser, RN_IN, low, high, atom, 0);
+}
+
+/**
+ * @brief Parses a number: decimal or 0x hexadecimal, optionally followed by KB or MB.
+ */
+static size_t parse_rule_number(RuleParser *parser)
+{
+    // Declare all the variables:
+    uint64_t value;
+    char *end;
+
+    while (*parser->cursor == ' ' || *parser->cursor == '\t')
+    {
+        parser->cursor++;
+    }
+    if (*parser->cursor < '0' || *parser->cursor > '9')
+    {
+        return RULE_NO_NODE;
+    }
+
+    value = strtoull(parser->cursor, &end, 0);
+    parser->cursor = end;
+    if (rule_keyword(parser, "KB"))
+    {
+        value *= 1024;
+    }
+    else if (rule_keyword(parser, "MB"))
+    {
+        value *= 1024 * 1024;
+    }
+
+    if (rule_keyword(parser, "of")) // "N of them"
+    {
+        return rule_keyword(parser, "them") ? rule_node(parser, RN_OF, 0, 0, 0, value) : RULE_NO_NODE;
+    }
+    return rule_node(parser, RN_NUMBER, 0, 0, 0, value);
+}
+
+/**
+ * @brief Parses one operand: $a (at/in), #a, @a[n], filesize, filetype, a type name,
+ *        true/false, "any/all/N of them", a number or a condition in parentheses.
+ */
+static size_t parse_rule_term(RuleParser *parser)
+{
+    // Declare all the variables:
+    size_t node, atom, type;
+
+    if (rule_symbol(parser, "("))
+    {
+        node = parse_rule_or(parser);
+        return rule_symbol(parser, ")") ? node : RULE_NO_NODE;
+    }
+    if (rule_symbol(parser, "$"))
+    {
+        atom = rule_atom(parser);
+        return (atom == MAX_RULE_ATOMS) ? RULE_NO_NODE : parse_rule_found(parser, atom);
+    }
+    if (rule_symbol(parser, "#"))
+    {
+        atom = rule_atom(parser);
+        return (atom == MAX_RULE_ATOMS) ? RULE_NO_NODE : rule_node(parser, RN_COUNT, 0, 0, atom, 0);
+    }
+    if (rule_symbol(parser, "@"))
+    {
+        atom = rule_atom(parser);
+        if (atom == MAX_RULE_ATOMS)
+        {
+            return RULE_NO_NODE;
+        }
+        if (!rule_symbol(parser, "["))
+        {
+            return rule_node(parser, RN_OFFSET, rule_node(parser, RN_NUMBER, 0, 0, 0, 1), 0, atom, 0); // @a = @a[1]
+        }
+        node = parse_rule_sum(parser);
+        return rule_symbol(parser, "]") ? rule_node(parser, RN_OFFSET, node, 0, atom, 0) : RULE_NO_NODE;
+    }
+
+    if (rule_keyword(parser, "filesize"))
+    {
+        return rule_node(parser, RN_FILESIZE, 0, 0, 0, 0);
+    }
+    if (rule_keyword(parser, "filetype"))
+    {
+        return rule_node(parser, RN_FILETYPE, 0, 0, 0, 0);
+    }
+    if (rule_keyword(parser, "true"))
+    {
+        return rule_node(parser, RN_NUMBER, 0, 0, 0, 1);
+    }
+    if (rule_keyword(parser, "false"))
+    {
+        return rule_node(parser, RN_NUMBER, 0, 0, 0, 0);
+    }
+    for (type = 0; type < FT_ANY; type++)
+    {
+        if (rule_keyword(parser, file_type_names[type]))
+        {
+            return rule_node(parser, RN_NUMBER, 0, 0, 0, type);
+        }
+    }
+    if (rule_keyword(parser, "any"))
+    {
+        return (rule_keyword(parser, "of") && rule_keyword(parser, "them"))
+               ? rule_node(parser, RN_OF, 0, 0, 0, 1) : RULE_NO_NODE;
+    }
+    if (rule_keyword(parser, "all"))
+    {
+        return (rule_keyword(parser, "of") && rule_keyword(parser, "them"))
+               ? rule_node(parser, RN_OF, 0, 0, 0, parser->rule->atom_count) : RULE_NO_NODE;
+    }
+
+    return parse_rule_number(parser);
+}
+
+static size_t parse_rule_sum(RuleParser *parser)
+{
+    // Declare all the variables:
+    size_t node = parse_rule_term(parser);
+
+    while (node != RULE_NO_NODE)
+    {
+        if (rule_symbol(parser, "+"))
+        {
+            node = rule_node(parser, RN_ADD, node, parse_rule_term(parser), 0, 0);
+        }
+        else if (rule_symbol(parser, "-"))
+        {
+            node = rule_node(parser, RN_SUB, node, parse_rule_term(parser), 0, 0);
+        }
+        else
+        {
+            break;
+        }
+    }
+    return node;
+}
+
+/**
+ * @brief Parses a sum, optionally compared with another one (==, !=, <, <=, >, >=).
+ */
+static size_t parse_rule_comparison(RuleParser *parser)
+{
+    // Declare all the variables:
+    static const struct
+    {
+        const char *symbol;
+        int kind;
+    } operators[] =
+    {
+        {"==", RN_EQ}, {"!=", RN_NE}, {"<=", RN_LE}, {">=", RN_GE}, {"<", RN_LT}, {">", RN_GT}
+    };
+    size_t node = parse_rule_sum(parser), i;
+
+    for (i = 0; node != RULE_NO_NODE && i < sizeof(operators) / sizeof(operators[0]); i++)
+    {
+        if (rule_symbol(parser, operators[i].symbol))
+        {
+            return rule_node(parser, operators[i].kind, node, parse_rule_sum(parser), 0, 0);
+        }
+    }
+    return node;
+}
+
+/**
+ * @brief Parses "not" applied any number of times to a comparison.
+ */
+static size_t parse_rule_not(RuleParser *parser)
+{
+    if (rule_keyword(parser, "not"))
+    {
+        return rule_node(parser, RN_NOT, parse_rule_not(parser), 0, 0, 0);
+    }
+    return parse_rule_comparison(parser);
+}
+
+/**
+ * @brief Parses operands joined by "and".
+ */
+static size_t parse_rule_and(RuleParser *parser)
+{
+    // Declare all the variables:
+    size_t node = parse_rule_not(parser);
+
+    while (node != RULE_NO_NODE && rule_keyword(parser, "and"))
+    {
+        node = rule_node(parser, RN_AND, node, parse_rule_not(parser), 0, 0);
+    }
+    return node;
+}
+
+static size_t parse_rule_or(RuleParser *parser)
+{
+    // Declare all the variables:
+    size_t node = parse_rule_and(parser);
+
+    while (node != RULE_NO_NODE && rule_keyword(parser, "or"))
+    {
+        node = rule_node(parser, RN_OR, node, parse_rule_and(parser), 0, 0);
+    }
+    return node;
+}
+
+/**
+ * @brief Reads one rule block of the signature file, from the line after "rule" to "end".
+ *
+ * Block format is:
+ * @code
+ * rule <NAME> [FILE TYPE]
+ *     $<atom> = <HEX SIGNATURE>
+ *     ...
+ *     condition: <CONDITION>
+ * end
+ * @endcode
+ * Atoms have the length of a signature. The entry naming the rule is written to
+ * *entry; the atoms are added to the atom pool (identical atoms are shared by all
+ * rules) and Rule.atoms holds pool indices until read_signature_base() appends the
+ * pool to the signatures.
+ *
+ * @param [in] file Signature file, positioned after the "rule" line.
+ * @param [in] header Rest of the "rule" line (name and optional file type).
+ * @param [out] entry Signature entry of the rule.
+ * @param [out] rule Parsed rule.
+ * @param [in,out] atoms Atom pool (grown with realloc()).
+ * @param [in,out] atom_count Number of atoms in the pool.
+ * @param [in,out] atom_capacity Allocated size of the pool.
+ * @return RSB_SUCCESS, RSB_RULE_PARSE_ERROR, RSB_BASE_MALLOC_ERROR or RSB_LINE_FGETS_ERROR.
+ */
+static int read_rule(FILE *file, const char *header, VirusSignature *entry, Rule *rule,
+                     VirusSignature **atoms, size_t *atom_count, size_t *atom_capacity)
+{
+    // Declare all the variables:
+    char line[MAX_SIGNATURE_LINE_LENGTH];
+    char type_name[MAX_FILE_TYPE_NAME_LENGTH];
+    char atom_names[MAX_RULE_ATOMS][MAX_RULE_ATOM_NAME_LENGTH];
+    VirusSignature atom, *grown;
+    RuleParser parser;
+    const char *cursor;
+    size_t i, pool;
+    int consumed = 0, condition_flag = 0;
+
+    memset(entry, 0, sizeof(*entry));
+    memset(rule, 0, sizeof(*rule));
+
+    // 255 = MAX_VIRUS_NAME_LENGTH - 1
+    if (sscanf(header, "%255s%n", entry->virus_name, &consumed) != 1)
+    {
+        return RSB_RULE_PARSE_ERROR; // 9
+    }
+    entry->offset = SIGNATURE_RULE_OFFSET;
+    entry->file_type = FT_ANY; // no type -> the rule sees every file
+    // 15 = MAX_FILE_TYPE_NAME_LENGTH - 1
+    if (sscanf(header + consumed, "%15s", type_name) == 1)
+    {
+        for (i = 0; i <= FT_ANY; i++)
+        {
+            if (strcmp(type_name, file_type_names[i]) == 0)
+            {
+                break;
+            }
+        }
+        if (i > FT_ANY)
+        {
+            return RSB_RULE_PARSE_ERROR; // 9
+        }
+        entry->file_type = (int)i;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        cursor = line;
+        while (*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n')
+        {
+            cursor++;
+        }
+        if (*cursor == '\0' || *cursor == '#') // blank line or comment
+        {
+            continue;
+        }
+
+        if (strncmp(cursor, "end", 3) == 0 && !is_rule_name_char(cursor[3]))
+        {
+            return condition_flag ? RSB_SUCCESS : RSB_RULE_PARSE_ERROR; // 0 : 9
+        }
+
+        if (condition_flag) // nothing but "end" after the condition
+        {
+            return RSB_RULE_PARSE_ERROR; // 9
+        }
+
+        if (strncmp(cursor, "condition:", 10) == 0)
+        {
+            parser.cursor = cursor + 10;
+            parser.rule = rule;
+            parser.atom_names = atom_names;
+            rule->root = parse_rule_or(&parser);
+            while (*parser.cursor == ' ' || *parser.cursor == '\t' || *parser.cursor == '\r' || *parser.cursor == '\n')
+            {
+                parser.cursor++;
+            }
+            if (rule->root == RULE_NO_NODE || *parser.cursor != '\0')
+            {
+                return RSB_RULE_PARSE_ERROR; // 9
+            }
+            condition_flag = 1;
+            continue;
+        }
+
+        // $<atom> = <HEX SIGNATURE>
+        if (*cursor != '$' || rule->atom_count == MAX_RULE_ATOMS)
+        {
+            return RSB_RULE_PARSE_ERROR; // 9
+        }
+        cursor++;
+        for (i = 0; is_rule_name_char(cursor[i]) && i + 1 < MAX_RULE_ATOM_NAME_LENGTH; i++)
+        {
+            atom_names[rule->atom_count][i] = cursor[i];
+        }
+        atom_names[rule->atom_count][i] = '\0';
+        cursor += i;
+        consumed = 0;
+        if (i == 0 || is_rule_name_char(*cursor) || sscanf(cursor, " =%n", &consumed) != 0 || consumed == 0)
+        {
+            return RSB_RULE_PARSE_ERROR; // 9
+        }
+        cursor += consumed;
+
+        memset(&atom, 0, sizeof(atom));
+        for (i = 0; i < MAX_SIGNATURE_LENGTH; i++)
+        {
+            if (sscanf(cursor, "%hhx%n", &atom.signature[i], &consumed) != 1)
+            {
+                return RSB_RULE_PARSE_ERROR; // 9
+            }
+            cursor += consumed;
+        }
+        atom.offset = SIGNATURE_ANY_OFFSET;
+        atom.file_type = entry->file_type;
+        snprintf(atom.virus_name, sizeof(atom.virus_name), "%.200s$%s", entry->virus_name, atom_names[rule->atom_count]);
+
+        // One pool entry per distinct pattern and type, shared by every rule using it
+        for (pool = 0; pool < *atom_count; pool++)
+        {
+            if ((*atoms)[pool].file_type == atom.file_type &&
+                memcmp((*atoms)[pool].signature, atom.signature, MAX_SIGNATURE_LENGTH) == 0)
+            {
+                break;
+            }
+        }
+        if (pool == *atom_count)
+        {
+            if (*atom_count == *atom_capacity)
+            {
+                *atom_capacity = (*atom_capacity == 0) ? 16 : *atom_capacity * 2;
+                grown = realloc(*atoms, *atom_capacity * sizeof(*grown));
+                if (grown == NULL)
+                {
+                    return RSB_BASE_MALLOC_ERROR; // 5
+                }
+                *atoms = grown;
+            }
+            (*atoms)[(*atom_count)++] = atom;
+        }
+        rule->atoms[rule->atom_count++] = pool;
+    }
+
+    return ferror(file) ? RSB_LINE_FGETS_ERROR : RSB_RULE_PARSE_ERROR; // 8 : 9 (no "end")
+}
+
+/**
+ * @brief Returns the anchor of a floating signature or of a file position: its first 4 bytes.
+ *
+ * @param [in] bytes At least 4 bytes.
+ */
+static uint32_t signature_anchor(const unsigned char *bytes)
+{
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+/**
+ * @brief Returns the first Bloom filter bit of an anchor.
+ *
+ * @param [in] anchor Anchor from signature_anchor().
+ * @param [in] shift 32 - log2(bits of the filter).
+ */
+static uint32_t bloom_bit1(uint32_t anchor, unsigned shift)
+{
+    return (anchor * 0x9E3779B1u) >> shift;
+}
+
+/**
+ * @brief Returns the second Bloom filter bit of an anchor (independent of the first).
+ *
+ * @param [in] anchor Anchor from signature_anchor().
+ * @param [in] shift 32 - log2(bits of the filter).
+ */
+static uint32_t bloom_bit2(uint32_t anchor, unsigned shift)
+{
+    return ((anchor ^ (anchor >> 16)) * 0x85EBCA6Bu) >> shift;
+}
+
+/**
+ * @brief Compares two (anchor << 32 | signature index) keys (for qsort()).
+ */
+static int compare_anchor_keys(const void *left, const void *right)
+{
+    // Declare all the variables:
+    uint64_t a = *(const uint64_t *)left;
+    uint64_t b = *(const uint64_t *)right;
+
+    return (a > b) - (a < b);
+}
+
+/**
+ * @brief Builds the prefilter of the floating signatures of one file type.
+ *
+ * The floating subset is sorted by anchor (then by index, so signatures matching
+ * at the same position are still reported in file order), the anchors are kept
+ * next to it for a binary search, and a Bloom filter of BLOOM_BITS_PER_ANCHOR
+ * bits per signature is filled with two hashes of every anchor.
+ *
+ * @param [in,out] sb Signature base with the floating subset of the type built.
+ * @param [in] type File type.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+static int build_floating_prefilter(SignatureBase *sb, size_t type)
+{
+    // Declare all the variables:
+    size_t count = sb->floating_subset_sizes[type];
+    uint64_t *keys;
+    uint32_t anchor, bit;
+    unsigned bits_log2 = MIN_BLOOM_BITS_LOG2;
+    size_t i;
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    keys = malloc(count * sizeof(uint64_t));
+    sb->floating_anchors[type] = malloc(count * sizeof(uint32_t));
+    while (bits_log2 < MAX_BLOOM_BITS_LOG2 && ((size_t)1 << bits_log2) < count * BLOOM_BITS_PER_ANCHOR)
+    {
+        bits_log2++;
+    }
+    sb->floating_blooms[type] = calloc(((size_t)1 << bits_log2) / 64, sizeof(uint64_t));
+    sb->floating_bloom_shifts[type] = 32 - bits_log2;
+    if (keys == NULL || sb->floating_anchors[type] == NULL || sb->floating_blooms[type] == NULL)
+    {
+        free(keys);
+        return -1;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        anchor = signature_anchor(sb->signatures[sb->floating_subsets[type][i]].signature);
+        keys[i] = ((uint64_t)anchor << 32) | (uint64_t)sb->floating_subsets[type][i];
+    }
+    qsort(keys, count, sizeof(uint64_t), compare_anchor_keys);
+    for (i = 0; i < count; i++)
+    {
+        sb->floating_subsets[type][i] = (size_t)(keys[i] & 0xFFFFFFFFu);
+        sb->floating_anchors[type][i] = anchor = (uint32_t)(keys[i] >> 32);
+        bit = bloom_bit1(anchor, sb->floating_bloom_shifts[type]);
+        sb->floating_blooms[type][bit >> 6] |= (uint64_t)1 << (bit & 63);
+        bit = bloom_bit2(anchor, sb->floating_bloom_shifts[type]);
+        sb->floating_blooms[type][bit >> 6] |= (uint64_t)1 << (bit & 63);
+    }
+
+    free(keys);
+    return 0;
+}
+
+/**
+ * @brief Reads every signature of the signature file into a signature base.
+ *
+ * Each non-empty line not starting with '#' is parsed by parse_signature_line(),
+ * except "rule" blocks, which are read by read_rule(). Rule atoms are appended
+ * after all signatures as floating signatures of the rule's type.
+ * After loading, the per-type subsets are built so that the matching stage only
+ * runs the signatures of the type returned by detect_file_type().
+ *
+ * Example usage:
+ * @code
+ * SignatureBase sb;
+ * if (read_signature_base("signature.txt", &sb) == RSB_SUCCESS)
+ * {
+ *     printf("%zu signatures for PE files\n", sb.subset_sizes[FT_PE]);
+ *     free_signature_base(&sb);
+ * }
+ * @endcode
+ *
+ * @param [in] file_path Path to the signature file.
+ * @param [out] sb Pointer to the SignatureBase to be filled. Must be released
+ *                 with free_signature_base() on success.
+ * @return Error code from @ref Error_Codes_RSB.
+ */
+int read_signature_base(const char *file_path, SignatureBase *sb)
+{
+    if (file_path == NULL)
+    {
+        return RSB_NULL_FILE_PATH_POINTER; // 1
+    }
+    if (sb == NULL)
+    {
+        return RSB_NULL_SBASE_POINTER; // 2
+    }
+
+    // Declare all the variables:
+    char line[MAX_SIGNATURE_LINE_LENGTH];
+    VirusSignature *grown, *atoms = NULL;
+    Rule *grown_rules;
+    const char *cursor;
+    size_t capacity = 0, rule_capacity = 0, atom_count = 0, atom_capacity = 0, type, i, n;
+    unsigned char first;
+    int result;
+    FILE *file;
+
+    memset(sb, 0, sizeof(*sb));
+
+    file = fopen(file_path, "r");
+    if (file == NULL)
+    {
+        return RSB_FILE_FOPEN_ERROR; // 3
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        cursor = line;
+        while (*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n')
+        {
+            cursor++;
+        }
+        if (*cursor == '\0' || *cursor == '#') // blank line or comment
+        {
+            continue;
+        }
+
+        if (sb->count == capacity)
+        {
+            capacity = (capacity == 0) ? 16 : capacity * 2;
+            grown = realloc(sb->signatures, capacity * sizeof(*grown));
+            if (grown == NULL)
+            {
+                fclose(file);
+                free(atoms);
+                free_signature_base(sb);
+                return RSB_BASE_MALLOC_ERROR; // 5
+            }
+            sb->signatures = grown;
+        }
+
+        if (strncmp(cursor, "rule", 4) == 0 && (cursor[4] == ' ' || cursor[4] == '\t')) // rule block
+        {
+            if (sb->rule_count == rule_capacity)
+            {
+                rule_capacity = (rule_capacity == 0) ? 4 : rule_capacity * 2;
+                grown_rules = realloc(sb->rules, rule_capacity * sizeof(*grown_rules));
+                if (grown_rules == NULL)
+                {
+                    fclose(file);
+                    free(atoms);
+                    free_signature_base(sb);
+                    return RSB_BASE_MALLOC_ERROR; // 5
+                }
+                sb->rules = grown_rules;
+            }
+
+            result = read_rule(file, cursor + 4, &sb->signatures[sb->count], &sb->rules[sb->rule_count],
+                               &atoms, &atom_count, &atom_capacity);
+            if (result != RSB_SUCCESS)
+            {
+                fclose(file);
+                free(atoms);
+                free_signature_base(sb);
+                return result; // 5, 8, 9
+            }
+            sb->rules[sb->rule_count++].signature_index = sb->count++;
+            continue;
+        }
+
+        if (parse_signature_line(line, &sb->signatures[sb->count]) != RS_SUCCESS)
+        {
+            fclose(file);
+            free(atoms);
+            free_signature_base(sb);
+            return RSB_LINE_PARSE_ERROR; // 4
+        }
+        sb->count++;
+    }
+
+    if (ferror(file))
+    {
+        fclose(file);
+        free(atoms);
+        free_signature_base(sb);
+        return RSB_LINE_FGETS_ERROR; // 8
+    }
+
+    if (fclose(file) != 0)
+    {
+        free(atoms);
+        free_signature_base(sb);
+        return RSB_FILE_FCLOSE_ERROR; // 7
+    }
+
+    if (sb->count == 0)
+    {
+        free_signature_base(sb);
+        return RSB_EMPTY_BASE; // 6
+    }
+
+    // Rule atoms go last, so that an index tells an atom from a signature
+    if (atom_count > 0)
+    {
+        grown = realloc(sb->signatures, (sb->count + atom_count) * sizeof(*grown));
+        if (grown == NULL)
+        {
+            free(atoms);
+            free_signature_base(sb);
+            return RSB_BASE_MALLOC_ERROR; // 5
+        }
+        sb->signatures = grown;
+        memcpy(sb->signatures + sb->count, atoms, atom_count * sizeof(*atoms));
+        for (i = 0; i < sb->rule_count; i++)
+        {
+            for (n = 0; n < sb->rules[i].atom_count; n++)
+            {
+                sb->rules[i].atoms[n] += sb->count;
+            }
+        }
+        sb->count += atom_count;
+        sb->atom_count = atom_count;
+        free(atoms);
+    }
+
+    // Subset of type T = signatures of type T + signatures of any type
+    for (type = 0; type < FT_ANY; type++)
+    {
+        for (i = 0, n = 0; i < sb->count; i++)
+        {
+            if ((sb->signatures[i].file_type == (int)type || sb->signatures[i].file_type == FT_ANY) &&
+                sb->signatures[i].offset != SIGNATURE_RULE_OFFSET) // rule entries are never searched
+            {
+                n++;
+            }
+        }
+        if (n == 0)
+        {
+            continue;
+        }
+
+        sb->subsets[type] = malloc(n * sizeof(size_t));
+        if (sb->subsets[type] == NULL)
+        {
+            free_signature_base(sb);
+            return RSB_BASE_MALLOC_ERROR; // 5
+        }
+        sb->floating_subsets[type] = malloc(n * sizeof(size_t));
+        if (sb->floating_subsets[type] == NULL)
+        {
+            free_signature_base(sb);
+            return RSB_BASE_MALLOC_ERROR; // 5
+        }
+        for (i = 0; i < sb->count; i++)
+        {
+            if ((sb->signatures[i].file_type == (int)type || sb->signatures[i].file_type == FT_ANY) &&
+                sb->signatures[i].offset != SIGNATURE_RULE_OFFSET)
+            {
+                sb->subsets[type][sb->subset_sizes[type]++] = i;
+                if (sb->signatures[i].offset == SIGNATURE_ANY_OFFSET)
+                {
+                    sb->floating_subsets[type][sb->floating_subset_sizes[type]++] = i;
+                    first = sb->signatures[i].signature[0];
+                    sb->floating_first_bytes[type][first >> 3] |= (unsigned char)(1u << (first & 7));
+                }
+            }
+        }
+        if (build_floating_prefilter(sb, type) != 0)
+        {
+            free_signature_base(sb);
+            return RSB_BASE_MALLOC_ERROR; // 5
+        }
+    }
+
+    return RSB_SUCCESS; // 0
+}
+
+/**
+ * @brief Releases memory owned by a signature base.
+ *
+ * Safe to call on a zeroed base or twice in a row.
+ *
+ * @param [in,out] sb Pointer to the SignatureBase to release (may be NULL).
+ */
+void free_signature_base(SignatureBase *sb)
+{
+    if (sb == NULL)
+    {
+        return;
+    }
+
+    // Declare all the variables:
+    size_t type;
+
+    for (type = 0; type < FT_ANY; type++)
+    {
+        free(sb->subsets[type]);
+        sb->subsets[type] = NULL;
+        sb->subset_sizes[type] = 0;
+        free(sb->floating_subsets[type]);
+        sb->floating_subsets[type] = NULL;
+        sb->floating_subset_sizes[type] = 0;
+        memset(sb->floating_first_bytes[type], 0, sizeof(sb->floating_first_bytes[type]));
+        free(sb->floating_anchors[type]);
+        sb->floating_anchors[type] = NULL;
+        free(sb->floating_blooms[type]);
+        sb->floating_blooms[type] = NULL;
+    }
+    free(sb->signatures);
+    sb->signatures = NULL;
+    sb->count = 0;
+    free(sb->rules);
+    sb->rules = NULL;
+    sb->rule_count = 0;
+    sb->atom_count = 0;
+}
+
+/**
+ * @brief Reads the first page of a file.
+ *
+ * The page is read once per file and then reused by detect_file_type(), so the
+ * type check does not need its own fopen/fread.
+ *
+ * @param [in] file_path Path to the file.
+ * @param [out] header Buffer of at least FILE_HEADER_PAGE_SIZE bytes.
+ * @param [out] header_size Number of bytes actually read (smaller for short files).
+ * @return Error code from @ref Error_Codes_RFH.
+ */
+int read_file_header(const char *file_path, unsigned char *header, size_t *header_size)
+{
+    if (file_path == NULL)
+    {
+        return RFH_NULL_FILE_PATH_POINTER; // 1
+    }
+    if (header == NULL)
+    {
+        return RFH_NULL_BUFFER_POINTER; // 2
+    }
+    if (header_size == NULL)
+    {
+        return RFH_NULL_HSIZE_POINTER; // 3
+    }
+
+    // Declare all the variables:
+    size_t size;
+    FILE *file = fopen(file_path, "rb");
+
+    if (file == NULL)
+    {
+        return RFH_FILE_FOPEN_ERROR; // 4
+    }
+
+    size = fread(header, sizeof(header[0]), FILE_HEADER_PAGE_SIZE, file);
+    if (size < FILE_HEADER_PAGE_SIZE && ferror(file))
+    {
+        fclose(file);
+        return RFH_BUFFER_FREAD_ERROR; // 5
+    }
+
+    if (fclose(file) != 0)
+    {
+        return RFH_FILE_FCLOSE_ERROR; // 6
+    }
+
+    *header_size = size;
+    return RFH_SUCCESS; // 0
+}
+
+// Magic number buckets. Each bucket holds the entries sharing one first byte and ends with a zero entry.
+static const MagicNumber magic_bucket_mz[] = { {2, {'M', 'Z'}, FT_PE}, {0, {0}, 0} };
+static const MagicNumber magic_bucket_elf[] = { {4, {0x7F, 'E', 'L', 'F'}, FT_ELF}, {0, {0}, 0} };
+static const MagicNumber magic_bucket_fe[] =
+{
+    {4, {0xFE, 0xED, 0xFA, 0xCE}, FT_MACHO}, // 32-bit, big endian
+    {4, {0xFE, 0xED, 0xFA, 0xCF}, FT_MACHO}, // 64-bit, big endian
+    {0, {0}, 0}
+};
+static const MagicNumber magic_bucket_ce[] = { {4, {0xCE, 0xFA, 0xED, 0xFE}, FT_MACHO}, {0, {0}, 0} };
+static const MagicNumber magic_bucket_cf[] = { {4, {0xCF, 0xFA, 0xED, 0xFE}, FT_MACHO}, {0, {0}, 0} };
+static const MagicNumber magic_bucket_ca[] = { {4, {0xCA, 0xFE, 0xBA, 0xBE}, FT_MACHO}, {0, {0}, 0} }; // fat binary (also Java class)
+static const MagicNumber magic_bucket_pdf[] = { {5, {'%', 'P', 'D', 'F', '-'}, FT_PDF}, {0, {0}, 0} };
+static const MagicNumber magic_bucket_ole[] =
+{
+    {8, {0xD0, 0xCF, 0x11, 0xE0, 0xA1, 0xB1, 0x1A, 0xE1}, FT_OLE},
+    {0, {0}, 0}
+};
+static const MagicNumber magic_bucket_zip[] =
+{
+    {4, {'P', 'K', 0x03, 0x04}, FT_ZIP}, // local file header
+    {4, {'P', 'K', 0x05, 0x06}, FT_ZIP}, // empty archive
+    {4, {'P', 'K', 0x07, 0x08}, FT_ZIP}, // spanned archive
+    {0, {0}, 0}
+};
+static const MagicNumber magic_bucket_gzip[] = { {2, {0x1F, 0x8B}, FT_GZIP}, {0, {0}, 0} };
+static const MagicNumber magic_bucket_script[] = { {2, {'#', '!'}, FT_SCRIPT}, {0, {0}, 0} };
+
+/**
+ * @brief Jump table from the first byte of a file to its magic number bucket.
+ *
+ * Detection costs one table lookup plus a compare of at most a few entries,
+ * instead of testing every known format in turn.
+ */
+static const MagicNumber *const magic_jump_table[256] =
+{
+    ['M'] = magic_bucket_mz,
+    [0x7F] = magic_bucket_elf,
+    [0xFE] = magic_bucket_fe,
+    [0xCE] = magic_bucket_ce,
+    [0xCF] = magic_bucket_cf,
+    [0xCA] = magic_bucket_ca,
+    ['%'] = magic_bucket_pdf,
+    [0xD0] = magic_bucket_ole,
+    ['P'] = magic_bucket_zip,
+    [0x1F] = magic_bucket_gzip,
+    ['#'] = magic_bucket_script
+};
+
+/**
+ * @brief Detects the type of a file by its magic number.
+ *
+ * The first byte of the header selects a bucket of magic_jump_table, then only
+ * the entries of that bucket are compared with the header.
+ *
+ * Example usage:
+ * @code
+ * unsigned char header[FILE_HEADER_PAGE_SIZE];
+ * size_t header_size;
+ * int file_type;
+ *
+ * if (read_file_header("target.exe", header, &header_size) == RFH_SUCCESS &&
+ *     detect_file_type(header, header_size, &file_type) == DFT_SUCCESS)
+ * {
+ *     printf("Type id: %d\n", file_type);
+ * }
+ * @endcode
+ *
+ * @param [in] header First bytes of the file (see read_file_header()).
+ * @param [in] header_size Number of valid bytes in header.
+ * @param [out] file_type Detected type id from @ref File_Types (FT_UNKNOWN if none matched).
+ * @return Error code from @ref Error_Codes_DFT.
+ */
+int detect_file_type(const unsigned char *header, size_t header_size, int *file_type)
+{
+    if (header == NULL)
+    {
+        return DFT_NULL_HEADER_POINTER; // 1
+    }
+    if (file_type == NULL)
+    {
+        return DFT_NULL_FTYPE_POINTER; // 2
+    }
+
+    // Declare all the variables:
+    const MagicNumber *entry;
+
+    *file_type = FT_UNKNOWN;
+    if (header_size == 0)
+    {
+        return DFT_SUCCESS; // 0
+    }
+
+    for (entry = magic_jump_table[header[0]]; entry != NULL && entry->length != 0; entry++)
+    {
+        if (entry->length <= header_size && memcmp(header, entry->magic, entry->length) == 0)
+        {
+            *file_type = entry->file_type;
+            break;
+        }
+    }
+
+    return DFT_SUCCESS; // 0
+}
+
+/**
+ * @brief Checks if the specified file has execution permissions.
+ *
+ * This function evaluates the file at the given path to determine if it is
+ * executable. It sets the provided flag to indicate the result of the check.
+ * The check is a thin wrapper over read_file_header() and detect_file_type().
+ *
+ * @param [in] file_path The path to the file to be checked for execution permissions.
+ * @param [out] exe_flag A pointer to an integer that will be updated to 1 if the file
+ *                 is executable, or 0 if it is not.
+ *
+ * @note This function is useful for validating file executable permission before attempting
+ *       to scan a file.
+ *
+ * @return Errors code from @ref Error_Codes_EXE.
+ */
+int is_exec(const char *file_path, int *exe_flag)
+{
+    if (file_path == NULL)
+    {
+        return EXE_NULL_FILE_PATH_POINTER; // 1
+    }
+
+    if (exe_flag == NULL)
+    {
+        return EXE_NULL_EFLAG_POINTER; // 2
+    }
+
+    // Declare all the variables:
+    unsigned char header[FILE_HEADER_PAGE_SIZE];
+    size_t header_size = 0;
+    int file_type = FT_UNKNOWN;
+
+    switch (read_file_header(file_path, header, &header_size))
+    {
+        case RFH_SUCCESS:
+            break;
+        case RFH_FILE_FOPEN_ERROR:
+            return EXE_FILE_FOPEN_ERROR; // 3
+        case RFH_FILE_FCLOSE_ERROR:
+            return EXE_FILE_FCLOSE_ERROR; // 5
+        default:
+            return EXE_BUFFER_FREAD_ERROR; // 4
+    }
+
+    if (header_size < sizeof(uint16_t)) // not even the "MZ" bytes
+    {
+        return EXE_BUFFER_FREAD_ERROR; // 4
+    }
+
+    detect_file_type(header, header_size, &file_type);
+    *exe_flag = (file_type == FT_PE);
+    return EXE_SUCCESS; // 0
+}
+
+/**
+ * @brief Calculates the size of a file.
+ *
+ * This function determines the total number of bytes in the file specified
+ * by the given path and stores the result in a provided variable.
+ *
+ * Example usage:
+ * @code
+ * size_t file_size = 0;
+ * int result = calculate_file_size("target.exe", &file_size);
+ * if (result == CFS_SUCCESS)
+ * {
+ *     printf("File size: %zu bytes\n", file_size);
+ * }
+ * else
+ * {
+ *     printf("Error calculating file size: %d\n", result);
+ * }
+ * @endcode
+ *
+ * @param [in] file_path Path to the file.
+ * @param [out] file_size Pointer to a variable to store the resulting file size.
+ * @return Error code from @ref Error_Codes_CFS.
+ */
+int calculate_file_size(const char *file_path, size_t *file_size)
+{
+    if (file_path == NULL)
+    {
+        return CFS_NULL_FILE_PATH_POINTER; // 1
+    }
+
+    if (file_size == NULL)
+    {
+        return CFS_NULL_FILE_SIZE_POINTER; // 2
+    }
+
+    // Declare all the variables:
+    long size;
+    FILE *file = fopen(file_path, "rb");
+
+    if (file == NULL)
+    {
+        return CFS_FILE_FOPEN_ERROR; // 3
+    }
+
+    if (fseek(file, 0, SEEK_END) != 0)
+    {
+        fclose(file);
+        return CFS_END_FSEEK_ERROR; // 4
+    }
+
+    size = ftell(file);
+
+    if (size == -1)
+    {
+        fclose(file);
+        return CFS_SIZE_FTELL_ERROR; // 5
+    }
+
+    *file_size = size;
+
+    if (fclose(file) != 0)
+    {
+        return CFS_FILE_FCLOSE_ERROR; // 6
+    }
+    return CFS_SUCCESS; // 0
+}
+
+/**
+ * @brief Scans a file for a virus signature at a specific offset.
+ *
+ * This function reads the file at the specified offset from the VirusSignature structure
+ * and compares the content against the known virus signature. The result is returned
+ * via the virus_flag parameter (1 = infected, 0 = clean).
+
+ * Example usage:
+ * @code
+ * VirusSignature vs;
+ * int virus_found = 0;
+ *
+ * if (scan_file("target.exe", &vs, &virus_found) != SF_SUCCESS) {
+ *     // Handle error
+ * }
+ *
+ * if (virus_found) {
+ *     printf("Virus detected: %s\n", vs.name);
+ * }
+ * @endcode
+ *
+ * @param [in] file_path Path to the file to scan (must not be NULL)
+ * @param [in] vs VirusSignature containing signature, offset and name (must not be NULL)
+ * @param [out] virus_flag Output flag for detection result (must not be NULL)
+ * @return SF_SUCCESS (0) on success, error code from @ref Error_Codes_SF on failure
+ */
+int scan_file(const char *file_path, VirusSignature *vs, int *virus_flag)
+{
+    if (file_path == NULL)
+    {
+        return SF_NULL_FILE_PATH_POINTER; // 1
+    }
+
+    if (vs == NULL)
+    {
+        return SF_NULL_VSTRUCT_POINTER; // 2
+    }
+
+    if (virus_flag == NULL)
+    {
+        return SF_NULL_VFLAG_POINTER; // 3
+    }
+
+    // Declare all the variables:
+    unsigned char buffer[MAX_SIGNATURE_LENGTH];
+    size_t element_size, elements_number;
+    int flag = 0; // flag for virus flag;
+    FILE *file;
+
+    file = fopen(file_path, "rb");
+    if (file == NULL)
+    {
+        return SF_FILE_FOPEN_ERROR; // 4
+    }
+
+    if (fseek(file, vs->offset, SEEK_SET) != 0)
+    {
+        fclose(file);
+        return SF_OFFSET_FSEEK_ERROR; // 14
+    }
+
+    element_size = sizeof(buffer[0]);
+    elements_number = sizeof(buffer)/sizeof(buffer[0]);
+
+    if (fread(buffer, element_size, elements_number, file) != elements_number)
+    {
+        fclose(file);
+        return SF_BUFFER_FREAD_ERROR; // 15
+    }
+    // if equal -> memcmp should be 0 -> virus in file -> file is not safe
+    if (memcmp(buffer, vs->signature, elements_number) == 0)
+    {
+        // if flag = 1 -> virus in file; else if flag = 0 -> virus not in file
+        flag = 1; // virus in file
+    }
+    //else flag = 0. This could be either an error in the memcmp function itself or the fact that there is no virus
+    if (fclose(file) != 0)
+    {
+        return SF_FILE_FCLOSE_ERROR; // 16
+    }
+
+    *virus_flag = flag;
+
+    return SF_SUCCESS; // 0
+}
+
+#ifndef _WIN32
+/**
+ * @brief Reads up to length bytes at the given offset, retrying short reads.
+ *
+ * @param [in] fd File descriptor to read from.
+ * @param [out] buffer Destination buffer.
+ * @param [in] length Number of bytes wanted.
+ * @param [in] offset File offset of the first byte.
+ * @param [out] got Number of bytes read (less than length only at end of file).
+ * @return 0 on success, -1 if pread() failed.
+ */
+static int pread_full(int fd, unsigned char *buffer, size_t length, off_t offset, size_t *got)
+{
+    // Declare all the variables:
+    ssize_t n;
+    size_t total = 0;
+
+    while (total < length)
+    {
+        n = pread(fd, buffer + total, length - total, offset + (off_t)total);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) // end of file
+        {
+            break;
+        }
+        total += (size_t)n;
+    }
+
+    *got = total;
+    return 0;
+}
+
+/**
+ * @brief Returns CLOCK_MONOTONIC time in nanoseconds (the clock of AvScanControl.deadline_ns).
+ */
+static uint64_t monotonic_ns(void)
+{
+    // Declare all the variables:
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief Token bucket limiting the reads of all scans of one engine.
+ *
+ * Both buckets may go into debt: a read is always granted, and the thread that
+ * made the debt waits until it is paid back, so concurrent scans queue up for
+ * the rate instead of retrying.
+ */
+struct IoLimiter
+{
+    uint64_t bytes_per_second; /**< Read bandwidth (0 = unlimited). */
+    uint64_t reads_per_second; /**< Read operations (0 = unlimited). */
+    double byte_tokens; /**< Bytes that may be read now (negative = debt). */
+    double read_tokens; /**< Reads that may be issued now (negative = debt). */
+    uint64_t last_ns; /**< Time of the last refill. */
+    pthread_mutex_t lock; /**< Protects the fields above. */
+};
+
+/**
+ * @brief Refills one bucket for the elapsed time, capped at IO_LIMIT_BURST_MS worth of tokens.
+ */
+static double io_bucket_refill(double tokens, uint64_t rate, double seconds)
+{
+    // Declare all the variables:
+    double burst = (double)rate * IO_LIMIT_BURST_MS / 1000.0;
+
+    tokens += (double)rate * seconds;
+    return (tokens > burst) ? burst : tokens;
+}
+
+/**
+ * @brief Charges one read of length bytes to the limiter.
+ *
+ * @param [in] limiter I/O limiter (NULL = unlimited).
+ * @param [in] length Number of bytes about to be read.
+ * @return Nanoseconds to wait before the read (0 if the limiter is not in debt).
+ */
+static uint64_t io_limiter_take(IoLimiter *limiter, size_t length)
+{
+    if (limiter == NULL)
+    {
+        return 0;
+    }
+
+    // Declare all the variables:
+    double wait = 0.0;
+    uint64_t now;
+
+    pthread_mutex_lock(&limiter->lock);
+    if (limiter->bytes_per_second != 0 || limiter->reads_per_second != 0)
+    {
+        now = monotonic_ns();
+        if (limiter->bytes_per_second != 0)
+        {
+            limiter->byte_tokens = io_bucket_refill(limiter->byte_tokens, limiter->bytes_per_second,
+                                                    (double)(now - limiter->last_ns) / 1e9);
+            limiter->byte_tokens -= (double)length;
+            if (limiter->byte_tokens < 0)
+            {
+                wait = -limiter->byte_tokens / (double)limiter->bytes_per_second;
+            }
+        }
+        if (limiter->reads_per_second != 0)
+        {
+            limiter->read_tokens = io_bucket_refill(limiter->read_tokens, limiter->reads_per_second,
+                                                    (double)(now - limiter->last_ns) / 1e9);
+            limiter->read_tokens -= 1.0;
+            if (limiter->read_tokens < 0 && -limiter->read_tokens / (double)limiter->reads_per_second > wait)
+            {
+                wait = -limiter->read_tokens / (double)limiter->reads_per_second;
+            }
+        }
+        limiter->last_ns = now;
+    }
+    pthread_mutex_unlock(&limiter->lock);
+
+    return (uint64_t)(wait * 1e9);
+}
+
+/**
+ * @brief pread_full() charged to the I/O limiter of a scan control.
+ *
+ * A throttled read sleeps in slices of IO_LIMIT_SLICE_MS; between them the calling
+ * thread runs the yield callback, and the wait ends early once the deadline passes,
+ * so throttling never delays more urgent work or a late verdict.
+ *
+ * @param [in] control Scan control (may be NULL).
+ * @param [in] calling_thread 1 if the yield callback may run on this thread.
+ * @param [in] fd File descriptor to read from.
+ * @param [out] buffer Destination buffer.
+ * @param [in] length Number of bytes wanted.
+ * @param [in] offset File offset of the first byte.
+ * @param [out] got Number of bytes read.
+ * @return 0 on success, -1 if pread() failed, 1 if the deadline passed while waiting.
+ */
+static int scan_pread(const ScanControl *control, int calling_thread, int fd, unsigned char *buffer, size_t length,
+                      off_t offset, size_t *got)
+{
+    // Declare all the variables:
+    struct timespec pause;
+    uint64_t end, now, slice;
+
+    if (control != NULL && control->limiter != NULL)
+    {
+        now = monotonic_ns();
+        end = now + io_limiter_take(control->limiter, length);
+        while (now < end)
+        {
+            if (calling_thread && control->yield != NULL)
+            {
+                control->yield(control->yield_arg);
+            }
+            now = monotonic_ns();
+            if (control->deadline_ns != 0 && now > control->deadline_ns)
+            {
+                return 1;
+            }
+            if (now >= end)
+            {
+                break;
+            }
+            slice = (end - now < IO_LIMIT_SLICE_MS * 1000000ull) ? end - now : IO_LIMIT_SLICE_MS * 1000000ull;
+            pause.tv_sec = (time_t)(slice / 1000000000u);
+            pause.tv_nsec = (long)(slice % 1000000000u);
+            nanosleep(&pause, NULL);
+            now = monotonic_ns();
+        }
+    }
+
+    return pread_full(fd, buffer, length, offset, got);
+}
+#endif
+
+#ifndef _WIN32
+/**
+ * @brief One recorded span: a phase of a scan, or a whole traced file.
+ */
+typedef struct
+{
+    uint64_t start_ns; /**< CLOCK_MONOTONIC time of the start. */
+    uint64_t end_ns; /**< CLOCK_MONOTONIC time of the end. */
+    uint64_t file_id; /**< Traced file the span belongs to (0 = none). */
+    uint64_t nested_ns; /**< File spans: time of the spans recorded inside it on the same thread. */
+    const char *name; /**< Phase name (static string), NULL for a file span. */
+    char file[TRACE_FILE_TAIL_LENGTH]; /**< File spans: end of the path. */
+} TraceEvent;
+
+/**
+ * @brief Ring of the last spans recorded by one thread.
+ *
+ * Only the owning thread writes a ring. It fills the slot first and then
+ * publishes it by advancing head with a release store, so av_trace_dump() reads
+ * rings without a lock and recording never waits. Rings are never freed: when a
+ * thread exits its ring is given back and the next new thread takes it over,
+ * so the worker threads started for every scan do not pile up rings.
+ */
+typedef struct TraceRing
+{
+    struct TraceRing *next; /**< Next ring of the list of all rings. */
+    atomic_int owned; /**< 1 while a thread records into the ring. */
+    unsigned index; /**< Number of the ring, the thread id of the trace. */
+    size_t capacity; /**< Number of slots. */
+    _Atomic uint64_t head; /**< Number of spans ever recorded; span n is in events[n % capacity]. */
+    TraceEvent events[]; /**< Slots. */
+} TraceRing;
+
+/**
+ * @brief A traced file open on the current thread.
+ */
+typedef struct
+{
+    uint64_t id; /**< Number of the file in the trace. */
+    uint64_t start_ns; /**< Start of the file span (0 = not traced). */
+    uint64_t nested_ns; /**< Time of the spans recorded inside it so far. */
+    char file[TRACE_FILE_TAIL_LENGTH]; /**< End of the path. */
+} TraceFile;
+
+static atomic_size_t trace_capacity; // slots of a new ring, 0 = tracing is off
+static _Atomic(TraceRing *) trace_rings; // all rings, newest first
+static atomic_uint trace_ring_count;
+static _Atomic uint64_t trace_file_count;
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key; // gives the ring back when its thread exits
+static int trace_key_flag;
+
+static _Thread_local TraceRing *trace_ring;
+static _Thread_local TraceFile trace_files[MAX_TRACE_FILE_DEPTH];
+static _Thread_local size_t trace_depth; // files deeper than MAX_TRACE_FILE_DEPTH are not traced
+static _Thread_local uint64_t trace_inherited; // file of the thread that started a range thread
+
+/**
+ * @brief Gives a ring back when its thread exits (pthread key destructor).
+ */
+static void trace_ring_release(void *ring)
+{
+    atomic_store_explicit(&((TraceRing *)ring)->owned, 0, memory_order_release);
+}
+
+/**
+ * @brief Creates the key that gives rings back (run once).
+ */
+static void trace_key_create(void)
+{
+    trace_key_flag = (pthread_key_create(&trace_key, trace_ring_release) == 0);
+}
+
+/**
+ * @brief Takes over a ring given back by an exited thread, or adds a new one to the list.
+ *
+ * @param [in] capacity Slots of a new ring.
+ * @return Ring of the calling thread, NULL if it could not be allocated.
+ */
+static TraceRing *trace_ring_acquire(size_t capacity)
+{
+    // Declare all the variables:
+    TraceRing *ring;
+    int expected;
+
+    pthread_once(&trace_key_once, trace_key_create);
+
+    for (ring = atomic_load_explicit(&trace_rings, memory_order_acquire); ring != NULL; ring = ring->next)
+    {
+        expected = 0;
+        if (atomic_compare_exchange_strong_explicit(&ring->owned, &expected, 1, memory_order_acquire,
+                                                    memory_order_relaxed))
+        {
+            break;
+        }
+    }
+
+    if (ring == NULL)
+    {
+        ring = malloc(sizeof(*ring) + capacity * sizeof(ring->events[0]));
+        if (ring == NULL)
+        {
+            return NULL;
+        }
+        atomic_init(&ring->owned, 1);
+        atomic_init(&ring->head, 0);
+        ring->index = atomic_fetch_add_explicit(&trace_ring_count, 1, memory_order_relaxed) + 1;
+        ring->capacity = capacity;
+        ring->next = atomic_load_explicit(&trace_rings, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&trace_rings, &ring->next, ring, memory_order_release,
+                                                      memory_order_relaxed));
+    }
+
+    if (trace_key_flag)
+    {
+        pthread_setspecific(trace_key, ring);
+    }
+    return ring;
+}
+
+/**
+ * @brief Returns the time to start a span with, or 0 when tracing is off.
+ */
+static uint64_t trace_now(void)
+{
+    return (atomic_load_explicit(&trace_capacity, memory_order_relaxed) != 0) ? monotonic_ns() : 0;
+}
+
+/**
+ * @brief Returns the traced file of the calling thread (0 = none).
+ */
+static uint64_t trace_current_file(void)
+{
+    if (trace_depth == 0)
+    {
+        return trace_inherited;
+    }
+    return trace_files[((trace_depth < MAX_TRACE_FILE_DEPTH) ? trace_depth : MAX_TRACE_FILE_DEPTH) - 1].id;
+}
+
+/**
+ * @brief Appends one span to the ring of the calling thread.
+ *
+ * @param [in] name Phase name (static string), NULL for a file span.
+ * @param [in] start_ns Start of the span.
+ * @param [in] end_ns End of the span.
+ * @param [in] file Traced file for a file span, NULL for a phase.
+ */
+static void trace_record(const char *name, uint64_t start_ns, uint64_t end_ns, const TraceFile *file)
+{
+    // Declare all the variables:
+    TraceEvent *event;
+    uint64_t head;
+    size_t capacity;
+
+    if (trace_ring == NULL)
+    {
+        capacity = atomic_load_explicit(&trace_capacity, memory_order_relaxed);
+        if (capacity == 0)
+        {
+            return;
+        }
+        trace_ring = trace_ring_acquire(capacity);
+        if (trace_ring == NULL)
+        {
+            return;
+        }
+    }
+
+    head = atomic_load_explicit(&trace_ring->head, memory_order_relaxed);
+    event = &trace_ring->events[head % trace_ring->capacity];
+    // The slot still holds span head - capacity: the store of head that made it stale must be
+    // visible before any byte of the new span (see trace_copy_rings())
+    atomic_thread_fence(memory_order_release);
+    event->start_ns = start_ns;
+    event->end_ns = end_ns;
+    event->name = name;
+    if (file != NULL)
+    {
+        event->file_id = file->id;
+        event->nested_ns = file->nested_ns;
+        memcpy(event->file, file->file, sizeof(event->file));
+    }
+    else
+    {
+        event->file_id = trace_current_file();
+        event->nested_ns = 0;
+        event->file[0] = '\0';
+    }
+    atomic_store_explicit(&trace_ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * @brief Records a phase that started at start_ns and ends now.
+ *
+ * @param [in] name Phase name (static string).
+ * @param [in] start_ns Value of trace_now() at the start (0 = tracing was off, nothing is recorded).
+ */
+static void trace_span(const char *name, uint64_t start_ns)
+{
+    if (start_ns == 0)
+    {
+        return;
+    }
+
+    // Declare all the variables:
+    uint64_t end_ns = monotonic_ns();
+
+    if (trace_depth > 0 && trace_depth <= MAX_TRACE_FILE_DEPTH)
+    {
+        trace_files[trace_depth - 1].nested_ns += end_ns - start_ns;
+    }
+    trace_record(name, start_ns, end_ns, NULL);
+}
+#endif
+
+/**
+ * @brief Scans an already open file descriptor against a signature base.
+ *
+ * Does the same work as read_file_header(), detect_file_type(), calculate_file_size()
+ * and scan_file() together, but never reopens the file by path: the descriptor may
+ * come from fanotify and the path may not even exist any more. Stops at the first
+ * match; see scan_fd_hits() for the whole list.
+ *
+ * Example usage:
+ * @code
+ * int fd = open("target.exe", O_RDONLY);
+ * int virus_flag;
+ * size_t index;
+ *
+ * if (scan_fd(fd, &sb, &virus_flag, &index) == SFD_SUCCESS && virus_flag)
+ * {
+ *     printf("Virus detected: %s\n", sb.signatures[index].virus_name);
+ * }
+ * @endcode
+ *
+ * @param [in] fd Open file descriptor (read access). The file offset is not changed.
+ * @param [in] sb Loaded signature base.
+ * @param [out] virus_flag 1 if a signature matched, 0 otherwise.
+ * @param [out] signature_index Index in sb->signatures of the first matched signature.
+ * @return Error code from @ref Error_Codes_SFD.
+ */
+int scan_fd(int fd, const SignatureBase *sb, int *virus_flag, size_t *signature_index)
+{
+    if (virus_flag == NULL)
+    {
+        return SFD_NULL_VFLAG_POINTER; // 3
+    }
+    if (signature_index == NULL)
+    {
+        return SFD_NULL_SINDEX_POINTER; // 4
+    }
+
+    // Declare all the variables:
+    ScanHits hits = {NULL, 0, 0};
+    int result;
+
+    *virus_flag = 0;
+    result = scan_fd_hits(fd, sb, 1, 1, NULL, NULL, &hits, NULL);
+    if (result == SFD_SUCCESS && hits.count > 0)
+    {
+        *virus_flag = 1;
+        *signature_index = hits.items[0].signature_index;
+    }
+    free_scan_hits(&hits);
+
+    return result;
+}
+
+/**
+ * @brief Reads a little-endian 16-bit value.
+ */
+static uint32_t read_le16(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+/**
+ * @brief Reads a little-endian 32-bit value.
+ */
+static uint32_t read_le32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * @brief Prepares byte statistics for a file.
+ *
+ * Clears all counters and, for PE files, reads the section table from the first
+ * page so that update_entropy_stats() can count the bytes of every section apart.
+ * When no two sections overlap, section bytes are counted once, into their section;
+ * finish_entropy_stats() adds the sections to the whole-file histogram.
+ * A missing or damaged PE header is not an error: only the whole-file statistics
+ * are kept then.
+ *
+ * @param [in] header First page of the file (see read_file_header()).
+ * @param [in] header_size Number of valid bytes in header.
+ * @param [out] stats Statistics to prepare.
+ * @return Error code from @ref Error_Codes_IES.
+ */
+int init_entropy_stats(const unsigned char *header, size_t header_size, EntropyStats *stats)
+{
+    if (header == NULL)
+    {
+        return IES_NULL_HEADER_POINTER; // 1
+    }
+    if (stats == NULL)
+    {
+        return IES_NULL_STATS_POINTER; // 2
+    }
+
+    // Declare all the variables:
+    const unsigned char *section;
+    const SectionStats *previous, *next;
+    size_t pe_offset, table, count, i, j;
+    unsigned char moved;
+
+    memset(stats, 0, sizeof(*stats));
+
+    // "MZ" ... e_lfanew at 0x3C -> "PE\0\0" + COFF header (20 bytes) + optional header + section table
+    if (header_size < 0x40 || header[0] != 'M' || header[1] != 'Z')
+    {
+        return IES_SUCCESS; // 0
+    }
+    pe_offset = read_le32(header + 0x3C);
+    if (pe_offset > header_size - 24 || memcmp(header + pe_offset, "PE\0\0", 4) != 0)
+    {
+        return IES_SUCCESS; // 0
+    }
+    count = read_le16(header + pe_offset + 6);
+    table = pe_offset + 24 + read_le16(header + pe_offset + 20);
+
+    for (i = 0; i < count && stats->section_count < MAX_PE_SECTIONS; i++)
+    {
+        if (table + (i + 1) * 40 > header_size) // section table outside the first page
+        {
+            break;
+        }
+        section = header + table + i * 40;
+
+        memcpy(stats->sections[stats->section_count].name, section, 8);
+        stats->sections[stats->section_count].name[8] = '\0';
+        stats->sections[stats->section_count].raw_size = read_le32(section + 16);
+        stats->sections[stats->section_count].raw_offset = read_le32(section + 20);
+        stats->sections[stats->section_count].characteristics = read_le32(section + 36);
+        stats->section_count++;
+    }
+
+    // Sections by raw offset (insertion sort, few entries); apart if each ends before the next starts
+    stats->apart_flag = (stats->section_count > 0);
+    for (i = 0; i < stats->section_count; i++)
+    {
+        moved = (unsigned char)i;
+        for (j = i; j > 0 && stats->sections[stats->order[j - 1]].raw_offset > stats->sections[moved].raw_offset; j--)
+        {
+            stats->order[j] = stats->order[j - 1];
+        }
+        stats->order[j] = moved;
+    }
+    for (i = 1; i < stats->section_count; i++)
+    {
+        previous = &stats->sections[stats->order[i - 1]];
+        next = &stats->sections[stats->order[i]];
+        if ((uint64_t)previous->raw_offset + previous->raw_size > next->raw_offset)
+        {
+            stats->apart_flag = 0;
+        }
+    }
+
+    return IES_SUCCESS; // 0
+}
+
+/**
+ * @brief Adds the byte counts of a buffer to a histogram.
+ *
+ * Word at a time: eight bytes are loaded at once and each goes to its own
+ * sub-histogram, so consecutive equal bytes (zero padding, for example) do not
+ * wait for each other's increment and the eight increments stay in flight at once.
+ * Byte order does not matter, as only the counts are kept. This takes the place
+ * of SIMD histogramming: vector units have no conflict-free scatter-increment
+ * (short of AVX-512CD), so a vector version is no faster than this and would need
+ * one code path per instruction set.
+ *
+ * Below HISTOGRAM_SPLIT_MIN bytes, clearing and summing the sub-histograms would
+ * cost more than the counting, so short buffers are counted byte by byte.
+ *
+ * @param [in,out] histogram Histogram to add to.
+ * @param [in] buffer Bytes to count.
+ * @param [in] length Number of bytes (below 2^32, the sub-histograms count in 32 bits).
+ */
+static void histogram_bytes(uint64_t histogram[256], const unsigned char *buffer, size_t length)
+{
+    // Declare all the variables:
+    uint32_t partial[8][256];
+    uint64_t word;
+    size_t i = 0, b;
+
+    if (length < HISTOGRAM_SPLIT_MIN)
+    {
+        for (; i < length; i++)
+        {
+            histogram[buffer[i]]++;
+        }
+        return;
+    }
+
+    memset(partial, 0, sizeof(partial));
+
+    for (; i + 8 <= length; i += 8)
+    {
+        memcpy(&word, buffer + i, sizeof(word));
+        partial[0][word & 0xFF]++;
+        partial[1][(word >> 8) & 0xFF]++;
+        partial[2][(word >> 16) & 0xFF]++;
+        partial[3][(word >> 24) & 0xFF]++;
+        partial[4][(word >> 32) & 0xFF]++;
+        partial[5][(word >> 40) & 0xFF]++;
+        partial[6][(word >> 48) & 0xFF]++;
+        partial[7][word >> 56]++;
+    }
+    for (; i < length; i++)
+    {
+        partial[0][buffer[i]]++;
+    }
+
+    for (b = 0; b < 256; b++)
+    {
+        histogram[b] += (uint64_t)partial[0][b] + partial[1][b] + partial[2][b] + partial[3][b] +
+                        partial[4][b] + partial[5][b] + partial[6][b] + partial[7][b];
+    }
+}
+
+/**
+ * @brief Counts the bytes of one chunk into the file and section histograms.
+ *
+ * Each byte is counted once when the sections do not overlap: section bytes into
+ * their section, the bytes between sections into the file histogram. Otherwise
+ * the whole chunk also goes to the file histogram.
+ *
+ * @param [in,out] stats Statistics prepared by init_entropy_stats().
+ * @param [in] buffer Chunk of the file.
+ * @param [in] length Number of bytes in the chunk (at most SCAN_CHUNK_SIZE).
+ * @param [in] file_offset File offset of buffer[0].
+ */
+static void update_entropy_stats(EntropyStats *stats, const unsigned char *buffer, size_t length, uint64_t file_offset)
+{
+    // Declare all the variables:
+    SectionStats *section;
+    uint64_t from, to, counted = file_offset;
+    size_t i;
+
+    if (!stats->apart_flag)
+    {
+        histogram_bytes(stats->histogram, buffer, length);
+    }
+    stats->bytes += length;
+
+    for (i = 0; i < stats->section_count; i++)
+    {
+        section = &stats->sections[stats->order[i]];
+        from = (section->raw_offset > file_offset) ? section->raw_offset : file_offset;
+        to = (uint64_t)section->raw_offset + section->raw_size;
+        if (to > file_offset + length)
+        {
+            to = file_offset + length;
+        }
+        if (from < to)
+        {
+            if (stats->apart_flag && from > counted) // bytes before the section belong to no section
+            {
+                histogram_bytes(stats->histogram, buffer + (counted - file_offset), (size_t)(from - counted));
+            }
+            histogram_bytes(section->histogram, buffer + (from - file_offset), (size_t)(to - from));
+            section->bytes += to - from;
+            counted = to;
+        }
+    }
+    if (stats->apart_flag && counted < file_offset + length)
+    {
+        histogram_bytes(stats->histogram, buffer + (counted - file_offset), (size_t)(file_offset + length - counted));
+    }
+}
+
+/**
+ * @brief Adds the counters of one statistics block to another with the same sections.
+ *
+ * @param [in,out] to Statistics to add to.
+ * @param [in] from Statistics to add.
+ */
+static void merge_entropy_stats(EntropyStats *to, const EntropyStats *from)
+{
+    // Declare all the variables:
+    size_t i, b;
+
+    for (b = 0; b < 256; b++)
+    {
+        to->histogram[b] += from->histogram[b];
+    }
+    to->bytes += from->bytes;
+
+    for (i = 0; i < to->section_count; i++)
+    {
+        for (b = 0; b < 256; b++)
+        {
+            to->sections[i].histogram[b] += from->sections[i].histogram[b];
+        }
+        to->sections[i].bytes += from->sections[i].bytes;
+    }
+}
+
+/**
+ * @brief Returns the Shannon entropy of a histogram in bits per byte.
+ *
+ * @param [in] histogram Byte counts.
+ * @param [in] total Sum of all counts.
+ */
+static double histogram_entropy(const uint64_t histogram[256], uint64_t total)
+{
+    // Declare all the variables:
+    double entropy = 0.0, p;
+    size_t b;
+
+    if (total == 0)
+    {
+        return 0.0;
+    }
+
+    for (b = 0; b < 256; b++)
+    {
+        if (histogram[b] != 0)
+        {
+            p = (double)histogram[b] / (double)total;
+            entropy -= p * log2(p);
+        }
+    }
+    return entropy;
+}
+
+/**
+ * @brief Computes entropies and decides whether the file looks packed.
+ *
+ * A PE file is flagged when one of its code sections (IMAGE_SCN_CNT_CODE or
+ * IMAGE_SCN_MEM_EXECUTE) of at least MIN_ENTROPY_BYTES bytes has an entropy of
+ * PACKED_ENTROPY_THRESHOLD or more: compiled code stays well below that, packed or
+ * encrypted code does not. Files without sections are judged by their whole-file entropy.
+ *
+ * @param [in,out] stats Statistics filled by scan_fd_floating().
+ */
+void finish_entropy_stats(EntropyStats *stats)
+{
+    if (stats == NULL)
+    {
+        return;
+    }
+
+    // Declare all the variables:
+    SectionStats *section;
+    size_t i, b;
+
+    if (stats->apart_flag) // section bytes are still missing from the file histogram
+    {
+        for (i = 0; i < stats->section_count; i++)
+        {
+            for (b = 0; b < 256; b++)
+            {
+                stats->histogram[b] += stats->sections[i].histogram[b];
+            }
+        }
+        stats->apart_flag = 0;
+    }
+
+    stats->entropy = histogram_entropy(stats->histogram, stats->bytes);
+    stats->packed_flag = 0;
+    stats->packed_section = stats->section_count;
+
+    for (i = 0; i < stats->section_count; i++)
+    {
+        section = &stats->sections[i];
+        section->entropy = histogram_entropy(section->histogram, section->bytes);
+
+        if (!stats->packed_flag && section->bytes >= MIN_ENTROPY_BYTES &&
+            (section->characteristics & (0x00000020u | 0x20000000u)) != 0 && // CNT_CODE | MEM_EXECUTE
+            section->entropy >= PACKED_ENTROPY_THRESHOLD)
+        {
+            stats->packed_flag = 1;
+            stats->packed_section = i;
+        }
+    }
+
+    if (stats->section_count == 0 && stats->bytes >= MIN_ENTROPY_BYTES &&
+        stats->entropy >= PACKED_ENTROPY_THRESHOLD)
+    {
+        stats->packed_flag = 1;
+    }
+}
+
+/**
+ * @brief Releases memory owned by a hits list.
+ *
+ * @param [in,out] hits Pointer to the hits list (may be NULL).
+ */
+void free_scan_hits(ScanHits *hits)
+{
+    if (hits == NULL)
+    {
+        return;
+    }
+
+    free(hits->items);
+    hits->items = NULL;
+    hits->count = 0;
+    hits->capacity = 0;
+}
+
+/**
+ * @brief Appends one match to a hits list.
+ *
+ * @param [in,out] hits Hits list.
+ * @param [in] signature_index Matched signature.
+ * @param [in] offset Offset of the match in the file.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+static int add_scan_hit(ScanHits *hits, size_t signature_index, uint64_t offset)
+{
+    // Declare all the variables:
+    ScanHit *grown;
+    size_t capacity;
+
+    if (hits->count == hits->capacity)
+    {
+        capacity = (hits->capacity == 0) ? 16 : hits->capacity * 2;
+        grown = realloc(hits->items, capacity * sizeof(*grown));
+        if (grown == NULL)
+        {
+            return -1;
+        }
+        hits->items = grown;
+        hits->capacity = capacity;
+    }
+
+    hits->items[hits->count].signature_index = signature_index;
+    hits->items[hits->count].offset = offset;
+    hits->count++;
+    return 0;
+}
+
+#ifdef AV_STATIC_SIGNATURES
+/**
+ * @def STATIC_SIGNATURE_WORD
+ * @brief Eight signature bytes as the 64-bit word memcpy() loads from them on this machine.
+ *
+ * Used by the matchers of the generated header: the compiler folds it to one constant.
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define STATIC_SIGNATURE_WORD(b0, b1, b2, b3, b4, b5, b6, b7) \
+    ((uint64_t)(b0) << 56 | (uint64_t)(b1) << 48 | (uint64_t)(b2) << 40 | (uint64_t)(b3) << 32 | \
+     (uint64_t)(b4) << 24 | (uint64_t)(b5) << 16 | (uint64_t)(b6) << 8 | (uint64_t)(b7))
+#else
+#define STATIC_SIGNATURE_WORD(b0, b1, b2, b3, b4, b5, b6, b7) \
+    ((uint64_t)(b7) << 56 | (uint64_t)(b6) << 48 | (uint64_t)(b5) << 40 | (uint64_t)(b4) << 32 | \
+     (uint64_t)(b3) << 24 | (uint64_t)(b2) << 16 | (uint64_t)(b1) << 8 | (uint64_t)(b0))
+#endif
+
+/**
+ * @def AV_STATIC_SIGNATURES_HEADER
+ * @brief Header written by gen_static_signatures (compiled-in signatures and their matchers).
+ */
+#ifndef AV_STATIC_SIGNATURES_HEADER
+#define AV_STATIC_SIGNATURES_HEADER "static_signatures.h"
+#endif
+#include AV_STATIC_SIGNATURES_HEADER
+#endif
+
+/**
+ * @brief Checks the Bloom filter of the floating anchors of one file type.
+ *
+ * @param [in] sb Signature base.
+ * @param [in] file_type Detected file type.
+ * @param [in] anchor Anchor of a file position (signature_anchor()).
+ * @return 1 if a signature may start with the anchor, 0 if none does.
+ */
+static int bloom_contains(const SignatureBase *sb, int file_type, uint32_t anchor)
+{
+    // Declare all the variables:
+    const uint64_t *bloom = sb->floating_blooms[file_type];
+    uint32_t bit1 = bloom_bit1(anchor, sb->floating_bloom_shifts[file_type]);
+    uint32_t bit2 = bloom_bit2(anchor, sb->floating_bloom_shifts[file_type]);
+
+    return (int)((bloom[bit1 >> 6] >> (bit1 & 63)) & (bloom[bit2 >> 6] >> (bit2 & 63)) & 1u);
+}
+
+/**
+ * @brief Compares the floating signatures sharing an anchor with the bytes at one position.
+ *
+ * The signatures are found by a binary search of the anchor in the sorted subset.
+ *
+ * @param [in] sb Signature base.
+ * @param [in] file_type Detected file type.
+ * @param [in] bytes Bytes of the file at the position (at least MAX_SIGNATURE_LENGTH).
+ * @param [in] anchor Anchor of the position.
+ * @param [in] offset File offset of the position.
+ * @param [in,out] hits Matches are appended here.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+static int match_anchor(const SignatureBase *sb, int file_type, const unsigned char *bytes, uint32_t anchor,
+                        uint64_t offset, ScanHits *hits)
+{
+    // Declare all the variables:
+    const size_t *indices = sb->floating_subsets[file_type];
+    const uint32_t *anchors = sb->floating_anchors[file_type];
+    size_t count = sb->floating_subset_sizes[file_type];
+    size_t low = 0, high = count, middle, i;
+
+    while (low < high) // first entry with this anchor
+    {
+        middle = low + (high - low) / 2;
+        if (anchors[middle] < anchor)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    for (i = low; i < count && anchors[i] == anchor; i++)
+    {
+        if (memcmp(bytes, sb->signatures[indices[i]].signature, MAX_SIGNATURE_LENGTH) == 0 &&
+            add_scan_hit(hits, indices[i], offset) != 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Searches floating signatures of one file type in a buffer.
+ *
+ * Only positions whose file offset is below owner_end are reported, so a match in
+ * the overlap between two ranges is found by exactly one of them. Positions closer
+ * than a signature length to the end of the buffer are left for the next chunk.
+ *
+ * A position is a candidate only if the Bloom filter of the 4-byte anchors may
+ * hold its first 4 bytes (two bit tests, about 1.4% false positives); only
+ * candidates go to match_anchor(), which compares the signatures sharing the
+ * anchor. On clean data almost every position stops at the filter, whatever the
+ * number of signatures. When few bytes start a signature, the first byte bitmap
+ * is tested before the filter: it rejects most positions on a well predicted branch.
+ *
+ * The compiled-in signatures of an AV_STATIC_SIGNATURES build are searched by the
+ * generated unrolled matcher instead, with the same results.
+ *
+ * @param [in] sb Signature base.
+ * @param [in] file_type Detected file type.
+ * @param [in] buffer Bytes of the file.
+ * @param [in] length Number of bytes in buffer.
+ * @param [in] base_offset File offset of buffer[0].
+ * @param [in] owner_end First file offset not owned by the caller.
+ * @param [in,out] hits Matches are appended here.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+static int match_floating(const SignatureBase *sb, int file_type, const unsigned char *buffer, size_t length,
+                          uint64_t base_offset, uint64_t owner_end, ScanHits *hits)
+{
+    // Declare all the variables:
+    const unsigned char *first_bytes = sb->floating_first_bytes[file_type];
+    size_t last, position, first_byte_count = 0, i;
+    uint32_t anchor;
+    unsigned char byte;
+
+    if (length < MAX_SIGNATURE_LENGTH)
+    {
+        return 0;
+    }
+    last = length - MAX_SIGNATURE_LENGTH;
+    if (owner_end <= base_offset)
+    {
+        return 0;
+    }
+    if (owner_end - base_offset <= last)
+    {
+        last = (size_t)(owner_end - base_offset) - 1;
+    }
+
+#ifdef AV_STATIC_SIGNATURES
+    if (sb->signatures == static_signature_base.signatures) // also for copies of the base
+    {
+        return static_match_floating(file_type, buffer, last, base_offset, hits);
+    }
+#endif
+
+    if (sb->floating_subset_sizes[file_type] == 0)
+    {
+        return 0;
+    }
+    for (i = 0; i < sizeof(sb->floating_first_bytes[file_type]); i++)
+    {
+        for (byte = first_bytes[i]; byte != 0; byte &= (unsigned char)(byte - 1))
+        {
+            first_byte_count++;
+        }
+    }
+
+    if (first_byte_count <= MAX_SPARSE_FIRST_BYTES)
+    {
+        for (position = 0; position <= last; position++)
+        {
+            byte = buffer[position];
+            if ((first_bytes[byte >> 3] & (1u << (byte & 7))) == 0) // no signature starts with this byte
+            {
+                continue;
+            }
+            anchor = signature_anchor(buffer + position);
+            if (bloom_contains(sb, file_type, anchor) &&
+                match_anchor(sb, file_type, buffer + position, anchor, base_offset + position, hits) != 0)
+            {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    for (position = 0; position <= last; position++)
+    {
+        anchor = signature_anchor(buffer + position);
+        if (bloom_contains(sb, file_type, anchor) && // no signature starts with these 4 bytes otherwise
+            match_anchor(sb, file_type, buffer + position, anchor, base_offset + position, hits) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Compares two matches by offset, then by signature (for qsort()).
+ */
+static int compare_scan_hits(const void *left, const void *right)
+{
+    // Declare all the variables:
+    const ScanHit *a = left, *b = right;
+
+    if (a->offset != b->offset)
+    {
+        return (a->offset < b->offset) ? -1 : 1;
+    }
+    if (a->signature_index != b->signature_index)
+    {
+        return (a->signature_index < b->signature_index) ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Matches of every atom of a signature base, as the rule conditions see them.
+ */
+typedef struct
+{
+    size_t first_atom; /**< Signature index of the first atom. */
+    const size_t *counts; /**< Number of matches of each atom. */
+    const size_t *starts; /**< Start of each atom's offsets in offsets. */
+    const uint64_t *offsets; /**< Match offsets, ascending per atom. */
+    uint64_t file_size; /**< Size of the scanned file. */
+    int file_type; /**< Detected file type. */
+} RuleMatches;
+
+/**
+ * @brief Returns the index of the first match of an atom at or after an offset (count if none).
+ */
+static size_t rule_lower_bound(const RuleMatches *matches, size_t atom, uint64_t offset)
+{
+    // Declare all the variables:
+    const uint64_t *offsets = matches->offsets + matches->starts[atom];
+    size_t low = 0, high = matches->counts[atom], middle;
+
+    while (low < high)
+    {
+        middle = low + (high - low) / 2;
+        if (offsets[middle] < offset)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/**
+ * @brief Computes the value of one node of a rule condition.
+ *
+ * Values are unsigned 64-bit numbers; conditions are 1 (true) or 0 (false). An
+ * offset of a match that does not exist is undefined: arithmetic on it stays
+ * undefined and any condition built on it is false.
+ *
+ * @param [in] rule Rule.
+ * @param [in] node Index of the node in rule->nodes.
+ * @param [in] matches Atom matches and file properties.
+ * @param [out] value Value of the node.
+ * @return 1 if the value is defined, 0 otherwise.
+ */
+static int evaluate_rule_node(const Rule *rule, size_t node, const RuleMatches *matches, uint64_t *value)
+{
+    // Declare all the variables:
+    const RuleNode *n = &rule->nodes[node];
+    size_t atom = (n->kind >= RN_FOUND && n->kind <= RN_IN) ? rule->atoms[n->atom] - matches->first_atom : 0;
+    uint64_t left = 0, right = 0;
+    size_t position, i;
+    int left_flag, right_flag;
+
+    *value = 0;
+    switch (n->kind)
+    {
+        case RN_NUMBER:
+            *value = n->value;
+            return 1;
+        case RN_FILESIZE:
+            *value = matches->file_size;
+            return 1;
+        case RN_FILETYPE:
+            *value = (uint64_t)matches->file_type;
+            return 1;
+        case RN_FOUND:
+            *value = (matches->counts[atom] > 0);
+            return 1;
+        case RN_COUNT:
+            *value = matches->counts[atom];
+            return 1;
+        case RN_OFFSET:
+            if (!evaluate_rule_node(rule, n->left, matches, &left) || left == 0 || left > matches->counts[atom])
+            {
+                return 0;
+            }
+            *value = matches->offsets[matches->starts[atom] + (size_t)left - 1];
+            return 1;
+        case RN_AT:
+            if (evaluate_rule_node(rule, n->left, matches, &left))
+            {
+                position = rule_lower_bound(matches, atom, left);
+                *value = (position < matches->counts[atom] &&
+                          matches->offsets[matches->starts[atom] + position] == left);
+            }
+            return 1;
+        case RN_IN:
+            if (evaluate_rule_node(rule, n->left, matches, &left) && evaluate_rule_node(rule, n->right, matches, &right))
+            {
+                position = rule_lower_bound(matches, atom, left);
+                *value = (position < matches->counts[atom] &&
+                          matches->offsets[matches->starts[atom] + position] <= right);
+            }
+            return 1;
+        case RN_OF:
+            for (i = 0, left = 0; i < rule->atom_count; i++)
+            {
+                left += (matches->counts[rule->atoms[i] - matches->first_atom] > 0);
+            }
+            *value = (left >= n->value);
+            return 1;
+        case RN_NOT:
+            *value = !(evaluate_rule_node(rule, n->left, matches, &left) && left != 0);
+            return 1;
+        case RN_AND:
+            *value = evaluate_rule_node(rule, n->left, matches, &left) && left != 0 &&
+                     evaluate_rule_node(rule, n->right, matches, &right) && right != 0;
+            return 1;
+        case RN_OR:
+            *value = (evaluate_rule_node(rule, n->left, matches, &left) && left != 0) ||
+                     (evaluate_rule_node(rule, n->right, matches, &right) && right != 0);
+            return 1;
+        default:
+            break;
+    }
+
+    // Arithmetic and comparisons: both operands are needed
+    left_flag = evaluate_rule_node(rule, n->left, matches, &left);
+    right_flag = evaluate_rule_node(rule, n->right, matches, &right);
+    switch (n->kind)
+    {
+        case RN_ADD:
+            *value = left + right;
+            return left_flag && right_flag;
+        case RN_SUB:
+            *value = left - right;
+            return left_flag && right_flag;
+        case RN_EQ: *value = left_flag && right_flag && left == right; return 1;
+        case RN_NE: *value = left_flag && right_flag && left != right; return 1;
+        case RN_LT: *value = left_flag && right_flag && left < right; return 1;
+        case RN_LE: *value = left_flag && right_flag && left <= right; return 1;
+        case RN_GT: *value = left_flag && right_flag && left > right; return 1;
+        case RN_GE: *value = left_flag && right_flag && left >= right; return 1;
+        default: return 0;
+    }
+}
+
+/**
+ * @brief Evaluates the rules of a signature base on the matches of one scan.
+ *
+ * The atom matches are taken out of hits (an atom is never reported on its own)
+ * and grouped per atom; then every rule of the file's type is evaluated once on
+ * them, without looking at the file again. A rule whose condition holds is
+ * appended to hits as a match of its entry, at the offset of its first atom match
+ * (0 if the condition needed none).
+ *
+ * @param [in] sb Signature base the scan ran on.
+ * @param [in] file_type Detected file type.
+ * @param [in] file_size Size of the scanned file.
+ * @param [in,out] hits Matches of the scan (atom matches of one atom in offset order).
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+static int apply_rules(const SignatureBase *sb, int file_type, uint64_t file_size, ScanHits *hits)
+{
+    if (sb->rule_count == 0)
+    {
+        return 0;
+    }
+
+    // Declare all the variables:
+    RuleMatches matches;
+    const Rule *rule;
+    size_t *counts, *starts, *filled;
+    uint64_t *offsets = NULL, offset, verdict;
+    size_t first_atom = sb->count - sb->atom_count;
+    size_t atom_hits = 0, kept = 0, atom, i, k;
+    int type, result = 0;
+
+    counts = calloc(3 * sb->atom_count + 1, sizeof(size_t));
+    if (counts == NULL)
+    {
+        return -1;
+    }
+    starts = counts + sb->atom_count;
+    filled = starts + sb->atom_count;
+
+    for (i = 0; i < hits->count; i++)
+    {
+        if (hits->items[i].signature_index >= first_atom)
+        {
+            counts[hits->items[i].signature_index - first_atom]++;
+            atom_hits++;
+        }
+    }
+    if (atom_hits > 0)
+    {
+        offsets = malloc(atom_hits * sizeof(*offsets));
+        if (offsets == NULL)
+        {
+            free(counts);
+            return -1;
+        }
+    }
+    for (atom = 1; atom < sb->atom_count; atom++)
+    {
+        starts[atom] = starts[atom - 1] + counts[atom - 1];
+    }
+
+    // Atom matches leave the list; the rest keeps its order
+    for (i = 0; i < hits->count; i++)
+    {
+        if (hits->items[i].signature_index >= first_atom)
+        {
+            atom = hits->items[i].signature_index - first_atom;
+            offsets[starts[atom] + filled[atom]++] = hits->items[i].offset;
+        }
+        else
+        {
+            hits->items[kept++] = hits->items[i];
+        }
+    }
+    hits->count = kept;
+
+    matches.first_atom = first_atom;
+    matches.counts = counts;
+    matches.starts = starts;
+    matches.offsets = offsets;
+    matches.file_size = file_size;
+    matches.file_type = file_type;
+
+    for (i = 0; i < sb->rule_count && result == 0; i++)
+    {
+        rule = &sb->rules[i];
+        type = sb->signatures[rule->signature_index].file_type;
+        if (type != file_type && type != FT_ANY)
+        {
+            continue;
+        }
+        if (!evaluate_rule_node(rule, rule->root, &matches, &verdict) || verdict == 0)
+        {
+            continue;
+        }
+
+        offset = UINT64_MAX;
+        for (k = 0; k < rule->atom_count; k++)
+        {
+            atom = rule->atoms[k] - first_atom;
+            if (counts[atom] > 0 && offsets[starts[atom]] < offset)
+            {
+                offset = offsets[starts[atom]];
+            }
+        }
+        result = add_scan_hit(hits, rule->signature_index, (offset == UINT64_MAX) ? 0 : offset);
+    }
+
+    free(offsets);
+    free(counts);
+    return result;
+}
+
+#ifndef _WIN32
+/**
+ * @brief One range of a file scanned by one thread with its own buffer and hits.
+ */
+typedef struct
+{
+    int fd; /**< Descriptor of the scanned file. */
+    const SignatureBase *sb; /**< Signature base (read only). */
+    int file_type; /**< Detected file type. */
+    uint64_t start; /**< First offset owned by the range. */
+    uint64_t end; /**< First offset not owned by the range. */
+    uint64_t file_size; /**< Size of the file. */
+    ScanHits hits; /**< Matches found in the range. */
+    EntropyStats *stats; /**< Byte statistics of the range (NULL if not collected). */
+    const ScanControl *control; /**< Deadline and yield callback (NULL if none). */
+    int first_hit; /**< 1 to stop at the first match of a floating signature (rule atoms do not count). */
+    atomic_int *stop; /**< Set once any range found such a match; every range stops at its next chunk. */
+    int calling_thread; /**< 1 if the range runs on the thread that called scan_fd_floating(). */
+    uint64_t trace_file; /**< Traced file of the calling thread, for the spans of the range (0 = none). */
+    int result; /**< Error code from @ref Error_Codes_SFF. */
+} RangeScan;
+
+/**
+ * @brief Scans one range in chunks; thread start routine.
+ *
+ * The range is read up to RANGE_OVERLAP bytes past its end, so a signature that
+ * starts inside the range is found even if it ends in the next one. The last
+ * RANGE_OVERLAP bytes of each chunk are carried to the front of the next chunk.
+ * Byte statistics are collected from the same chunks, counting only owned bytes.
+ *
+ * Before every chunk but the first, the calling thread runs the yield callback of
+ * the scan control (so more urgent work can run in between), and every thread
+ * abandons the range once the deadline has passed, keeping the matches found so
+ * far. Reads are charged to the I/O limiter of the control (see scan_pread()).
+ *
+ * With first_hit, a range that finds a floating signature raises the shared stop
+ * flag and every range ends before its next chunk. Rule atoms do not raise it:
+ * their rules can only be evaluated on a complete pass.
+ *
+ * @param [in,out] arg Pointer to the RangeScan.
+ * @return Always NULL; the outcome is in RangeScan.result.
+ */
+static void *scan_range(void *arg)
+{
+    // Declare all the variables:
+    RangeScan *job = arg;
+    unsigned char *buffer;
+    uint64_t position = job->start;
+    uint64_t read_end = job->end + RANGE_OVERLAP;
+    uint64_t span;
+    size_t carry = 0, want, got, length, found, i;
+    size_t first_atom = job->sb->count - job->sb->atom_count;
+    int result;
+
+    job->result = SFF_SUCCESS;
+    if (!job->calling_thread)
+    {
+        trace_inherited = job->trace_file;
+    }
+    if (read_end > job->file_size)
+    {
+        read_end = job->file_size;
+    }
+
+    buffer = malloc(SCAN_CHUNK_SIZE + RANGE_OVERLAP);
+    if (buffer == NULL)
+    {
+        job->result = SFF_HITS_MALLOC_ERROR; // 8
+        return NULL;
+    }
+
+    while (position < read_end)
+    {
+        if (job->first_hit && atomic_load_explicit(job->stop, memory_order_relaxed))
+        {
+            break;
+        }
+        if (job->control != NULL && position != job->start)
+        {
+            if (job->calling_thread && job->control->yield != NULL)
+            {
+                job->control->yield(job->control->yield_arg);
+            }
+            if (job->control->deadline_ns != 0 && monotonic_ns() > job->control->deadline_ns)
+            {
+                job->result = SFF_DEADLINE_EXPIRED; // 10
+                break;
+            }
+        }
+
+        want = (read_end - position < SCAN_CHUNK_SIZE) ? (size_t)(read_end - position) : SCAN_CHUNK_SIZE;
+        span = trace_now();
+        result = scan_pread(job->control, job->calling_thread, job->fd, buffer + carry, want, (off_t)position, &got);
+        trace_span("read", span);
+        switch (result)
+        {
+            case 0:
+            {
+                break;
+            }
+            case 1:
+            {
+                job->result = SFF_DEADLINE_EXPIRED; // 10
+                break;
+            }
+            default:
+            {
+                job->result = SFF_BUFFER_PREAD_ERROR; // 7
+                break;
+            }
+        }
+        if (job->result != SFF_SUCCESS)
+        {
+            break;
+        }
+        if (got == 0) // file shrank after fstat
+        {
+            break;
+        }
+
+        if (job->stats != NULL && position < job->end)
+        {
+            update_entropy_stats(job->stats, buffer + carry,
+                                 (job->end - position < got) ? (size_t)(job->end - position) : got, position);
+        }
+
+        length = carry + got;
+        if (job->sb->floating_subset_sizes[job->file_type] > 0)
+        {
+            found = job->hits.count;
+            span = trace_now();
+            result = match_floating(job->sb, job->file_type, buffer, length, position - carry, job->end, &job->hits);
+            trace_span("match", span);
+            if (result != 0)
+            {
+                job->result = SFF_HITS_MALLOC_ERROR; // 8
+                break;
+            }
+            for (i = found; job->first_hit && i < job->hits.count; i++)
+            {
+                if (job->hits.items[i].signature_index < first_atom) // a floating signature, not a rule atom
+                {
+                    atomic_store_explicit(job->stop, 1, memory_order_relaxed);
+                    break;
+                }
+            }
+        }
+
+        position += got;
+        carry = (length < RANGE_OVERLAP) ? length : RANGE_OVERLAP;
+        memmove(buffer, buffer + length - carry, carry);
+    }
+
+    free(buffer);
+    return NULL;
+}
+#endif
+
+/**
+ * @brief Searches floating signatures in a file, splitting it into ranges scanned in parallel.
+ *
+ * The file is cut into equal ranges (at least PARALLEL_SCAN_MIN_RANGE bytes each),
+ * one per thread. Neighbouring ranges overlap by RANGE_OVERLAP bytes (longest
+ * signature minus one) and every thread has its own chunk buffer and hits list.
+ * At the end the lists are merged, sorted by offset and deduplicated, so the result
+ * is the same as a single-threaded scan. If a thread cannot be started, its range
+ * is scanned by the calling thread.
+ *
+ * If stats is not NULL, byte histograms of the file and its PE sections are
+ * collected from the same chunks (per range, then summed), so the entropy triage
+ * costs no extra read. The file is read even without floating signatures then.
+ *
+ * With first_hit, all ranges stop at their next chunk once one of them found a
+ * floating signature; hits then holds what was found until then, rule atoms
+ * included, and stats is incomplete.
+ *
+ * With a scan control, the scan can be preempted and abandoned at chunk granularity:
+ * the yield callback runs on the calling thread between its chunks, and the scan
+ * fails with SFF_DEADLINE_EXPIRED once the deadline passes. hits then holds the
+ * matches found before the deadline and must be released as well.
+ *
+ * Example usage:
+ * @code
+ * ScanHits hits = {NULL, 0, 0};
+ * if (scan_fd_floating(fd, &sb, FT_UNKNOWN, 0, 0, NULL, &hits, NULL) == SFF_SUCCESS)
+ * {
+ *     printf("%zu matches\n", hits.count);
+ * }
+ * free_scan_hits(&hits);
+ * @endcode
+ *
+ * @param [in] fd Open file descriptor (read access). The file offset is not changed.
+ * @param [in] sb Loaded signature base.
+ * @param [in] file_type Detected file type; selects the floating subset.
+ * @param [in] first_hit 1 to stop once a floating signature matched, 0 to collect all matches.
+ * @param [in] threads Maximum number of threads (0 = one per online CPU).
+ * @param [in] control Deadline and yield callback (may be NULL).
+ * @param [out] hits Matches sorted by offset. Must be released with free_scan_hits(),
+ *                   also after SFF_DEADLINE_EXPIRED.
+ * @param [in,out] stats Statistics prepared by init_entropy_stats() (may be NULL).
+ *                       Call finish_entropy_stats() afterwards.
+ * @return Error code from @ref Error_Codes_SFF.
+ */
+int scan_fd_floating(int fd, const SignatureBase *sb, int file_type, int first_hit, size_t threads, const ScanControl *control, ScanHits *hits, EntropyStats *stats)
+{
+    if (fd < 0)
+    {
+        return SFF_INVALID_FILE; // 1
+    }
+    if (sb == NULL)
+    {
+        return SFF_NULL_SBASE_POINTER; // 2
+    }
+    if (hits == NULL)
+    {
+        return SFF_NULL_HITS_POINTER; // 3
+    }
+    if (file_type < 0 || file_type >= FT_ANY)
+    {
+        return SFF_INVALID_FILE_TYPE; // 4
+    }
+
+    hits->items = NULL;
+    hits->count = 0;
+    hits->capacity = 0;
+    if (sb->floating_subset_sizes[file_type] == 0 && stats == NULL) // nothing to search
+    {
+        return SFF_SUCCESS; // 0
+    }
+
+#ifdef _WIN32
+    (void)first_hit;
+    (void)threads;
+    (void)control;
+    return SFF_NOT_SUPPORTED; // 9
+#else
+    // Declare all the variables:
+    RangeScan *jobs;
+    pthread_t *ids;
+    unsigned char *started;
+    uint64_t size, range;
+    size_t ranges, i, j;
+    int result = SFF_SUCCESS;
+    atomic_int stop;
+    struct stat st;
+    long cpus;
+
+    if (fstat(fd, &st) != 0)
+    {
+        return SFF_FILE_FSTAT_ERROR; // 6
+    }
+    size = (uint64_t)st.st_size;
+
+    if (threads == 0)
+    {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0) ? (size_t)cpus : 1;
+    }
+    ranges = (size_t)((size + PARALLEL_SCAN_MIN_RANGE - 1) / PARALLEL_SCAN_MIN_RANGE);
+    if (ranges > threads)
+    {
+        ranges = threads;
+    }
+    if (ranges == 0)
+    {
+        ranges = 1;
+    }
+    range = (size + ranges - 1) / ranges;
+    atomic_init(&stop, 0);
+
+    jobs = calloc(ranges, sizeof(*jobs));
+    ids = calloc(ranges, sizeof(*ids));
+    started = calloc(ranges, sizeof(*started));
+    if (jobs == NULL || ids == NULL || started == NULL)
+    {
+        free(jobs);
+        free(ids);
+        free(started);
+        return SFF_HITS_MALLOC_ERROR; // 8
+    }
+
+    for (i = 0; i < ranges; i++)
+    {
+        jobs[i].fd = fd;
+        jobs[i].sb = sb;
+        jobs[i].file_type = file_type;
+        jobs[i].start = i * range;
+        jobs[i].end = (i + 1 == ranges) ? size : (i + 1) * range;
+        jobs[i].file_size = size;
+        jobs[i].control = control;
+        jobs[i].first_hit = first_hit;
+        jobs[i].stop = &stop;
+        jobs[i].calling_thread = (i == 0);
+        jobs[i].trace_file = trace_current_file();
+        if (stats != NULL)
+        {
+            jobs[i].stats = malloc(sizeof(EntropyStats));
+            if (jobs[i].stats == NULL)
+            {
+                result = SFF_HITS_MALLOC_ERROR; // 8
+                break;
+            }
+            memcpy(jobs[i].stats, stats, sizeof(EntropyStats));
+        }
+    }
+    if (result != SFF_SUCCESS)
+    {
+        for (i = 0; i < ranges; i++)
+        {
+            free(jobs[i].stats);
+        }
+        free(jobs);
+        free(ids);
+        free(started);
+        return result;
+    }
+
+    // Range 0 runs on the calling thread, the rest on their own threads
+    for (i = 1; i < ranges; i++)
+    {
+        started[i] = (pthread_create(&ids[i], NULL, scan_range, &jobs[i]) == 0);
+    }
+    scan_range(&jobs[0]);
+    for (i = 1; i < ranges; i++)
+    {
+        if (started[i])
+        {
+            pthread_join(ids[i], NULL);
+        }
+        else
+        {
+            jobs[i].calling_thread = 1;
+            scan_range(&jobs[i]);
+        }
+    }
+
+    // Merge: concatenate, sort by offset, drop duplicates; sum byte statistics.
+    // A missed deadline keeps the matches found before it.
+    for (i = 0; i < ranges; i++)
+    {
+        if (jobs[i].stats != NULL)
+        {
+            merge_entropy_stats(stats, jobs[i].stats);
+            free(jobs[i].stats);
+        }
+        if (jobs[i].result != SFF_SUCCESS && result == SFF_SUCCESS)
+        {
+            result = jobs[i].result;
+        }
+        for (j = 0; j < jobs[i].hits.count && (result == SFF_SUCCESS || result == SFF_DEADLINE_EXPIRED); j++)
+        {
+            if (add_scan_hit(hits, jobs[i].hits.items[j].signature_index, jobs[i].hits.items[j].offset) != 0)
+            {
+                result = SFF_HITS_MALLOC_ERROR; // 8
+            }
+        }
+        free_scan_hits(&jobs[i].hits);
+    }
+    free(jobs);
+    free(ids);
+    free(started);
+
+    if (result != SFF_SUCCESS && result != SFF_DEADLINE_EXPIRED)
+    {
+        free_scan_hits(hits);
+        return result;
+    }
+
+    if (hits->count > 1)
+    {
+        qsort(hits->items, hits->count, sizeof(hits->items[0]), compare_scan_hits);
+        for (i = 1, j = 1; i < hits->count; i++)
+        {
+            if (compare_scan_hits(&hits->items[i], &hits->items[j - 1]) != 0)
+            {
+                hits->items[j++] = hits->items[i];
+            }
+        }
+        hits->count = j;
+    }
+
+    return result; // 0, 10
+#endif
+}
+
+/**
+ * @brief Searches floating signatures in a file given by path.
+ *
+ * Opens the file and calls scan_fd_floating(); see there for details.
+ *
+ * @param [in] file_path Path to the file to scan.
+ * @param [in] sb Loaded signature base.
+ * @param [in] file_type Detected file type; selects the floating subset.
+ * @param [in] threads Maximum number of threads (0 = one per online CPU).
+ * @param [out] hits Matches sorted by offset. Must be released with free_scan_hits().
+ * @param [in,out] stats Statistics prepared by init_entropy_stats() (may be NULL).
+ * @return Error code from @ref Error_Codes_SFF.
+ */
+int scan_file_floating(const char *file_path, const SignatureBase *sb, int file_type, size_t threads, ScanHits *hits, EntropyStats *stats)
+{
+    if (file_path == NULL)
+    {
+        return SFF_INVALID_FILE; // 1
+    }
+    if (sb == NULL)
+    {
+        return SFF_NULL_SBASE_POINTER; // 2
+    }
+    if (hits == NULL)
+    {
+        return SFF_NULL_HITS_POINTER; // 3
+    }
+    if (file_type < 0 || file_type >= FT_ANY)
+    {
+        return SFF_INVALID_FILE_TYPE; // 4
+    }
+
+    hits->items = NULL;
+    hits->count = 0;
+    hits->capacity = 0;
+    if (sb->floating_subset_sizes[file_type] == 0 && stats == NULL) // nothing to search, don't even open the file
+    {
+        return SFF_SUCCESS; // 0
+    }
+
+#ifdef _WIN32
+    (void)threads;
+    return SFF_NOT_SUPPORTED; // 9
+#else
+    // Declare all the variables:
+    int fd, result;
+
+    fd = open(file_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return SFF_FILE_OPEN_ERROR; // 5
+    }
+
+    result = scan_fd_floating(fd, sb, file_type, 0, threads, NULL, hits, stats);
+    close(fd);
+    return result;
+#endif
+}
+/**
+ * @brief Removes the matches of rule atoms from a list of hits; the rest keeps its order.
+ *
+ * For scans that end before the rules can be evaluated.
+ *
+ * @param [in] sb Signature base the hits refer to.
+ * @param [in,out] hits Matches.
+ */
+static void drop_atom_hits(const SignatureBase *sb, ScanHits *hits)
+{
+    // Declare all the variables:
+    size_t first_atom = sb->count - sb->atom_count;
+    size_t i, kept = 0;
+
+    for (i = 0; i < hits->count; i++)
+    {
+        if (hits->items[i].signature_index < first_atom)
+        {
+            hits->items[kept++] = hits->items[i];
+        }
+    }
+    hits->count = kept;
+}
+
+/**
+ * @brief Scans an open file descriptor against a signature base and collects every match.
+ *
+ * The first page is read once and gives the file type. Fixed-offset signatures of
+ * that type are compared in the first page or read with pread(); floating signatures
+ * are then searched with scan_fd_floating(). With first_hit the scan stops at the
+ * first fixed-offset match, else at the chunk where a floating signature matched
+ * (rule atoms do not count); rules are only evaluated when no signature matched.
+ *
+ * If stats is not NULL and the file is a PE file, its byte statistics are collected
+ * from the same reads as the floating search and finished with finish_entropy_stats().
+ * For other files, and when the scan stopped early, stats is cleared.
+ *
+ * A scan control (see ScanControl) lets a long scan give way to more urgent work
+ * between chunks and gives it a deadline. A scan that misses it returns
+ * SFD_DEADLINE_EXPIRED with the signatures matched so far in hits (no rules, no
+ * atoms): any of them is a verdict, none is not. Every read is charged to its I/O limiter.
+ *
+ * @param [in] fd Open file descriptor (read access). The file offset is not changed.
+ * @param [in] sb Loaded signature base.
+ * @param [in] first_hit 1 to stop at the first match, 0 to collect all of them.
+ * @param [in] threads Maximum number of threads for floating signatures (0 = one per online CPU).
+ * @param [in] control Deadline and yield callback (may be NULL).
+ * @param [out] file_type Detected type id from @ref File_Types (may be NULL).
+ * @param [out] hits Fixed-offset matches in subset order, floating matches by offset, then matched rules.
+ *                   Must be released with free_scan_hits(), also after SFD_DEADLINE_EXPIRED.
+ * @param [out] stats Byte statistics of the file (may be NULL).
+ * @return Error code from @ref Error_Codes_SFD.
+ */
+int scan_fd_hits(int fd, const SignatureBase *sb, int first_hit, size_t threads, const ScanControl *control, int *file_type, ScanHits *hits, EntropyStats *stats)
+{
+    if (fd < 0)
+    {
+        return SFD_INVALID_FD; // 1
+    }
+    if (sb == NULL)
+    {
+        return SFD_NULL_SBASE_POINTER; // 2
+    }
+    if (hits == NULL)
+    {
+        return SFD_NULL_HITS_POINTER; // 9
+    }
+
+    hits->items = NULL;
+    hits->count = 0;
+    hits->capacity = 0;
+    if (stats != NULL)
+    {
+        memset(stats, 0, sizeof(*stats));
+    }
+
+#ifdef _WIN32
+    (void)first_hit;
+    (void)threads;
+    (void)control;
+    (void)file_type;
+    return SFD_NOT_SUPPORTED; // 7
+#else
+    // Declare all the variables:
+    unsigned char header[FILE_HEADER_PAGE_SIZE];
+    unsigned char buffer[MAX_SIGNATURE_LENGTH];
+    const VirusSignature *vs;
+    const unsigned char *window;
+    ScanHits floating = {NULL, 0, 0};
+    EntropyStats *collected = NULL;
+    size_t header_size = 0, got, length, i, signature_hits = 0;
+    int type = FT_UNKNOWN;
+    int result;
+    uint64_t span;
+    struct stat st;
+
+    if (control != NULL && control->deadline_ns != 0 && monotonic_ns() > control->deadline_ns) // waited too long
+    {
+        return SFD_DEADLINE_EXPIRED; // 11
+    }
+
+    if (fstat(fd, &st) != 0)
+    {
+        return SFD_FILE_FSTAT_ERROR; // 5
+    }
+
+    span = trace_now();
+    result = scan_pread(control, 1, fd, header, sizeof(header), 0, &header_size);
+    trace_span("header", span);
+    if (result != 0)
+    {
+        return (result > 0) ? SFD_DEADLINE_EXPIRED : SFD_BUFFER_PREAD_ERROR; // 11 : 6
+    }
+
+    detect_file_type(header, header_size, &type);
+    if (file_type != NULL)
+    {
+        *file_type = type;
+    }
+
+    for (i = 0; i < sb->subset_sizes[type]; i++)
+    {
+        vs = &sb->signatures[sb->subsets[type][i]];
+        length = sizeof(vs->signature) / sizeof(vs->signature[0]);
+
+        if (vs->offset == SIGNATURE_ANY_OFFSET) // floating, searched below
+        {
+            continue;
+        }
+        if (vs->offset + length > (size_t)st.st_size) // signature can't be in file
+        {
+            continue;
+        }
+
+        if (vs->offset + length <= header_size) // already in the first page
+        {
+            window = header + vs->offset;
+        }
+        else
+        {
+            span = trace_now();
+            result = scan_pread(control, 1, fd, buffer, length, (off_t)vs->offset, &got);
+            trace_span("read", span);
+            if (result > 0) // late: keep the matches found so far
+            {
+                return SFD_DEADLINE_EXPIRED; // 11
+            }
+            if (result != 0)
+            {
+                free_scan_hits(hits);
+                return SFD_BUFFER_PREAD_ERROR; // 6
+            }
+            if (got != length) // file shrank after fstat
+            {
+                continue;
+            }
+            window = buffer;
+        }
+
+        if (memcmp(window, vs->signature, length) == 0)
+        {
+            if (add_scan_hit(hits, sb->subsets[type][i], vs->offset) != 0)
+            {
+                free_scan_hits(hits);
+                return SFD_HITS_MALLOC_ERROR; // 10
+            }
+            if (first_hit)
+            {
+                return SFD_SUCCESS; // 0
+            }
+        }
+    }
+
+    if (stats != NULL && type == FT_PE && init_entropy_stats(header, header_size, stats) == IES_SUCCESS)
+    {
+        collected = stats;
+    }
+
+    if (sb->floating_subset_sizes[type] > 0 || collected != NULL)
+    {
+        result = scan_fd_floating(fd, sb, type, first_hit, threads, control, &floating, collected);
+        if (result != SFF_SUCCESS && result != SFF_DEADLINE_EXPIRED)
+        {
+            free_scan_hits(hits);
+            return SFD_FLOATING_SCAN_ERROR; // 8
+        }
+
+        if (hits->count == 0) // usual case: take the floating list as it is
+        {
+            *hits = floating;
+        }
+        else
+        {
+            for (i = 0; i < floating.count; i++)
+            {
+                if (add_scan_hit(hits, floating.items[i].signature_index, floating.items[i].offset) != 0)
+                {
+                    free_scan_hits(&floating);
+                    free_scan_hits(hits);
+                    return SFD_HITS_MALLOC_ERROR; // 10
+                }
+            }
+            free_scan_hits(&floating);
+        }
+
+        for (i = 0; first_hit && i < hits->count; i++)
+        {
+            signature_hits += (hits->items[i].signature_index < sb->count - sb->atom_count);
+        }
+        if (result == SFF_DEADLINE_EXPIRED || signature_hits > 0) // stopped early: rules lack atom matches
+        {
+            drop_atom_hits(sb, hits);
+            if (stats != NULL)
+            {
+                memset(stats, 0, sizeof(*stats));
+            }
+            return (result == SFF_DEADLINE_EXPIRED) ? SFD_DEADLINE_EXPIRED : SFD_SUCCESS; // 11 : 0
+        }
+
+        finish_entropy_stats(collected);
+    }
+
+    span = (sb->rule_count > 0) ? trace_now() : 0;
+    result = apply_rules(sb, type, (uint64_t)st.st_size, hits);
+    trace_span("rules", span);
+    if (result != 0)
+    {
+        free_scan_hits(hits);
+        return SFD_HITS_MALLOC_ERROR; // 10
+    }
+    return SFD_SUCCESS; // 0
+#endif
+}
+
+/**
+ * @brief Copies bytes at a stream offset out of scattered buffers.
+ *
+ * @param [in] iov Segments of the stream.
+ * @param [in] iovcnt Number of segments.
+ * @param [in] offset Stream offset of the first byte.
+ * @param [out] destination Copied bytes.
+ * @param [in] length Number of bytes wanted.
+ * @return Number of bytes copied (less than length only at the end of the stream).
+ */
+static size_t iovec_gather(const struct iovec *iov, size_t iovcnt, uint64_t offset, unsigned char *destination, size_t length)
+{
+    // Declare all the variables:
+    uint64_t base = 0;
+    size_t copied = 0, skip, part, i;
+
+    for (i = 0; i < iovcnt && copied < length; i++)
+    {
+        if (base + iov[i].iov_len > offset + copied)
+        {
+            skip = (size_t)(offset + copied - base);
+            part = iov[i].iov_len - skip;
+            if (part > length - copied)
+            {
+                part = length - copied;
+            }
+            memcpy(destination + copied, (const unsigned char *)iov[i].iov_base + skip, part);
+            copied += part;
+        }
+        base += iov[i].iov_len;
+    }
+
+    return copied;
+}
+
+/**
+ * @brief Scans scattered buffers as one stream and collects every match.
+ *
+ * Same stages and results as scan_fd_hits(), but on memory the caller already
+ * holds in pieces (a readv()/recvmsg() iovec, a mail attachment in MIME parts...):
+ * nothing is read, joined or written to disk. Only the first page is copied when
+ * it spans segments, and the few bytes of a signature that crosses a segment border.
+ *
+ * Floating signatures are searched segment by segment on the calling thread. The
+ * last RANGE_OVERLAP bytes seen are kept in a small carry buffer and joined with
+ * the head of the next segment, so a match spanning any number of segments
+ * (even shorter than a signature) is found exactly once, and in offset order.
+ *
+ * @param [in] iov Segments of the stream, in order (segments may be empty).
+ * @param [in] iovcnt Number of segments.
+ * @param [in] sb Loaded signature base.
+ * @param [in] first_hit 1 to stop at the first match, 0 to collect all of them.
+ * @param [out] file_type Detected type id from @ref File_Types (may be NULL).
+ * @param [out] hits Fixed-offset matches in subset order, floating matches by offset, then matched rules.
+ *                   Offsets are stream offsets. Must be released with free_scan_hits().
+ * @param [out] stats Byte statistics of the stream, PE files only (may be NULL).
+ * @return Error code from @ref Error_Codes_SBH.
+ */
+int scan_iovec_hits(const struct iovec *iov, size_t iovcnt, const SignatureBase *sb, int first_hit, int *file_type, ScanHits *hits, EntropyStats *stats)
+{
+    if (iov == NULL && iovcnt > 0)
+    {
+        return SBH_NULL_BUFFER_POINTER; // 1
+    }
+    if (sb == NULL)
+    {
+        return SBH_NULL_SBASE_POINTER; // 2
+    }
+    if (hits == NULL)
+    {
+        return SBH_NULL_HITS_POINTER; // 3
+    }
+
+    // Declare all the variables:
+    unsigned char header_copy[FILE_HEADER_PAGE_SIZE];
+    unsigned char buffer[MAX_SIGNATURE_LENGTH];
+    unsigned char carry[2 * RANGE_OVERLAP];
+    const unsigned char *header, *segment, *window;
+    const VirusSignature *vs;
+    uint64_t size = 0, base, carry_base = 0;
+    size_t header_size, carry_length = 0, length, i, done, part;
+    int type = FT_UNKNOWN;
+
+    hits->items = NULL;
+    hits->count = 0;
+    hits->capacity = 0;
+    if (stats != NULL)
+    {
+        memset(stats, 0, sizeof(*stats));
+    }
+
+    for (i = 0; i < iovcnt; i++)
+    {
+        if (iov[i].iov_base == NULL && iov[i].iov_len > 0)
+        {
+            return SBH_NULL_BUFFER_POINTER; // 1
+        }
+        size += iov[i].iov_len;
+    }
+
+    // First page: straight from the first segment if it holds it, else joined
+    header_size = (size < FILE_HEADER_PAGE_SIZE) ? (size_t)size : FILE_HEADER_PAGE_SIZE;
+    if (iovcnt > 0 && iov[0].iov_len >= header_size)
+    {
+        header = iov[0].iov_base;
+    }
+    else
+    {
+        iovec_gather(iov, iovcnt, 0, header_copy, header_size);
+        header = header_copy;
+    }
+
+    if (header_size > 0)
+    {
+        detect_file_type(header, header_size, &type);
+    }
+    if (file_type != NULL)
+    {
+        *file_type = type;
+    }
+
+    for (i = 0; i < sb->subset_sizes[type]; i++)
+    {
+        vs = &sb->signatures[sb->subsets[type][i]];
+        length = sizeof(vs->signature) / sizeof(vs->signature[0]);
+
+        if (vs->offset == SIGNATURE_ANY_OFFSET || vs->offset + length > size) // floating, or can't be in file
+        {
+            continue;
+        }
+
+        if (vs->offset + length <= header_size) // already in the first page
+        {
+            window = header + vs->offset;
+        }
+        else
+        {
+            iovec_gather(iov, iovcnt, vs->offset, buffer, length);
+            window = buffer;
+        }
+
+        if (memcmp(window, vs->signature, length) == 0)
+        {
+            if (add_scan_hit(hits, sb->subsets[type][i], vs->offset) != 0)
+            {
+                free_scan_hits(hits);
+                return SBH_HITS_MALLOC_ERROR; // 4
+            }
+            if (first_hit)
+            {
+                return SBH_SUCCESS; // 0
+            }
+        }
+    }
+
+    if (stats != NULL && type == FT_PE)
+    {
+        init_entropy_stats(header, header_size, stats);
+    }
+    else
+    {
+        stats = NULL;
+    }
+
+    if (sb->floating_subset_sizes[type] == 0 && stats == NULL)
+    {
+        if (apply_rules(sb, type, size, hits) != 0) // rules on file size and type alone
+        {
+            free_scan_hits(hits);
+            return SBH_HITS_MALLOC_ERROR; // 4
+        }
+        return SBH_SUCCESS; // 0
+    }
+
+    // Invariant: every position before carry_base has been searched; carry holds the
+    // (at most RANGE_OVERLAP) bytes from carry_base on, which still lack a full window.
+    for (i = 0, base = 0; i < iovcnt; base += iov[i].iov_len, i++)
+    {
+        segment = iov[i].iov_base;
+        length = iov[i].iov_len;
+        if (length == 0)
+        {
+            continue;
+        }
+
+        for (done = 0; stats != NULL && done < length; done += part) // histogram_bytes() counts in 32 bits
+        {
+            part = (length - done < SCAN_CHUNK_SIZE) ? length - done : SCAN_CHUNK_SIZE;
+            update_entropy_stats(stats, segment + done, part, base + done);
+        }
+
+        if (sb->floating_subset_sizes[type] == 0)
+        {
+            continue;
+        }
+
+        if (length < RANGE_OVERLAP) // short segment: grow the carry, search what became complete
+        {
+            memcpy(carry + carry_length, segment, length);
+            carry_length += length;
+            if (carry_length > RANGE_OVERLAP)
+            {
+                part = carry_length - RANGE_OVERLAP;
+                if (match_floating(sb, type, carry, carry_length, carry_base, carry_base + part, hits) != 0)
+                {
+                    free_scan_hits(hits);
+                    return SBH_HITS_MALLOC_ERROR; // 4
+                }
+                memmove(carry, carry + part, RANGE_OVERLAP);
+                carry_length = RANGE_OVERLAP;
+                carry_base += part;
+            }
+            continue;
+        }
+
+        // Positions still in the carry, completed by the head of this segment, then the segment itself
+        memcpy(carry + carry_length, segment, RANGE_OVERLAP);
+        if (match_floating(sb, type, carry, carry_length + RANGE_OVERLAP, carry_base, base, hits) != 0 ||
+            match_floating(sb, type, segment, length, base, base + length, hits) != 0)
+        {
+            free_scan_hits(hits);
+            return SBH_HITS_MALLOC_ERROR; // 4
+        }
+        memcpy(carry, segment + length - RANGE_OVERLAP, RANGE_OVERLAP);
+        carry_length = RANGE_OVERLAP;
+        carry_base = base + length - RANGE_OVERLAP;
+    }
+
+    finish_entropy_stats(stats);
+    if (apply_rules(sb, type, size, hits) != 0)
+    {
+        free_scan_hits(hits);
+        return SBH_HITS_MALLOC_ERROR; // 4
+    }
+    return SBH_SUCCESS; // 0
+}
+
+/**
+ * @brief Scans bytes in memory against a signature base and collects every match.
+ *
+ * A single-segment scan_iovec_hits(): nothing is read, copied or written to disk.
+ *
+ * @param [in] buffer Contents of the file (may be NULL if size is 0).
+ * @param [in] size Number of bytes in buffer.
+ * @param [in] sb Loaded signature base.
+ * @param [in] first_hit 1 to stop at the first match, 0 to collect all of them.
+ * @param [out] file_type Detected type id from @ref File_Types (may be NULL).
+ * @param [out] hits Fixed-offset matches in subset order, floating matches by offset, then matched rules.
+ *                   Must be released with free_scan_hits().
+ * @param [out] stats Byte statistics of the buffer, PE files only (may be NULL).
+ * @return Error code from @ref Error_Codes_SBH.
+ */
+int scan_buffer_hits(const unsigned char *buffer, size_t size, const SignatureBase *sb, int first_hit, int *file_type, ScanHits *hits, EntropyStats *stats)
+{
+    // Declare all the variables:
+    struct iovec segment;
+
+    segment.iov_base = (void *)buffer; // only read
+    segment.iov_len = size;
+
+    return scan_iovec_hits(&segment, 1, sb, first_hit, file_type, hits, stats);
+}
+
+/**
+ * @brief Signature base of an engine, shared by the scans that started while it was current.
+ */
+typedef struct
+{
+    SignatureBase sb; /**< Loaded signatures. */
+    size_t references; /**< Running scans, plus 1 while this is the engine's current base. */
+    int static_flag; /**< 1 if sb is the compiled-in static_signature_base (never freed). */
+} EngineBase;
+
+#ifdef __linux__
+/**
+ * @brief NUMA nodes of the machine and their CPUs, read from NUMA_SYSFS_PATH.
+ */
+typedef struct
+{
+    size_t node_count; /**< Number of nodes with CPUs. */
+    cpu_set_t cpus[MAX_NUMA_NODES]; /**< CPUs of each node. */
+} NumaTopology;
+#endif
+
+/**
+ * @brief Scanning engine behind the opaque AvEngine handle.
+ *
+ * av_engine_load() swaps the current base under the lock; a scan takes a reference
+ * to the current base and runs without the lock, so a reload never waits for scans
+ * and scans never wait for a reload. The old base is freed by its last user.
+ *
+ * With a NUMA topology (av_engine_set_numa()), the base is loaded once per node by
+ * a thread running on that node, so each replica lives in node-local memory, and
+ * a scan takes the replica of the node it runs on.
+ */
+struct AvEngine
+{
+    EngineBase *current[MAX_NUMA_NODES]; /**< Bases used by new scans, one per node (NULL until av_engine_load()). */
+#ifdef _WIN32
+    CRITICAL_SECTION lock; /**< Protects current and the reference counts. */
+#else
+    pthread_mutex_t lock; /**< Protects current and the reference counts. */
+    IoLimiter limiter; /**< I/O budget of scans with AV_SCAN_IO_LIMIT. */
+#endif
+#ifdef __linux__
+    NumaTopology *topology; /**< NUMA nodes (NULL = one base for the whole machine). */
+#endif
+};
+
+/**
+ * @brief Locks the engine.
+ */
+static void engine_lock(AvEngine *engine)
+{
+#ifdef _WIN32
+    EnterCriticalSection(&engine->lock);
+#else
+    pthread_mutex_lock(&engine->lock);
+#endif
+}
+
+/**
+ * @brief Unlocks the engine.
+ */
+static void engine_unlock(AvEngine *engine)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(&engine->lock);
+#else
+    pthread_mutex_unlock(&engine->lock);
+#endif
+}
+
+/**
+ * @brief Returns the NUMA node the calling thread runs on (0 without a topology).
+ *
+ * @param [in] engine Engine.
+ */
+static size_t engine_node(const AvEngine *engine)
+{
+#ifdef __linux__
+    // Declare all the variables:
+    size_t node;
+    int cpu;
+
+    if (engine->topology == NULL)
+    {
+        return 0;
+    }
+    cpu = sched_getcpu();
+    for (node = 0; cpu >= 0 && node < engine->topology->node_count; node++)
+    {
+        if (CPU_ISSET(cpu, &engine->topology->cpus[node]))
+        {
+            return node;
+        }
+    }
+#else
+    (void)engine;
+#endif
+    return 0;
+}
+
+/**
+ * @brief Takes a reference to the current signature base (the replica of the caller's NUMA node).
+ *
+ * @param [in] engine Engine.
+ * @return Current base, or NULL if no base is loaded.
+ */
+static EngineBase *engine_acquire(AvEngine *engine)
+{
+    // Declare all the variables:
+    size_t node = engine_node(engine);
+    EngineBase *base;
+
+    engine_lock(engine);
+    base = engine->current[node];
+    if (base == NULL) // topology set after the last load
+    {
+        base = engine->current[0];
+    }
+    if (base != NULL)
+    {
+        base->references++;
+    }
+    engine_unlock(engine);
+
+    return base;
+}
+
+/**
+ * @brief Drops a reference to a signature base, freeing it with the last one.
+ *
+ * @param [in] engine Engine the base belongs to.
+ * @param [in] base Base returned by engine_acquire() (or the replaced current base).
+ */
+static void engine_release(AvEngine *engine, EngineBase *base)
+{
+    // Declare all the variables:
+    size_t references;
+
+    engine_lock(engine);
+    references = --base->references;
+    engine_unlock(engine);
+
+    if (references == 0)
+    {
+        if (!base->static_flag)
+        {
+            free_signature_base(&base->sb);
+        }
+        free(base);
+    }
+}
+
+/**
+ * @brief Converts a read_signature_base() error code to a library error code.
+ */
+static int av_error_from_rsb(int result)
+{
+    switch (result)
+    {
+        case RSB_SUCCESS: return AV_SUCCESS;
+        case RSB_FILE_FOPEN_ERROR: return AV_SIGNATURE_FOPEN_ERROR;
+        case RSB_LINE_PARSE_ERROR: return AV_SIGNATURE_PARSE_ERROR;
+        case RSB_RULE_PARSE_ERROR: return AV_SIGNATURE_PARSE_ERROR;
+        case RSB_BASE_MALLOC_ERROR: return AV_MALLOC_ERROR;
+        case RSB_EMPTY_BASE: return AV_SIGNATURE_EMPTY;
+        case RSB_FILE_FCLOSE_ERROR: return AV_SIGNATURE_READ_ERROR;
+        case RSB_LINE_FGETS_ERROR: return AV_SIGNATURE_READ_ERROR;
+        default: return AV_NULL_ARGUMENT_POINTER;
+    }
+}
+
+/**
+ * @brief Converts a scan_fd_hits() error code to a library error code.
+ */
+static int av_error_from_sfd(int result)
+{
+    switch (result)
+    {
+        case SFD_SUCCESS: return AV_SUCCESS;
+        case SFD_INVALID_FD: return AV_INVALID_FD;
+        case SFD_HITS_MALLOC_ERROR: return AV_MALLOC_ERROR;
+        case SFD_NOT_SUPPORTED: return AV_NOT_SUPPORTED;
+        case SFD_FILE_FSTAT_ERROR: return AV_FILE_READ_ERROR;
+        case SFD_BUFFER_PREAD_ERROR: return AV_FILE_READ_ERROR;
+        case SFD_FLOATING_SCAN_ERROR: return AV_FILE_READ_ERROR;
+        case SFD_DEADLINE_EXPIRED: return AV_DEADLINE_EXPIRED;
+        default: return AV_NULL_ARGUMENT_POINTER;
+    }
+}
+
+/**
+ * @brief Fills a scan result from the hits and statistics of one scan.
+ *
+ * Virus names are copied, so the result stays valid after the engine is reloaded.
+ *
+ * @param [in] sb Signature base the scan ran on.
+ * @param [in] file_type Detected file type.
+ * @param [in] hits Matches.
+ * @param [in] stats Finished byte statistics (may be NULL).
+ * @param [out] result Result to fill (cleared by the caller).
+ * @return AV_SUCCESS or AV_MALLOC_ERROR.
+ */
+static int fill_scan_result(const SignatureBase *sb, int file_type, const ScanHits *hits, const EntropyStats *stats,
+                            AvScanResult *result)
+{
+    // Declare all the variables:
+    const VirusSignature *vs;
+    size_t i;
+
+    result->file_type = file_type;
+
+    if (hits->count > 0)
+    {
+        result->hits = calloc(hits->count, sizeof(*result->hits));
+        if (result->hits == NULL)
+        {
+            return AV_MALLOC_ERROR;
+        }
+        for (i = 0; i < hits->count; i++)
+        {
+            vs = &sb->signatures[hits->items[i].signature_index];
+            memcpy(result->hits[i].virus_name, vs->virus_name, sizeof(result->hits[i].virus_name));
+            result->hits[i].offset = hits->items[i].offset;
+            result->hits[i].floating_flag = (vs->offset == SIGNATURE_ANY_OFFSET);
+        }
+        result->hit_count = hits->count;
+    }
+
+    if (stats != NULL && stats->packed_flag)
+    {
+        result->packed_flag = 1;
+        if (stats->packed_section < stats->section_count)
+        {
+            result->packed_entropy = stats->sections[stats->packed_section].entropy;
+            memcpy(result->packed_section, stats->sections[stats->packed_section].name, sizeof(result->packed_section));
+        }
+        else
+        {
+            result->packed_entropy = stats->entropy;
+        }
+    }
+
+    return AV_SUCCESS;
+}
+
+/**
+ * @brief Creates a scanning engine without signatures.
+ *
+ * In an AV_STATIC_SIGNATURES build the engine starts with the compiled-in signatures
+ * instead, so it can scan without av_engine_load() (which may still replace them).
+ *
+ * Example usage:
+ * @code
+ * AvEngine *engine;
+ * AvScanResult result;
+ *
+ * if (av_engine_create(&engine) == AV_SUCCESS && av_engine_load(engine, "signature.txt") == AV_SUCCESS &&
+ *     av_scan_path(engine, "upload.bin", AV_SCAN_FIRST_HIT, &result) == AV_SUCCESS)
+ * {
+ *     printf("%s\n", (result.hit_count > 0) ? result.hits[0].virus_name : "clean");
+ *     av_free_result(&result);
+ * }
+ * av_engine_destroy(engine);
+ * @endcode
+ *
+ * @param [out] engine New engine. Must be released with av_engine_destroy().
+ * @return Error code from @ref Error_Codes_AV.
+ */
+int av_engine_create(AvEngine **engine)
+{
+    if (engine == NULL)
+    {
+        return AV_NULL_ENGINE_POINTER; // 1
+    }
+
+    // Declare all the variables:
+    AvEngine *created = calloc(1, sizeof(*created));
+
+    *engine = NULL;
+    if (created == NULL)
+    {
+        return AV_MALLOC_ERROR; // 4
+    }
+
+#ifdef _WIN32
+    InitializeCriticalSection(&created->lock);
+#else
+    if (pthread_mutex_init(&created->lock, NULL) != 0)
+    {
+        free(created);
+        return AV_LOCK_ERROR; // 5
+    }
+    if (pthread_mutex_init(&created->limiter.lock, NULL) != 0)
+    {
+        pthread_mutex_destroy(&created->lock);
+        free(created);
+        return AV_LOCK_ERROR; // 5
+    }
+#endif
+
+#ifdef AV_STATIC_SIGNATURES
+    created->current[0] = malloc(sizeof(EngineBase));
+    if (created->current[0] == NULL)
+    {
+        av_engine_destroy(created);
+        return AV_MALLOC_ERROR; // 4
+    }
+    created->current[0]->sb = static_signature_base;
+    created->current[0]->references = 1; // held by the engine
+    created->current[0]->static_flag = 1;
+#endif
+
+    *engine = created;
+    return AV_SUCCESS; // 0
+}
+
+/**
+ * @brief Work of one thread loading the signature replica of a NUMA node.
+ */
+typedef struct
+{
+    const char *sign_path; /**< Path to the signature file. */
+    EngineBase *base; /**< Loaded replica (NULL on error). */
+    int result; /**< Error code from @ref Error_Codes_RSB. */
+} ReplicaLoad;
+
+/**
+ * @brief Loads one signature replica; thread start routine.
+ *
+ * Memory is placed on the node of the thread that first touches it, so a thread
+ * started on a node's CPUs builds a replica in that node's memory.
+ *
+ * @param [in,out] arg Pointer to the ReplicaLoad.
+ * @return Always NULL; the outcome is in ReplicaLoad.result.
+ */
+static void *load_replica(void *arg)
+{
+    // Declare all the variables:
+    ReplicaLoad *job = arg;
+
+    job->base = malloc(sizeof(*job->base));
+    if (job->base == NULL)
+    {
+        job->result = RSB_BASE_MALLOC_ERROR;
+        return NULL;
+    }
+
+    job->result = read_signature_base(job->sign_path, &job->base->sb);
+    if (job->result != RSB_SUCCESS)
+    {
+        free(job->base);
+        job->base = NULL;
+        return NULL;
+    }
+    job->base->references = 1; // held by the engine
+    job->base->static_flag = 0;
+
+    return NULL;
+}
+
+#ifdef __linux__
+/**
+ * @brief Loads one replica per NUMA node, each on a thread bound to the node's CPUs.
+ *
+ * A replica whose thread cannot be started is loaded by the calling thread.
+ *
+ * @param [in] topology NUMA nodes.
+ * @param [in,out] jobs One job per node.
+ */
+static void load_node_replicas(const NumaTopology *topology, ReplicaLoad *jobs)
+{
+    // Declare all the variables:
+    pthread_t ids[MAX_NUMA_NODES];
+    pthread_attr_t attributes;
+    int started[MAX_NUMA_NODES];
+    size_t i;
+
+    for (i = 0; i < topology->node_count; i++)
+    {
+        started[i] = 0;
+        if (pthread_attr_init(&attributes) == 0)
+        {
+            started[i] = (pthread_attr_setaffinity_np(&attributes, sizeof(cpu_set_t), &topology->cpus[i]) == 0 &&
+                          pthread_create(&ids[i], &attributes, load_replica, &jobs[i]) == 0);
+            pthread_attr_destroy(&attributes);
+        }
+    }
+    for (i = 0; i < topology->node_count; i++)
+    {
+        if (started[i])
+        {
+            pthread_join(ids[i], NULL);
+        }
+        else
+        {
+            load_replica(&jobs[i]);
+        }
+    }
+}
+#endif
+
+/**
+ * @brief Loads a signature file into the engine, replacing the signatures loaded before.
+ *
+ * The file is parsed without holding the engine lock. Scans already running keep
+ * the old signatures until they finish; scans started afterwards use the new ones.
+ * If loading fails, the engine keeps its previous signatures.
+ *
+ * After av_engine_set_numa() one replica is parsed per NUMA node, each by a thread
+ * bound to the CPUs of its node (or by the calling thread if it cannot be started).
+ *
+ * @param [in] engine Engine.
+ * @param [in] sign_path Path to the signature file (see read_signature_base()).
+ * @return Error code from @ref Error_Codes_AV.
+ */
+int av_engine_load(AvEngine *engine, const char *sign_path)
+{
+    if (engine == NULL)
+    {
+        return AV_NULL_ENGINE_POINTER; // 1
+    }
+    if (sign_path == NULL)
+    {
+        return AV_NULL_ARGUMENT_POINTER; // 2
+    }
+
+    // Declare all the variables:
+    ReplicaLoad jobs[MAX_NUMA_NODES];
+    EngineBase *old[MAX_NUMA_NODES];
+    size_t replicas = 1, i;
+    int result = RSB_SUCCESS;
+
+    memset(jobs, 0, sizeof(jobs));
+    for (i = 0; i < MAX_NUMA_NODES; i++)
+    {
+        jobs[i].sign_path = sign_path;
+    }
+
+#ifdef __linux__
+    if (engine->topology != NULL && engine->topology->node_count > 1)
+    {
+        replicas = engine->topology->node_count;
+        load_node_replicas(engine->topology, jobs);
+    }
+#endif
+    if (replicas == 1)
+    {
+        load_replica(&jobs[0]);
+    }
+
+    for (i = 0; i < replicas; i++)
+    {
+        if (jobs[i].result != RSB_SUCCESS && result == RSB_SUCCESS)
+        {
+            result = jobs[i].result;
+        }
+    }
+    if (result != RSB_SUCCESS)
+    {
+        for (i = 0; i < replicas; i++)
+        {
+            if (jobs[i].base != NULL)
+            {
+                free_signature_base(&jobs[i].base->sb);
+                free(jobs[i].base);
+            }
+        }
+        return av_error_from_rsb(result);
+    }
+
+    engine_lock(engine);
+    for (i = 0; i < MAX_NUMA_NODES; i++)
+    {
+        old[i] = engine->current[i];
+        engine->current[i] = jobs[i].base; // NULL past the last node
+    }
+    engine_unlock(engine);
+
+    for (i = 0; i < MAX_NUMA_NODES; i++)
+    {
+        if (old[i] != NULL)
+        {
+            engine_release(engine, old[i]);
+        }
+    }
+
+    return AV_SUCCESS; // 0
+}
+
+/**
+ * @brief Limits the reads of scans made with AV_SCAN_IO_LIMIT.
+ *
+ * All such scans of the engine share one token bucket per limit, so a sweep on
+ * many threads stays within the budget as a whole. Short bursts of up to
+ * IO_LIMIT_BURST_MS worth of reads are allowed. May be called at any time.
+ *
+ * @param [in] engine Engine.
+ * @param [in] bytes_per_second Read bandwidth (0 = unlimited).
+ * @param [in] reads_per_second Read operations per second (0 = unlimited).
+ * @return Error code from @ref Error_Codes_AV.
+ */
+int av_engine_set_io_limit(AvEngine *engine, uint64_t bytes_per_second, uint64_t reads_per_second)
+{
+    if (engine == NULL)
+    {
+        return AV_NULL_ENGINE_POINTER; // 1
+    }
+
+#ifdef _WIN32
+    (void)bytes_per_second;
+    (void)reads_per_second;
+    return AV_NOT_SUPPORTED; // 13
+#else
+    pthread_mutex_lock(&engine->limiter.lock);
+    engine->limiter.bytes_per_second = bytes_per_second;
+    engine->limiter.reads_per_second = reads_per_second;
+    engine->limiter.byte_tokens = (double)bytes_per_second * IO_LIMIT_BURST_MS / 1000.0;
+    engine->limiter.read_tokens = (double)reads_per_second * IO_LIMIT_BURST_MS / 1000.0;
+    engine->limiter.last_ns = monotonic_ns();
+    pthread_mutex_unlock(&engine->limiter.lock);
+
+    return AV_SUCCESS; // 0
+#endif
+}
+
+#ifdef __linux__
+/**
+ * @brief Adds the CPUs of a sysfs cpulist ("0-3,8-11") to a CPU set.
+ *
+ * @param [in] text cpulist text.
+ * @param [out] cpus CPU set (cleared first).
+ * @return Number of CPUs in the set.
+ */
+static size_t parse_cpu_list(const char *text, cpu_set_t *cpus)
+{
+    // Declare all the variables:
+    unsigned long first, last, cpu;
+    char *end;
+
+    CPU_ZERO(cpus);
+    while (*text != '\0' && *text != '\n')
+    {
+        first = strtoul(text, &end, 10);
+        if (end == text)
+        {
+            break;
+        }
+        last = first;
+        if (*end == '-')
+        {
+            text = end + 1;
+            last = strtoul(text, &end, 10);
+        }
+        for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+        {
+            CPU_SET(cpu, cpus);
+        }
+        text = (*end == ',') ? end + 1 : end;
+    }
+
+    return (size_t)CPU_COUNT(cpus);
+}
+#endif
+
+/**
+ * @brief Makes the engine NUMA-aware.
+ *
+ * Reads the nodes and their CPUs from sysfs (no libnuma needed). From the next
+ * av_engine_load() on, the signatures are kept once per node in node-local memory
+ * and every scan uses the replica of the node it runs on; av_engine_bind_thread()
+ * spreads worker threads over the nodes. Nodes without CPUs are skipped.
+ *
+ * Call it before av_engine_load() and before any scan starts.
+ *
+ * @param [in] engine Engine.
+ * @return Error code from @ref Error_Codes_AV.
+ */
+int av_engine_set_numa(AvEngine *engine)
+{
+    if (engine == NULL)
+    {
+        return AV_NULL_ENGINE_POINTER; // 1
+    }
+
+#ifndef __linux__
+    return AV_NOT_SUPPORTED; // 13
+#else
+    // Declare all the variables:
+    NumaTopology *topology;
+    char path[sizeof(NUMA_SYSFS_PATH) + 32];
+    char line[4096];
+    FILE *file;
+    size_t node;
+
+    topology = calloc(1, sizeof(*topology));
+    if (topology == NULL)
+    {
+        return AV_MALLOC_ERROR; // 4
+    }
+
+    for (node = 0; node < MAX_NUMA_NODES; node++) // node numbers may have gaps
+    {
+        snprintf(path, sizeof(path), "%s/node%zu/cpulist", NUMA_SYSFS_PATH, node);
+        file = fopen(path, "r");
+        if (file == NULL)
+        {
+            continue;
+        }
+        if (fgets(line, sizeof(line), file) != NULL &&
+            parse_cpu_list(line, &topology->cpus[topology->node_count]) > 0)
+        {
+            topology->node_count++;
+        }
+        fclose(file);
+    }
+
+    if (topology->node_count == 0)
+    {
+        free(topology);
+        return AV_TOPOLOGY_ERROR; // 15
+    }
+
+    free(engine->topology);
+    engine->topology = topology;
+    return AV_SUCCESS; // 0
+#endif
+}
+
+/**
+ * @brief Binds the calling thread to the CPUs of one NUMA node.
+ *
+ * Workers numbered 0, 1, 2, ... are spread round-robin over the nodes found by
+ * av_engine_set_numa(), so each stays next to its signature replica and its
+ * chunk buffers.
+ *
+ * @param [in] engine Engine after av_engine_set_numa().
+ * @param [in] worker_index Number of the worker; selects node worker_index % nodes.
+ * @return Error code from @ref Error_Codes_AV.
+ */
+int av_engine_bind_thread(AvEngine *engine, size_t worker_index)
+{
+    if (engine == NULL)
+    {
+        return AV_NULL_ENGINE_POINTER; // 1
+    }
+
+#ifndef __linux__
+    (void)worker_index;
+    return AV_NOT_SUPPORTED; // 13
+#else
+    if (engine->topology == NULL)
+    {
+        return AV_TOPOLOGY_ERROR; // 15
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                               &engine->topology->cpus[worker_index % engine->topology->node_count]) != 0)
+    {
+        return AV_AFFINITY_ERROR; // 16
+    }
+
+    return AV_SUCCESS; // 0
+#endif
+}
+
+/**
+ * @brief Scans an open file descriptor.
+ *
+ * The descriptor is never reopened by path and its file offset is not changed
+ * (see scan_fd_hits()). Safe to call from many threads at once.
+ *
+ * @param [in] engine Engine with loaded signatures.
+ * @param [in] fd Open file descriptor (read access).
+ * @param [in] flags Options from @ref Av_Scan_Flags.
+ * @param [out] result Outcome of the scan. Must be released with av_free_result() on success.
+ * @return Error code from @ref Error_Codes_AV.
+ */
+int av_scan_fd(AvEngine *engine, int fd, int flags, AvScanResult *result)
+{
+    return av_scan_fd_control(engine, fd, flags, NULL, result);
+}
+
+/**
+ * @brief Scans an open file descriptor with a deadline and a yield callback.
+ *
+ * Same as av_scan_fd(), but the scan can be preempted: between two chunks of the
+ * floating signature search the calling thread runs control->yield, and the scan
+ * is abandoned with AV_DEADLINE_EXPIRED once control->deadline_ns has passed
+ * (also if it passed before the scan started). A scheduler uses this to run
+ * urgent scans inside a long one and to answer "not scanned in time" instead of waiting.
+ *
+ * A late scan still fills result with the signatures matched before the deadline:
+ * a hit is a verdict (the file is infected), no hit means it was not scanned in time.
+ *
+ * @param [in] engine Engine with loaded signatures.
+ * @param [in] fd Open file descriptor (read access).
+ * @param [in] flags Options from @ref Av_Scan_Flags.
+ * @param [in] control Deadline and yield callback (NULL = same as av_scan_fd()).
+ * @param [out] result Outcome of the scan. Must be released with av_free_result() on success
+ *                     and after AV_DEADLINE_EXPIRED.
+ * @return Error code from @ref Error_Codes_AV.
+ */
+int av_scan_fd_control(AvEngine *engine, int fd, int flags, const AvScanControl *control, AvScanResult *result)
+{
+    if (engine == NULL)
+    {
+        return AV_NULL_ENGINE_POINTER; // 1
+    }
+    if (result == NULL)
+    {
+        return AV_NULL_ARGUMENT_POINTER; // 2
+    }
+    if (fd < 0)
+    {
+        return AV_INVALID_FD; // 3
+    }
+
+    // Declare all the variables:
+    EngineBase *base;
+    EntropyStats *stats = NULL;
+    ScanHits hits = {NULL, 0, 0};
+    ScanControl scan_control;
+    int file_type = FT_UNKNOWN, status;
+
+    memset(result, 0, sizeof(*result));
+    memset(&scan_control, 0, sizeof(scan_control));
+    if (control != NULL)
+    {
+        scan_control.deadline_ns = control->deadline_ns;
+        scan_control.yield = control->yield;
+        scan_control.yield_arg = control->yield_arg;
+    }
+#ifndef _WIN32
+    if ((flags & AV_SCAN_IO_LIMIT) != 0)
+    {
+        scan_control.limiter = &engine->limiter;
+    }
+#endif
+
+    if ((flags & AV_SCAN_ENTROPY) != 0)
+    {
+        stats = malloc(sizeof(*stats)); // ~70 KB, too large for small thread stacks
+        if (stats == NULL)
+        {
+            return AV_MALLOC_ERROR; // 4
+        }
+    }
+
+    base = engine_acquire(engine);
+    if (base == NULL)
+    {
+        free(stats);
+        return AV_NO_SIGNATURES; // 6
+    }
+
+    status = av_error_from_sfd(scan_fd_hits(fd, &base->sb, (flags & AV_SCAN_FIRST_HIT) != 0,
+                                            (flags & AV_SCAN_SINGLE_THREAD) ? 1 : 0, &scan_control,
+                                            &file_type, &hits, stats));
+    if (status == AV_SUCCESS || status == AV_DEADLINE_EXPIRED) // a late scan keeps the matches it found
+    {
+        status = (fill_scan_result(&base->sb, file_type, &hits, stats, result) == AV_SUCCESS) ? status : AV_MALLOC_ERROR;
+    }
+
+    engine_release(engine, base);
+    free_scan_hits(&hits);
+    free(stats);
+    return status;
+}
+
+/**
+ * @brief Scans a file by path.
+ *
+ * Opens the file once and scans the descriptor with av_scan_fd(). Where descriptors
+ * cannot be scanned (Windows), the file is read into memory and scanned with av_scan_buffer().
+ * While tracing is on (see av_trace_enable()), the open and the scan are recorded as
+ * a file span of their own, unless the calling thread has already begun one.
+ *
+ * @param [in] engine Engine with loaded signatures.
+ * @param [in] file_path Path to the file.
+ * @param [in] flags Options from @ref Av_Scan_Flags.
+ * @param [out] result Outcome of the scan. Must be released with av_free_result() on success.
+ * @return Error code from @ref Error_Codes_AV.
+ */
+int av_scan_path(AvEngine *engine, const char *file_path, int flags, AvScanResult *result)
+{
+    if (engine == NULL)
+    {
+        return AV_NULL_ENGINE_POINTER; // 1
+    }
+    if (file_path == NULL || result == NULL)
+    {
+        return AV_NULL_ARGUMENT_POINTER; // 2
+    }
+
+#ifdef _WIN32
+    // Declare all the variables:
+    unsigned char *buffer;
+    size_t file_size = 0;
+    FILE *file;
+    int status;
+
+    if (calculate_file_size(file_path, &file_size) != CFS_SUCCESS)
+    {
+        return AV_FILE_OPEN_ERROR; // 11
+    }
+    buffer = malloc((file_size > 0) ? file_size : 1);
+    if (buffer == NULL)
+    {
+        return AV_MALLOC_ERROR; // 4
+    }
+    file = fopen(file_path, "rb");
+    if (file == NULL)
+    {
+        free(buffer);
+        return AV_FILE_OPEN_ERROR; // 11
+    }
+    file_size = fread(buffer, 1, file_size, file);
+    fclose(file);
+
+    status = av_scan_buffer(engine, buffer, file_size, flags, result);
+    free(buffer);
+    return status;
+#else
+    // Declare all the variables:
+    int fd, status;
+    int traced_flag = (trace_depth == 0 && trace_now() != 0); // not inside a file of the caller
+    uint64_t span;
+
+    if (traced_flag)
+    {
+        av_trace_file_begin(file_path);
+    }
+
+    span = trace_now();
+    fd = open(file_path, O_RDONLY | O_CLOEXEC);
+    trace_span("open", span);
+    if (fd < 0)
+    {
+        if (traced_flag)
+        {
+            av_trace_file_end();
+        }
+        return AV_FILE_OPEN_ERROR; // 11
+    }
+
+    status = av_scan_fd(engine, fd, flags, result);
+    close(fd);
+    if (traced_flag)
+    {
+        av_trace_file_end();
+    }
+    return status;
+#endif
+}
+
+/**
+ * @brief Scans scattered buffers as one stream (see scan_iovec_hits()).
+ *
+ * The segments are scanned in place, as if they were joined: the type check, size
+ * gate and signatures see one file, and matches across segment borders are found.
+ * Match offsets are relative to the start of the first segment. Safe to call from
+ * many threads at once.
+ *
+ * Example usage:
+ * @code
+ * struct iovec parts[2] = { {mime_head, head_size}, {mime_body, body_size} };
+ * AvScanResult result;
+ *
+ * if (av_scan_iovec(engine, parts, 2, AV_SCAN_FIRST_HIT, &result) == AV_SUCCESS)
+ * {
+ *     reject = (result.hit_count > 0);
+ *     av_free_result(&result);
+ * }
+ * @endcode
+ *
+ * @param [in] engine Engine with loaded signatures.
+ * @param [in] iov Segments of the stream (a segment may be NULL if its length is 0).
+ * @param [in] iovcnt Number of segments.
+ * @param [in] flags Options from @ref Av_Scan_Flags (AV_SCAN_SINGLE_THREAD is implied).
+ * @param [out] result Outcome of the scan. Must be released with av_free_result() on success.
+ * @return Error code from @ref Error_Codes_AV.
+ */
+int av_scan_iovec(AvEngine *engine, const struct iovec *iov, int iovcnt, int flags, AvScanResult *result)
+{
+    if (engine == NULL)
+    {
+        return AV_NULL_ENGINE_POINTER; // 1
+    }
+    if ((iov == NULL && iovcnt > 0) || iovcnt < 0 || result == NULL)
+    {
+        return AV_NULL_ARGUMENT_POINTER; // 2
+    }
+
+    // Declare all the variables:
+    EngineBase *base;
+    EntropyStats *stats = NULL;
+    ScanHits hits = {NULL, 0, 0};
+    int file_type = FT_UNKNOWN, status;
+
+    memset(result, 0, sizeof(*result));
+
+    if ((flags & AV_SCAN_ENTROPY) != 0)
+    {
+        stats = malloc(sizeof(*stats));
+        if (stats == NULL)
+        {
+            return AV_MALLOC_ERROR; // 4
+        }
+    }
+
+    base = engine_acquire(engine);
+    if (base == NULL)
+    {
+        free(stats);
+        return AV_NO_SIGNATURES; // 6
+    }
+
+    status = scan_iovec_hits(iov, (size_t)iovcnt, &base->sb, (flags & AV_SCAN_FIRST_HIT) != 0, &file_type, &hits, stats);
+    if (status == SBH_SUCCESS)
+    {
+        status = fill_scan_result(&base->sb, file_type, &hits, stats, result);
+    }
+    else
+    {
+        status = (status == SBH_NULL_BUFFER_POINTER) ? AV_NULL_ARGUMENT_POINTER : AV_MALLOC_ERROR;
+    }
+
+    engine_release(engine, base);
+    free_scan_hits(&hits);
+    free(stats);
+    return status;
+}
+
+/**
+ * @brief Scans bytes in memory: a single-segment av_scan_iovec().
+ *
+ * Match offsets are relative to the start of the buffer. Safe to call from many threads at once.
+ *
+ * @param [in] engine Engine with loaded signatures.
+ * @param [in] buffer Contents of the file (may be NULL if size is 0).
+ * @param [in] size Number of bytes in buffer.
+ * @param [in] flags Options from @ref Av_Scan_Flags (AV_SCAN_SINGLE_THREAD is implied).
+ * @param [out] result Outcome of the scan. Must be released with av_free_result() on success.
+ * @return Error code from @ref Error_Codes_AV.
+ */
+int av_scan_buffer(AvEngine *engine, const void *buffer, size_t size, int flags, AvScanResult *result)
+{
+    // Declare all the variables:
+    struct iovec segment;
+
+    segment.iov_base = (void *)buffer; // only read
+    segment.iov_len = size;
+
+    return av_scan_iovec(engine, &segment, 1, flags, result);
+}
+
+/**
+ * @brief Releases memory owned by a scan result.
+ *
+ * @param [in,out] result Scan result (may be NULL).
+ */
+void av_free_result(AvScanResult *result)
+{
+    if (result == NULL)
+    {
+        return;
+    }
+
+    free(result->hits);
+    result->hits = NULL;
+    result->hit_count = 0;
+}
+
+/**
+ * @brief Releases an engine and its signatures.
+ *
+ * No scan may be running on the engine any more.
+ *
+ * @param [in] engine Engine (may be NULL).
+ */
+void av_engine_destroy(AvEngine *engine)
+{
+    if (engine == NULL)
+    {
+        return;
+    }
+
+    // Declare all the variables:
+    size_t i;
+
+    for (i = 0; i < MAX_NUMA_NODES; i++)
+    {
+        if (engine->current[i] != NULL)
+        {
+            engine_release(engine, engine->current[i]);
+        }
+    }
+
+#ifdef _WIN32
+    DeleteCriticalSection(&engine->lock);
+#else
+    pthread_mutex_destroy(&engine->limiter.lock);
+    pthread_mutex_destroy(&engine->lock);
+#endif
+#ifdef __linux__
+    free(engine->topology);
+#endif
+    free(engine);
+}
+
+/**
+ * @brief Starts or stops recording the spans of scans.
+ *
+ * While tracing is on, every scan of a descriptor records its phases ("header",
+ * "read" for each read window, "match" for each searched chunk, "rules") with
+ * CLOCK_MONOTONIC start and end times, also on the threads that scan ranges of
+ * a large file. An application adds its own phases with av_trace_span() and
+ * groups them per file with av_trace_file_begin() and av_trace_file_end().
+ *
+ * Each thread records into its own ring of events_per_thread spans, without
+ * locks; when it is full the oldest spans are overwritten. Rings are allocated
+ * on the first span of a thread and kept for the life of the process (threads
+ * that exit hand theirs to new threads). A ring keeps the size it was created
+ * with. Stopping keeps the recorded spans for av_trace_dump().
+ *
+ * Example usage:
+ * @code
+ * av_trace_enable(16384);
+ * av_scan_path(engine, "slow.iso", AV_SCAN_DEFAULT, &result);
+ * av_trace_dump("scan.json", AV_TRACE_CHROME);
+ * @endcode
+ *
+ * @param [in] events_per_thread Spans kept per thread (0 = stop recording).
+ * @return Error code from @ref Error_Codes_AV.
+ */
+int av_trace_enable(size_t events_per_thread)
+{
+#ifdef _WIN32
+    (void)events_per_thread;
+    return AV_NOT_SUPPORTED; // 13
+#else
+    atomic_store_explicit(&trace_capacity, events_per_thread, memory_order_relaxed);
+    return AV_SUCCESS; // 0
+#endif
+}
+
+/**
+ * @brief Returns the start time of a span for av_trace_span().
+ *
+ * @return CLOCK_MONOTONIC time in nanoseconds, 0 when tracing is off.
+ */
+uint64_t av_trace_now(void)
+{
+#ifdef _WIN32
+    return 0;
+#else
+    return trace_now();
+#endif
+}
+
+/**
+ * @brief Records a phase of the calling thread from start_ns to now.
+ *
+ * The span belongs to the file begun last on the thread (see av_trace_file_begin()).
+ *
+ * @param [in] name Phase name; must stay valid until the trace is dumped (e.g. a string literal).
+ * @param [in] start_ns Value of av_trace_now() at the start (0 = nothing is recorded).
+ */
+void av_trace_span(const char *name, uint64_t start_ns)
+{
+#ifdef _WIN32
+    (void)name;
+    (void)start_ns;
+#else
+    if (name != NULL)
+    {
+        trace_span(name, start_ns);
+    }
+#endif
+}
+
+/**
+ * @brief Begins a file span: the following spans of the thread belong to the file.
+ *
+ * Scans run by the thread, including their range threads, record into the file.
+ * Calls may nest (a scan started from a yield callback) up to MAX_TRACE_FILE_DEPTH
+ * deep; every call must be matched by av_trace_file_end() on the same thread.
+ *
+ * @param [in] path Path of the file (only its end is kept; may be NULL).
+ */
+void av_trace_file_begin(const char *path)
+{
+#ifdef _WIN32
+    (void)path;
+#else
+    // Declare all the variables:
+    TraceFile *file;
+    const char *tail;
+    size_t length;
+
+    trace_depth++;
+    if (trace_depth > MAX_TRACE_FILE_DEPTH)
+    {
+        return;
+    }
+
+    file = &trace_files[trace_depth - 1];
+    file->start_ns = trace_now();
+    file->nested_ns = 0;
+    file->id = 0;
+    if (file->start_ns == 0) // tracing is off; the call is still counted for its av_trace_file_end()
+    {
+        return;
+    }
+    file->id = atomic_fetch_add_explicit(&trace_file_count, 1, memory_order_relaxed) + 1;
+
+    tail = (path != NULL) ? path : "";
+    length = strlen(tail);
+    if (length >= sizeof(file->file))
+    {
+        tail += length - (sizeof(file->file) - 1);
+        while ((*tail & 0xC0) == 0x80) // do not start inside a UTF-8 sequence
+        {
+            tail++;
+        }
+    }
+    strcpy(file->file, tail);
+#endif
+}
+
+/**
+ * @brief Ends the file span begun last on the calling thread and records it.
+ */
+void av_trace_file_end(void)
+{
+#ifndef _WIN32
+    // Declare all the variables:
+    TraceFile *file;
+    uint64_t end_ns;
+
+    if (trace_depth == 0)
+    {
+        return;
+    }
+    trace_depth--;
+    if (trace_depth >= MAX_TRACE_FILE_DEPTH)
+    {
+        return;
+    }
+
+    file = &trace_files[trace_depth];
+    if (file->start_ns == 0)
+    {
+        return;
+    }
+    end_ns = monotonic_ns();
+    if (trace_depth > 0) // time of a nested file is not time of the outer one
+    {
+        trace_files[trace_depth - 1].nested_ns += end_ns - file->start_ns;
+    }
+    trace_record(NULL, file->start_ns, end_ns, file);
+#endif
+}
+
+#ifndef _WIN32
+/**
+ * @brief A span copied out of a ring by av_trace_dump().
+ */
+typedef struct
+{
+    TraceEvent event; /**< Copy of the span. */
+    unsigned thread; /**< Number of the ring it was recorded in. */
+} TraceCopy;
+
+/**
+ * @brief Orders copied spans by file, the file span first, then by phase name.
+ */
+static int compare_trace_copies(const void *left, const void *right)
+{
+    // Declare all the variables:
+    const TraceEvent *a = &((const TraceCopy *)left)->event;
+    const TraceEvent *b = &((const TraceCopy *)right)->event;
+
+    if (a->file_id != b->file_id)
+    {
+        return (a->file_id < b->file_id) ? -1 : 1;
+    }
+    if ((a->name == NULL) != (b->name == NULL))
+    {
+        return (a->name == NULL) ? -1 : 1;
+    }
+    return (a->name == NULL) ? 0 : strcmp(a->name, b->name);
+}
+
+/**
+ * @brief Copies the spans of all rings.
+ *
+ * The rings are read while threads may record: after a ring is copied its head
+ * is read again, and spans whose slots may have been overwritten meanwhile are dropped.
+ *
+ * @param [out] count Number of copied spans.
+ * @return Copies (free() them), NULL if memory could not be allocated.
+ */
+static TraceCopy *trace_copy_rings(size_t *count)
+{
+    // Declare all the variables:
+    TraceRing *rings = atomic_load_explicit(&trace_rings, memory_order_acquire); // rings added later are skipped
+    TraceRing *ring;
+    TraceCopy *copies;
+    uint64_t head, first, lowest, n;
+    size_t total = 0;
+
+    for (ring = rings; ring != NULL; ring = ring->next)
+    {
+        total += ring->capacity;
+    }
+    copies = malloc((total > 0) ? total * sizeof(*copies) : 1);
+    if (copies == NULL)
+    {
+        return NULL;
+    }
+
+    *count = 0;
+    for (ring = rings; ring != NULL; ring = ring->next)
+    {
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        first = (head > ring->capacity) ? head - ring->capacity : 0;
+        for (n = first; n < head; n++)
+        {
+            copies[*count + (size_t)(n - first)].event = ring->events[n % ring->capacity];
+            copies[*count + (size_t)(n - first)].thread = ring->index;
+        }
+
+        // Span n is overwritten while span n + capacity is written, i.e. once head reaches it.
+        // The fence keeps the copies above before the reload (reader side of a sequence lock,
+        // paired with the release fence in trace_record()).
+        atomic_thread_fence(memory_order_acquire);
+        n = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        lowest = (n >= ring->capacity) ? n - ring->capacity + 1 : 0;
+        lowest = (lowest < first) ? first : (lowest > head) ? head : lowest;
+        memmove(&copies[*count], &copies[*count + (size_t)(lowest - first)], (size_t)(head - lowest) * sizeof(*copies));
+        *count += (size_t)(head - lowest);
+    }
+    return copies;
+}
+
+/**
+ * @brief Writes a string as the contents of a JSON string.
+ */
+static int trace_write_json(FILE *file, const char *text)
+{
+    for (; *text != '\0'; text++)
+    {
+        if ((*text == '"' || *text == '\\') ? fprintf(file, "\\%c", *text) < 0 :
+            ((unsigned char)*text < 0x20) ? fprintf(file, "\\u%04x", (unsigned)(unsigned char)*text) < 0 :
+            fputc(*text, file) == EOF)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes spans as Chrome trace-event JSON: one complete ("X") event per span.
+ *
+ * File spans are named by the path, phases by their name; every event carries
+ * the file number in args.file. Times are microseconds since the earliest span.
+ */
+static int trace_write_chrome(FILE *file, const TraceCopy *copies, size_t count)
+{
+    // Declare all the variables:
+    uint64_t origin = UINT64_MAX;
+    size_t i;
+    int pid = (int)getpid();
+
+    for (i = 0; i < count; i++)
+    {
+        if (copies[i].event.start_ns < origin)
+        {
+            origin = copies[i].event.start_ns;
+        }
+    }
+
+    if (fprintf(file, "{\"traceEvents\":[") < 0)
+    {
+        return -1;
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (fprintf(file, "%s\n{\"name\":\"", (i > 0) ? "," : "") < 0 ||
+            trace_write_json(file, (copies[i].event.name != NULL) ? copies[i].event.name : copies[i].event.file) != 0 ||
+            fprintf(file, "\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,"
+                          "\"args\":{\"file\":%llu}}",
+                    (copies[i].event.name != NULL) ? "phase" : "file",
+                    (double)(copies[i].event.start_ns - origin) / 1000.0,
+                    (double)(copies[i].event.end_ns - copies[i].event.start_ns) / 1000.0,
+                    pid, copies[i].thread, (unsigned long long)copies[i].event.file_id) < 0)
+        {
+            return -1;
+        }
+    }
+    return (fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n") < 0) ? -1 : 0;
+}
+
+/**
+ * @brief Writes a path as one frame of a folded stack (';' and line breaks replaced by '_').
+ */
+static int trace_write_frame(FILE *file, const char *text)
+{
+    for (; *text != '\0'; text++)
+    {
+        if (fputc((*text == ';' || *text == '\n' || *text == '\r') ? '_' : *text, file) == EOF)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes spans as folded stacks: "file;phase nanoseconds", one line per file and phase.
+ *
+ * Phases of a file are summed over all its threads. The line of the file itself
+ * has the time spent outside its phases on the thread that began it. Phases whose
+ * file span was overwritten in the ring, or that belong to no file, have no file frame.
+ *
+ * @param [in] file Output.
+ * @param [in,out] copies Spans (sorted by this function).
+ * @param [in] count Number of spans.
+ */
+static int trace_write_folded(FILE *file, TraceCopy *copies, size_t count)
+{
+    // Declare all the variables:
+    const TraceEvent *event, *root = NULL;
+    uint64_t total, duration, nested;
+    size_t i, j;
+
+    qsort(copies, count, sizeof(*copies), compare_trace_copies);
+
+    for (i = 0; i < count; i = j)
+    {
+        event = &copies[i].event;
+        if (root == NULL || root->file_id != event->file_id)
+        {
+            root = (event->name == NULL && event->file_id != 0) ? event : NULL;
+        }
+
+        total = 0;
+        for (j = i; j < count && compare_trace_copies(&copies[j], &copies[i]) == 0; j++)
+        {
+            duration = copies[j].event.end_ns - copies[j].event.start_ns;
+            nested = (copies[j].event.nested_ns < duration) ? copies[j].event.nested_ns : duration;
+            total += duration - nested; // nested_ns is 0 for phases
+        }
+        if (total == 0)
+        {
+            continue;
+        }
+
+        if ((root != NULL && trace_write_frame(file, root->file) != 0) ||
+            (root != NULL && event->name != NULL && fputc(';', file) == EOF) ||
+            (event->name != NULL && trace_write_frame(file, event->name) != 0) ||
+            fprintf(file, " %llu\n", (unsigned long long)total) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+#endif
+
+/**
+ * @brief Writes the recorded spans to a file.
+ *
+ * May be called while scans run; spans recorded during the dump may be missing
+ * from it. Nothing is cleared: a later dump contains the same spans and newer ones.
+ *
+ * Example usage:
+ * @code
+ * if (av_trace_dump("scan.folded", AV_TRACE_FOLDED) == AV_SUCCESS)
+ * {
+ *     system("flamegraph.pl scan.folded > scan.svg");
+ * }
+ * @endcode
+ *
+ * @param [in] path Path of the trace file (created or replaced).
+ * @param [in] format Format from @ref Av_Trace_Formats.
+ * @return Error code from @ref Error_Codes_AV.
+ */
+int av_trace_dump(const char *path, int format)
+{
+    if (path == NULL)
+    {
+        return AV_NULL_ARGUMENT_POINTER; // 2
+    }
+    if (format != AV_TRACE_CHROME && format != AV_TRACE_FOLDED)
+    {
+        return AV_TRACE_FORMAT_ERROR; // 17
+    }
+
+#ifdef _WIN32
+    return AV_NOT_SUPPORTED; // 13
+#else
+    // Declare all the variables:
+    TraceCopy *copies;
+    size_t count = 0;
+    FILE *file;
+    int result;
+
+    copies = trace_copy_rings(&count);
+    if (copies == NULL)
+    {
+        return AV_MALLOC_ERROR; // 4
+    }
+
+    file = fopen(path, "w");
+    if (file == NULL)
+    {
+        free(copies);
+        return AV_TRACE_WRITE_ERROR; // 18
+    }
+
+    result = (format == AV_TRACE_CHROME) ? trace_write_chrome(file, copies, count)
+                                         : trace_write_folded(file, copies, count);
+    free(copies);
+    if (fclose(file) != 0 || result != 0)
+    {
+        return AV_TRACE_WRITE_ERROR; // 18
+    }
+    return AV_SUCCESS; // 0
+#endif
+}
+
+/**
+ * @brief Describes a library error code.
+ *
+ * @param [in] error Error code from @ref Error_Codes_AV.
+ * @return Static description of the error.
+ */
+const char *av_strerror(int error)
+{
+    switch (error)
+    {
+        case AV_SUCCESS: return "No error";
+        case AV_NULL_ENGINE_POINTER: return "Engine pointer is NULL";
+        case AV_NULL_ARGUMENT_POINTER: return "Path, buffer or result pointer is NULL";
+        case AV_INVALID_FD: return "File descriptor is invalid";
+        case AV_MALLOC_ERROR: return "Failed to allocate memory";
+        case AV_LOCK_ERROR: return "Failed to create engine lock";
+        case AV_NO_SIGNATURES: return "No signature base is loaded";
+        case AV_SIGNATURE_FOPEN_ERROR: return "Failed to open signature file";
+        case AV_SIGNATURE_READ_ERROR: return "Failed to read signature file";
+        case AV_SIGNATURE_PARSE_ERROR: return "Failed to parse signature line (signature, offset, name or type) or rule";
+        case AV_SIGNATURE_EMPTY: return "Signature file contains no signatures";
+        case AV_FILE_OPEN_ERROR: return "Failed to open target file";
+        case AV_FILE_READ_ERROR: return "Failed to read target file";
+        case AV_NOT_SUPPORTED: return "Operation is not supported on this platform";
+        case AV_DEADLINE_EXPIRED: return "File was not scanned in time";
+        case AV_TOPOLOGY_ERROR: return "NUMA topology is unknown (see av_engine_set_numa())";
+        case AV_AFFINITY_ERROR: return "Failed to set the CPU affinity of the thread";
+        case AV_TRACE_FORMAT_ERROR: return "Unknown trace format";
+        case AV_TRACE_WRITE_ERROR: return "Failed to write trace file";
+        default: return "Unknown error";
+    }
+}
@@ -0,0 +1,284 @@
+#ifndef LIBANTIVIRUS_H
+#define LIBANTIVIRUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @def AV_API
+ * @brief Marks the functions exported by the shared library (the rest is built with hidden visibility).
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define AV_API __attribute__((visibility("default")))
+#else
+#define AV_API
+#endif
+
+/**
+ * @def AV_MAX_VIRUS_NAME_LENGTH
+ * @brief Maximum length (in characters, with the terminating zero) of a virus name in a scan result.
+ */
+#define AV_MAX_VIRUS_NAME_LENGTH 256
+
+/**
+ * @def AV_MAX_SECTION_NAME_LENGTH
+ * @brief Length of a PE section name in a scan result (8 characters and the terminating zero).
+ */
+#define AV_MAX_SECTION_NAME_LENGTH 9
+
+/**
+ * @brief Scanning engine: a loaded signature base shared by all threads.
+ *
+ * The structure is opaque; it is created by av_engine_create() and released by
+ * av_engine_destroy(). All av_scan_*() functions may be called on one engine from
+ * any number of threads at once, also while av_engine_load() replaces the signatures:
+ * a scan always runs on the signature base that was current when it started.
+ */
+typedef struct AvEngine AvEngine;
+
+#ifdef _WIN32
+/**
+ * @brief One segment of scattered memory, as struct iovec from POSIX <sys/uio.h>.
+ */
+struct iovec
+{
+    void *iov_base; /**< Start of the segment. */
+    size_t iov_len; /**< Length of the segment in bytes. */
+};
+#endif
+
+/**
+ * @enum File_Types
+ * @brief File type ids returned by detect_file_type() and reported in AvScanResult.
+ *
+ * The type id selects which subset of the signature base is run against a file.
+ * FT_ANY is never returned by detection: it marks signatures that apply to every type.
+ *
+ * @see detect_file_type() for function returning these ids.
+ */
+enum File_Types
+{
+    /** @brief No known magic number matched. */
+    FT_UNKNOWN = 0,
+
+    /** @brief DOS/Windows executable ("MZ"). */
+    FT_PE = 1,
+
+    /** @brief ELF executable or shared object. */
+    FT_ELF = 2,
+
+    /** @brief Mach-O executable (thin or fat). */
+    FT_MACHO = 3,
+
+    /** @brief PDF document. */
+    FT_PDF = 4,
+
+    /** @brief OLE compound document (legacy Office). */
+    FT_OLE = 5,
+
+    /** @brief ZIP archive (also OOXML, JAR, APK). */
+    FT_ZIP = 6,
+
+    /** @brief GZIP stream. */
+    FT_GZIP = 7,
+
+    /** @brief Script with a "#!" shebang line. */
+    FT_SCRIPT = 8,
+
+    /** @brief Signature applies to any file type. Number of detectable types. */
+    FT_ANY = 9
+};
+
+/**
+ * @enum Av_Scan_Flags
+ * @brief Options of the av_scan_*() functions (may be combined with |).
+ */
+enum Av_Scan_Flags
+{
+    /** @brief Report every match; floating signatures are searched on all CPUs. */
+    AV_SCAN_DEFAULT = 0,
+
+    /** @brief Stop at the first match (enough for an allow/deny verdict). */
+    AV_SCAN_FIRST_HIT = 1,
+
+    /** @brief Search floating signatures on the calling thread only. */
+    AV_SCAN_SINGLE_THREAD = 2,
+
+    /** @brief Compute the entropy of PE sections and report files that look packed. */
+    AV_SCAN_ENTROPY = 4,
+
+    /** @brief Charge the reads to the engine's I/O limit (see av_engine_set_io_limit()). */
+    AV_SCAN_IO_LIMIT = 8
+};
+
+/**
+ * @enum Error_Codes_AV
+ * @brief Error codes of every libantivirus function.
+ *
+ * AV - libantivirus. One error type for the whole library; av_strerror() gives
+ * a description of each code.
+ *
+ * @retval Error_Codes_AV See the enum for possible return values.
+ */
+enum Error_Codes_AV
+{
+    /** @brief No errors, function completed successfully. */
+    AV_SUCCESS = 0,
+
+    /** @brief Engine pointer (or the pointer to store it in) is NULL. */
+    AV_NULL_ENGINE_POINTER = 1,
+
+    /** @brief Path, buffer or result pointer is NULL. */
+    AV_NULL_ARGUMENT_POINTER = 2,
+
+    /** @brief File descriptor is negative. */
+    AV_INVALID_FD = 3,
+
+    /** @brief Failed to allocate memory. */
+    AV_MALLOC_ERROR = 4,
+
+    /** @brief Failed to create the engine lock. */
+    AV_LOCK_ERROR = 5,
+
+    /** @brief No signature base has been loaded into the engine yet. */
+    AV_NO_SIGNATURES = 6,
+
+    /** @brief Failed to open the signature file. */
+    AV_SIGNATURE_FOPEN_ERROR = 7,
+
+    /** @brief Failed to read or close the signature file. */
+    AV_SIGNATURE_READ_ERROR = 8,
+
+    /** @brief A line or a rule of the signature file could not be parsed. */
+    AV_SIGNATURE_PARSE_ERROR = 9,
+
+    /** @brief The signature file contains no signatures. */
+    AV_SIGNATURE_EMPTY = 10,
+
+    /** @brief Failed to open the scanned file. */
+    AV_FILE_OPEN_ERROR = 11,
+
+    /** @brief Failed to get the status of, or read from, the scanned file. */
+    AV_FILE_READ_ERROR = 12,
+
+    /** @brief The operation is not supported on this platform. */
+    AV_NOT_SUPPORTED = 13,
+
+    /** @brief The deadline of av_scan_fd_control() passed before the scan finished; the result holds the hits found before it. */
+    AV_DEADLINE_EXPIRED = 14,
+
+    /** @brief The NUMA topology could not be read, or av_engine_set_numa() was not called. */
+    AV_TOPOLOGY_ERROR = 15,
+
+    /** @brief Failed to bind the thread to the CPUs of a NUMA node. */
+    AV_AFFINITY_ERROR = 16,
+
+    /** @brief The trace format is not one of @ref Av_Trace_Formats. */
+    AV_TRACE_FORMAT_ERROR = 17,
+
+    /** @brief Failed to create or write the trace file. */
+    AV_TRACE_WRITE_ERROR = 18
+};
+
+/**
+ * @enum Av_Trace_Formats
+ * @brief Output formats of av_trace_dump().
+ */
+enum Av_Trace_Formats
+{
+    /** @brief Chrome trace-event JSON (chrome://tracing, Perfetto, speedscope). */
+    AV_TRACE_CHROME = 0,
+
+    /** @brief Folded stacks "file;phase nanoseconds", as stackcollapse-perf.pl output (flamegraph.pl). */
+    AV_TRACE_FOLDED = 1
+};
+
+/**
+ * @brief One signature match reported by a scan.
+ */
+typedef struct
+{
+    char virus_name[AV_MAX_VIRUS_NAME_LENGTH]; /**< Name of the matched signature (copied; stays valid after a reload). */
+    uint64_t offset; /**< Offset of the first matched byte. */
+    int floating_flag; /**< 1 if the signature is floating ("*" offset), 0 if it has a fixed offset. */
+} AvHit;
+
+/**
+ * @brief Outcome of one scan. Must be released with av_free_result().
+ */
+typedef struct
+{
+    int file_type; /**< Detected file type (see @ref File_Types). */
+    AvHit *hits; /**< Matches: fixed-offset signatures first, then floating ones by offset, then rules. */
+    size_t hit_count; /**< Number of matches (0 = clean). */
+    int packed_flag; /**< 1 if AV_SCAN_ENTROPY was given and the file looks packed. */
+    double packed_entropy; /**< Entropy (bits per byte) that set packed_flag. */
+    char packed_section[AV_MAX_SECTION_NAME_LENGTH]; /**< Section that set packed_flag ("" = whole file). */
+} AvScanResult;
+
+/**
+ * @brief Called by a preemptible scan between two chunks (see AvScanControl).
+ */
+typedef void (*AvYieldCallback)(void *arg);
+
+/**
+ * @brief Scheduling control of av_scan_fd_control().
+ */
+typedef struct
+{
+    uint64_t deadline_ns; /**< CLOCK_MONOTONIC time in nanoseconds after which the scan is abandoned (0 = none). */
+    AvYieldCallback yield; /**< Run on the calling thread between chunks, e.g. to scan urgent files first (may be NULL). */
+    void *yield_arg; /**< Argument of yield. */
+} AvScanControl;
+
+AV_API int av_engine_create(AvEngine **engine); // Creates an engine without signatures.
+
+AV_API int av_engine_load(AvEngine *engine, const char *sign_path); // Loads (or replaces) the signature base.
+
+AV_API int av_engine_set_io_limit(AvEngine *engine, uint64_t bytes_per_second, uint64_t reads_per_second); // Limits reads of AV_SCAN_IO_LIMIT scans.
+
+AV_API int av_engine_set_numa(AvEngine *engine); // Keeps one signature replica per NUMA node.
+
+AV_API int av_engine_bind_thread(AvEngine *engine, size_t worker_index); // Binds the calling thread to a NUMA node.
+
+AV_API int av_scan_fd(AvEngine *engine, int fd, int flags, AvScanResult *result); // Scans an open file descriptor.
+
+AV_API int av_scan_fd_control(AvEngine *engine, int fd, int flags, const AvScanControl *control, AvScanResult *result); // Scans a descriptor with a deadline.
+
+AV_API int av_scan_path(AvEngine *engine, const char *file_path, int flags, AvScanResult *result); // Scans a file by path.
+
+AV_API int av_scan_buffer(AvEngine *engine, const void *buffer, size_t size, int flags, AvScanResult *result); // Scans bytes in memory.
+
+AV_API int av_scan_iovec(AvEngine *engine, const struct iovec *iov, int iovcnt, int flags, AvScanResult *result); // Scans scattered buffers as one stream.
+
+AV_API void av_free_result(AvScanResult *result); // Releases memory owned by a scan result.
+
+AV_API void av_engine_destroy(AvEngine *engine); // Releases the engine and its signatures.
+
+AV_API const char *av_strerror(int error); // Describes an error code.
+
+AV_API int av_trace_enable(size_t events_per_thread); // Starts (or with 0 stops) recording scan spans.
+
+AV_API uint64_t av_trace_now(void); // Start time of a span (0 when tracing is off).
+
+AV_API void av_trace_span(const char *name, uint64_t start_ns); // Records a span from start_ns to now.
+
+AV_API void av_trace_file_begin(const char *path); // Attributes the following spans of the thread to a file.
+
+AV_API void av_trace_file_end(void); // Ends the file span opened by av_trace_file_begin().
+
+AV_API int av_trace_dump(const char *path, int format); // Writes the recorded spans to a file.
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBANTIVIRUS_H
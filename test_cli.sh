@@ -0,0 +1,104 @@
+#!/bin/sh
+# Scripted checks of the command line scanner: sweep journal resume, sharding and quarantine.
+#
+#   make check            (or: ./test_cli.sh [path to antivirus])
+#
+# Every check runs in a fresh temporary directory; the quarantine directory is
+# made next to the tree, as quarantining never copies across file systems.
+
+set -eu
+
+ANTIVIRUS=$(cd "$(dirname "${1:-./antivirus}")" && pwd)/$(basename "${1:-./antivirus}")
+WORK=$(mktemp -d)
+trap 'chmod -R u+rwx "$WORK" 2>/dev/null; rm -rf "$WORK"' EXIT
+FAILURES=0
+
+fail()
+{
+    echo "FAIL: $1"
+    FAILURES=$((FAILURES + 1))
+}
+
+# Tree: a/f1..f3 and b/f1..f3 clean, b/evil infected; the root is absolute, as in the journal
+make_tree()
+{
+    rm -rf "$WORK/tree" "$WORK/quarantine" "$WORK"/journal*
+    mkdir -p "$WORK/tree/a" "$WORK/tree/b"
+    for d in a b; do
+        for i in 1 2 3; do
+            echo "clean $d$i" > "$WORK/tree/$d/f$i"
+        done
+    done
+    printf 'xxAAAAAAAAyy' > "$WORK/tree/b/evil"
+    printf '41 41 41 41 41 41 41 41 * FLOAT-AAAA ANY\n' > "$WORK/sig.txt"
+    ROOT=$WORK/tree
+}
+
+# Number of F (clean) and V (infected) records of a path in a journal
+records()
+{
+    grep -c -e "^F $2\$" -e "^V [^ ]* $2\$" "$1" || true
+}
+
+# 1) Resume from a journal whose last record was torn by a crash
+make_tree
+printf 'W %s\nW %s\nD %s\nF %s\nF %s' "$ROOT/b" "$ROOT/a" "$ROOT/b" "$ROOT/a/f1" "$ROOT/a/f" > "$WORK/journal"
+OUTPUT=$("$ANTIVIRUS" --sweep "$WORK/sig.txt" "$WORK/journal" "$ROOT")
+echo "$OUTPUT" | grep -q "Sweep: 2 files scanned, 0 infected, 0 unreadable, 2 files and directories already done" ||
+    fail "torn journal: D and F records not skipped on resume: $OUTPUT"
+grep -q "^F $ROOT/a/f\$" "$WORK/journal" && fail "torn journal: torn line not cut off"
+[ "$(tail -c 1 "$WORK/journal" | od -An -c | tr -d ' ')" = '\n' ] || fail "torn journal: last record not complete"
+for f in f2 f3; do
+    [ "$(records "$WORK/journal" "$ROOT/a/$f")" = 1 ] || fail "torn journal: $ROOT/a/$f not recorded once"
+done
+grep -q "^D $ROOT/a\$" "$WORK/journal" || fail "torn journal: resumed directory not completed"
+
+# 2) Resume from a journal with a NUL-filled tail (blocks allocated, data never written)
+make_tree
+printf 'W %s\nW %s\nD %s\n' "$ROOT/b" "$ROOT/a" "$ROOT/b" > "$WORK/journal"
+head -c 300 /dev/zero >> "$WORK/journal"
+OUTPUT=$("$ANTIVIRUS" --sweep "$WORK/sig.txt" "$WORK/journal" "$ROOT")
+echo "$OUTPUT" | grep -q "Sweep: 3 files scanned, 0 infected, 0 unreadable, 1 files and directories already done" ||
+    fail "NUL tail: unexpected resume: $OUTPUT"
+[ "$(tr -d '\000' < "$WORK/journal" | wc -c)" = "$(wc -c < "$WORK/journal")" ] || fail "NUL tail: NUL bytes left in the journal"
+
+# 3) Two shards over one journal: every file scanned exactly once
+make_tree
+"$ANTIVIRUS" --sweep "$WORK/sig.txt" "$WORK/journal" "$ROOT" 0/2 > "$WORK/shard0" || true
+"$ANTIVIRUS" --sweep "$WORK/sig.txt" "$WORK/journal" "$ROOT" 1/2 > "$WORK/shard1" || true
+for f in a/f1 a/f2 a/f3 b/f1 b/f2 b/f3 b/evil; do
+    [ "$(records "$WORK/journal" "$ROOT/$f")" = 1 ] || fail "shards: $ROOT/$f not recorded once"
+done
+grep -q "^V FLOAT-AAAA $ROOT/b/evil\$" "$WORK/journal" || fail "shards: infected file not recorded"
+[ "$(grep -c '^W ' "$WORK/journal")" = 2 ] || fail "shards: work items written twice"
+grep -q "^D $ROOT/a\$" "$WORK/journal" && grep -q "^D $ROOT/b\$" "$WORK/journal" || fail "shards: a work item not completed"
+grep -q "Sweep: [34] files scanned" "$WORK/shard0" && grep -q "Sweep: [34] files scanned" "$WORK/shard1" ||
+    fail "shards: work not split between the processes"
+
+# 4) Quarantine a planted file: moved, mode 000, sidecar with path, virus and size
+make_tree
+OUTPUT=$("$ANTIVIRUS" --quarantine "$WORK/quarantine" --sweep "$WORK/sig.txt" "$WORK/journal" "$ROOT")
+echo "$OUTPUT" | grep -q "Quarantined FILE($ROOT/b/evil) in $WORK/quarantine" || fail "quarantine: not reported: $OUTPUT"
+[ -e "$ROOT/b/evil" ] && fail "quarantine: file left at its path"
+QUARANTINED=$(ls "$WORK/quarantine" | grep -v '\.meta$' || true)
+if [ "$(echo "$QUARANTINED" | grep -c .)" != 1 ]; then
+    fail "quarantine: expected one quarantined file, found: $QUARANTINED"
+else
+    [ "$(ls -l "$WORK/quarantine/$QUARANTINED" | cut -c1-10)" = "----------" ] || fail "quarantine: mode is not 000"
+    SIDECAR=$WORK/quarantine/$QUARANTINED.meta
+    if [ ! -f "$SIDECAR" ]; then
+        fail "quarantine: no sidecar"
+    else
+        grep -qx "path=$ROOT/b/evil" "$SIDECAR" || fail "quarantine: sidecar path"
+        grep -qx "virus=FLOAT-AAAA" "$SIDECAR" || fail "quarantine: sidecar virus"
+        grep -qx "size=12" "$SIDECAR" || fail "quarantine: sidecar size"
+        grep -qx "method=rename" "$SIDECAR" || fail "quarantine: sidecar method"
+    fi
+fi
+[ "$(records "$WORK/journal" "$ROOT/b/evil")" = 1 ] || fail "quarantine: infected file not in the journal"
+
+if [ "$FAILURES" -ne 0 ]; then
+    echo "$FAILURES check(s) failed"
+    exit 1
+fi
+echo "All checks passed"